@@ -0,0 +1,18 @@
+# Compiles a script ahead of time: `whimsia --emit-cpp` translates it to C++,
+# which is built against //:whimsia_lib the way ./aot does with
+# bin/libwhimsia.a.
+def whimsia_aot(name, script, copts = [], **kwargs):
+    native.genrule(
+        name = name + "_cpp",
+        srcs = [script],
+        outs = [name + ".cpp"],
+        cmd = "$(location //:whimsia) --emit-cpp $< -o $@",
+        tools = ["//:whimsia"],
+    )
+    native.cc_binary(
+        name = name,
+        srcs = [name + ".cpp"],
+        copts = ["-std=c++20", "-fwrapv"] + copts,
+        deps = ["//:whimsia_lib", "//raylib:raylib"],
+        **kwargs
+    )
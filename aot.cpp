@@ -0,0 +1,54 @@
+#include "aot.h"
+
+AotFunction *aot_tail_call = nullptr;
+
+void aot_error(std::string err) { throw EvalError(err); }
+
+// Checks a call through the function table.
+AotFunction *aot_callee(AotFunction *func, const char *name, int argc) {
+  if (func == nullptr) {
+    throw EvalError("function " + std::string(name) + " not defined");
+  }
+  if (argc != func->arity) {
+    throw EvalError("invalid number of arguments");
+  }
+  return func;
+}
+
+// Runs func on the frame pushed for it and pops the frame again. A function
+// ending in `return g(...)` leaves the arguments on top of its frame and
+// sets aot_tail_call, g then runs in the same frame like in call_function().
+Object *aot_call(AotFunction *func, Object **frame) {
+  Object *ret = func->code(frame);
+  while (aot_tail_call != nullptr) {
+    AotFunction *next = aot_tail_call;
+    aot_tail_call = nullptr;
+    frame = call_stack.reuse(frame, func->slots, next->arity, next->slots);
+    func = next;
+    ret = func->code(frame);
+  }
+  call_stack.pop(func->slots);
+  return ret;
+}
+
+// Checks arr[prop] like evaluate_expression() and returns the index.
+int aot_index(Object *arr, Object *prop) {
+  if (arr == nullptr) {
+    throw EvalError("object not defined");
+  }
+  if (prop->type() != IntType) {
+    throw EvalError("invalid property type");
+  }
+  int index = ((IntegerObject *)prop)->value;
+  if (index < 0 || index >= ((ArrayObject *)arr)->elements.size()) {
+    throw EvalError("index out of bounds");
+  }
+  return index;
+}
+
+int aot_main(void (*program)(Object **globals), int num_globals) {
+  srand(time(0));
+  call_stack.register_roots();
+  program(call_stack.push(num_globals));
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "ast.h"
+#include "builtins.h"
+#include "common.h"
+#include "eval.h"
+#include "gc.h"
+
+#ifndef aot_h
+#define aot_h
+
+// Runtime support for the C++ that --emit-cpp generates. Script functions
+// take their frame on the CallStack like in evaluate(), which keeps every
+// boxed variable a GC root; ints and floats that never hold anything else
+// are plain C++ locals with a flag for whether they are defined yet.
+class AotFunction {
+public:
+  Object *(*code)(Object **frame);
+  int arity;
+  int slots;
+};
+
+[[noreturn]] void aot_error(std::string err);
+
+inline void aot_check_read(bool defined, const char *name) {
+  if (!defined) {
+    aot_error("undefined identifier: " + std::string(name));
+  }
+}
+
+inline void aot_check_let(bool defined, const char *name) {
+  if (defined) {
+    aot_error("variable already defined: " + std::string(name));
+  }
+}
+
+inline void aot_check_assign(bool defined) {
+  if (!defined) {
+    aot_error("variable not defined");
+  }
+}
+
+inline void aot_safepoint() {
+  if (heap.no_gc_depth == 0) {
+    heap.safepoint();
+  }
+}
+
+extern AotFunction *aot_tail_call;
+
+AotFunction *aot_callee(AotFunction *func, const char *name, int argc);
+
+Object *aot_call(AotFunction *func, Object **frame);
+
+int aot_index(Object *arr, Object *prop);
+
+int aot_main(void (*program)(Object **globals), int num_globals);
+
+#endif // !aot_h
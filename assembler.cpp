@@ -0,0 +1,231 @@
+#include "assembler.h"
+#include <cstring>
+#include <sys/mman.h>
+
+Mem::Mem(Reg base, int32_t disp) : base(base), index(NoReg), disp(disp) {}
+
+Mem::Mem(Reg base, Reg index, int32_t disp)
+    : base(base), index(index), disp(disp) {}
+
+void Assembler::byte(uint8_t b) { code.push_back(b); }
+
+void Assembler::int32(int32_t value) {
+  for (int i = 0; i < 4; i++) {
+    byte(value >> (8 * i));
+  }
+}
+
+// REX.W prefix with the high bits of the register numbers.
+void Assembler::rex(int reg, int index, int base) {
+  byte(0x48 | (reg >= 8) << 2 | (index >= 8) << 1 | (base >= 8));
+}
+
+// Always uses a 32 bit displacement, which sidesteps the special cases of
+// RBP/R13 as base without displacement.
+void Assembler::modrm(int reg, Mem mem) {
+  if (mem.index == NoReg && (mem.base & 7) != RSP) {
+    byte(0x80 | (reg & 7) << 3 | (mem.base & 7));
+  } else {
+    int index = mem.index == NoReg ? RSP : mem.index;
+    int scale = mem.index == NoReg ? 0 : 3;
+    byte(0x80 | (reg & 7) << 3 | RSP);
+    byte(scale << 6 | (index & 7) << 3 | (mem.base & 7));
+  }
+  int32(mem.disp);
+}
+
+void Assembler::op_reg(uint8_t opcode, int reg, Reg rm) {
+  rex(reg, 0, rm);
+  byte(opcode);
+  byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// Same for the two byte opcodes 0f xx.
+void Assembler::op_reg2(uint8_t opcode, int reg, Reg rm) {
+  rex(reg, 0, rm);
+  byte(0x0f);
+  byte(opcode);
+  byte(0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+void Assembler::op_mem(uint8_t opcode, int reg, Mem mem) {
+  rex(reg, mem.index == NoReg ? 0 : mem.index, mem.base);
+  byte(opcode);
+  modrm(reg, mem);
+}
+
+void Assembler::push(Reg reg) {
+  if (reg >= 8) {
+    byte(0x41);
+  }
+  byte(0x50 | (reg & 7));
+}
+
+void Assembler::pop(Reg reg) {
+  if (reg >= 8) {
+    byte(0x41);
+  }
+  byte(0x58 | (reg & 7));
+}
+
+void Assembler::mov(Reg dst, Reg src) { op_reg(0x89, src, dst); }
+
+void Assembler::mov(Reg dst, Mem src) { op_mem(0x8b, dst, src); }
+
+void Assembler::mov(Mem dst, Reg src) { op_mem(0x89, src, dst); }
+
+void Assembler::mov(Mem dst, int32_t imm) {
+  op_mem(0xc7, 0, dst);
+  int32(imm);
+}
+
+void Assembler::mov_imm64(Reg dst, uint64_t imm) {
+  rex(0, 0, dst);
+  byte(0xb8 | (dst & 7));
+  for (int i = 0; i < 8; i++) {
+    byte(imm >> (8 * i));
+  }
+}
+
+void Assembler::mov_imm32(Reg dst, int32_t imm) {
+  if (dst >= 8) {
+    byte(0x41);
+  }
+  byte(0xb8 | (dst & 7));
+  int32(imm);
+}
+
+void Assembler::lea(Reg dst, Mem src) { op_mem(0x8d, dst, src); }
+
+void Assembler::inc(Reg reg) { op_reg(0xff, 0, reg); }
+
+void Assembler::dec(Reg reg) { op_reg(0xff, 1, reg); }
+
+void Assembler::movsxd(Reg dst, Reg src) { op_reg(0x63, dst, src); }
+
+void Assembler::movsxd(Reg dst, Mem src) { op_mem(0x63, dst, src); }
+
+void Assembler::movzx8(Reg dst, Reg src) { op_reg2(0xb6, dst, src); }
+
+void Assembler::add(Reg reg, int32_t imm) {
+  op_reg(0x81, 0, reg);
+  int32(imm);
+}
+
+void Assembler::sub(Reg reg, int32_t imm) {
+  op_reg(0x81, 5, reg);
+  int32(imm);
+}
+
+void Assembler::add(Reg dst, Reg src) { op_reg(0x01, src, dst); }
+
+void Assembler::sub(Reg dst, Reg src) { op_reg(0x29, src, dst); }
+
+void Assembler::imul(Reg dst, Reg src) { op_reg2(0xaf, dst, src); }
+
+void Assembler::and_(Reg dst, Reg src) { op_reg(0x21, src, dst); }
+
+void Assembler::or_(Reg dst, Reg src) { op_reg(0x09, src, dst); }
+
+void Assembler::cqo() {
+  byte(0x48);
+  byte(0x99);
+}
+
+void Assembler::idiv(Reg divisor) { op_reg(0xf7, 7, divisor); }
+
+void Assembler::cmp(Reg left, Reg right) { op_reg(0x39, right, left); }
+
+void Assembler::cmp(Mem left, int32_t imm) {
+  op_mem(0x81, 7, left);
+  int32(imm);
+}
+
+void Assembler::test(Reg left, Reg right) { op_reg(0x85, right, left); }
+
+void Assembler::test8(Reg reg) {
+  // test r8, r8 for the low byte registers without REX (al, cl, dl, bl).
+  byte(0x84);
+  byte(0xc0 | (reg & 7) << 3 | (reg & 7));
+}
+
+void Assembler::setcc(Cond cond, Reg reg) {
+  // Like test8, only for al, cl, dl and bl.
+  byte(0x0f);
+  byte(0x90 | cond);
+  byte(0xc0 | (reg & 7));
+}
+
+void Assembler::call(Reg target) {
+  if (target >= 8) {
+    byte(0x41);
+  }
+  byte(0xff);
+  byte(0xd0 | (target & 7));
+}
+
+void Assembler::call(void *target) {
+  mov_imm64(RAX, (uint64_t)target);
+  call(RAX);
+}
+
+void Assembler::jmp(Reg target) {
+  if (target >= 8) {
+    byte(0x41);
+  }
+  byte(0xff);
+  byte(0xe0 | (target & 7));
+}
+
+void Assembler::jmp(Label &label) {
+  byte(0xe9);
+  label_use(label);
+}
+
+void Assembler::jcc(Cond cond, Label &label) {
+  byte(0x0f);
+  byte(0x80 | cond);
+  label_use(label);
+}
+
+void Assembler::ret() { byte(0xc3); }
+
+void Assembler::label_use(Label &label) {
+  if (label.offset >= 0) {
+    int32(label.offset - (offset() + 4));
+  } else {
+    label.uses.push_back(offset());
+    int32(0);
+  }
+}
+
+void Assembler::bind(Label &label) {
+  label.offset = offset();
+  for (auto use : label.uses) {
+    int32_t rel = label.offset - (use + 4);
+    for (int i = 0; i < 4; i++) {
+      code[use + i] = rel >> (8 * i);
+    }
+  }
+  label.uses.clear();
+}
+
+int Assembler::offset() { return code.size(); }
+
+// Copies the code to freshly mapped memory that is made executable once the
+// code is written. Returns nullptr if that fails.
+uint8_t *Assembler::install() {
+  void *memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    return nullptr;
+  }
+  memcpy(memory, code.data(), code.size());
+  if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, code.size());
+    return nullptr;
+  }
+  return (uint8_t *)memory;
+}
+
+void uninstall(uint8_t *memory, size_t size) { munmap(memory, size); }
@@ -0,0 +1,111 @@
+#include "common.h"
+
+#ifndef assembler_h
+#define assembler_h
+
+enum Reg {
+  RAX,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+  NoReg = -1,
+};
+
+enum Cond {
+  CondAboveEqual = 0x3,
+  CondEqual = 0x4,
+  CondNotEqual = 0x5,
+  CondLess = 0xc,
+  CondGreaterEqual = 0xd,
+  CondLessEqual = 0xe,
+  CondGreater = 0xf,
+};
+
+// A memory operand [base + index * 8 + disp].
+class Mem {
+public:
+  Mem(Reg base, int32_t disp = 0);
+  Mem(Reg base, Reg index, int32_t disp = 0);
+  Reg base;
+  Reg index;
+  int32_t disp;
+};
+
+// Position in the code; jumps to a label that is not bound yet are patched
+// when it is.
+class Label {
+public:
+  int offset = -1;
+  std::vector<int> uses;
+};
+
+// Emits the handful of x86-64 instructions the JIT needs. All operations are
+// 64 bit unless the name says otherwise.
+class Assembler {
+public:
+  std::vector<uint8_t> code;
+
+  void push(Reg reg);
+  void pop(Reg reg);
+  void mov(Reg dst, Reg src);
+  void mov(Reg dst, Mem src);
+  void mov(Mem dst, Reg src);
+  void mov(Mem dst, int32_t imm);
+  void mov_imm64(Reg dst, uint64_t imm);
+  void mov_imm32(Reg dst, int32_t imm);
+  void lea(Reg dst, Mem src);
+  void inc(Reg reg);
+  void dec(Reg reg);
+  void movsxd(Reg dst, Reg src);
+  void movsxd(Reg dst, Mem src);
+  void movzx8(Reg dst, Reg src);
+  void add(Reg reg, int32_t imm);
+  void sub(Reg reg, int32_t imm);
+  void add(Reg dst, Reg src);
+  void sub(Reg dst, Reg src);
+  void imul(Reg dst, Reg src);
+  void and_(Reg dst, Reg src);
+  void or_(Reg dst, Reg src);
+  void cqo();
+  void idiv(Reg divisor);
+  void cmp(Reg left, Reg right);
+  void cmp(Mem left, int32_t imm);
+  void test(Reg left, Reg right);
+  void test8(Reg reg);
+  void setcc(Cond cond, Reg reg);
+  void call(Reg target);
+  void call(void *target);
+  void jmp(Reg target);
+  void jmp(Label &label);
+  void jcc(Cond cond, Label &label);
+  void ret();
+  void bind(Label &label);
+  int offset();
+  uint8_t *install();
+
+private:
+  void byte(uint8_t b);
+  void int32(int32_t value);
+  void rex(int reg, int index, int base);
+  void modrm(int reg, Mem mem);
+  void op_reg(uint8_t opcode, int reg, Reg rm);
+  void op_reg2(uint8_t opcode, int reg, Reg rm);
+  void op_mem(uint8_t opcode, int reg, Mem mem);
+  void label_use(Label &label);
+};
+
+void uninstall(uint8_t *memory, size_t size);
+
+#endif // !assembler_h
@@ -3,18 +3,58 @@
 #include "utils.h"
 
 Environment::Environment() {}
+Environment::Environment(Object **slots, Environment *globals)
+    : slots(slots), globals(globals) {}
 
 Object *Environment::get_identifier(std::string name) {
-  if (store.find(name) != store.end()) {
-    return store[name];
+  auto entry = store.find(name);
+  if (entry != store.end()) {
+    return entry->second;
   }
   return nullptr;
 }
 
 void Environment::set_identifier(std::string name, Object *obj) {
   store[name] = obj;
+  heap.write_barrier(this, obj);
 }
 
+bool Environment::has(Identifier *ident) {
+  if (slots != nullptr) {
+    return ident->slot >= 0 && slots[ident->slot] != nullptr;
+  }
+  return store.find(ident->name) != store.end();
+}
+
+Object *Environment::get(Identifier *ident) {
+  if (slots != nullptr) {
+    return ident->slot >= 0 ? slots[ident->slot] : nullptr;
+  }
+  return get_identifier(ident->name);
+}
+
+void Environment::set(Identifier *ident, Object *obj) {
+  if (slots != nullptr) {
+    slots[ident->slot] = obj;
+    return;
+  }
+  set_identifier(ident->name, obj);
+}
+
+FunctionObject *Environment::get_function(std::string &name) {
+  auto func = functions.find(name);
+  if (func != functions.end()) {
+    return func->second;
+  }
+  if (globals != nullptr) {
+    return globals->get_function(name);
+  }
+  return nullptr;
+}
+
+void *Object::operator new(size_t size) { return heap.allocate(size); }
+void Object::operator delete(void *ptr) { heap.release(ptr); }
+
 Literal::Literal(std::string value, DataType data_type)
     : value(value), data_type(data_type){};
 std::string Literal::to_string() {
@@ -30,6 +70,21 @@ std::string Identifier::to_string() {
 std::string Identifier::statement_type() { return type; };
 
 IntegerObject::IntegerObject(int value) : value(value){};
+IntegerObject *IntegerObject::make(int value) {
+  const int min = -128, max = 1023;
+  static std::vector<IntegerObject *> cache = [] {
+    std::vector<IntegerObject *> objs;
+    for (int i = min; i <= max; i++) {
+      objs.push_back(::new (heap.allocate_pinned(sizeof(IntegerObject)))
+                         IntegerObject(i));
+    }
+    return objs;
+  }();
+  if (value >= min && value <= max) {
+    return cache[value - min];
+  }
+  return new IntegerObject(value);
+}
 DataType IntegerObject::type() { return IntType; };
 std::string IntegerObject::inspect() { return std::to_string(value); }
 bool IntegerObject::is_truthy() { return value != 0; }
@@ -39,12 +94,21 @@ DataType FloatObject::type() { return FloatType; }
 std::string FloatObject::inspect() { return std::to_string(value); }
 bool FloatObject::is_truthy() { return value != 0; }
 
-StringObject::StringObject(std::string value) : value(value) {}
+StringObject::StringObject(std::string value) : value(value) {
+  heap.register_finalizer(this);
+}
 DataType StringObject::type() { return StringType; }
 std::string StringObject::inspect() { return value; }
 bool StringObject::is_truthy() { return value != ""; }
 
 BoolObject::BoolObject(bool value) : value(value) {}
+BoolObject *BoolObject::make(bool value) {
+  static BoolObject *true_obj =
+      ::new (heap.allocate_pinned(sizeof(BoolObject))) BoolObject(true);
+  static BoolObject *false_obj =
+      ::new (heap.allocate_pinned(sizeof(BoolObject))) BoolObject(false);
+  return value ? true_obj : false_obj;
+}
 DataType BoolObject::type() { return BoolType; }
 std::string BoolObject::inspect() { return std::to_string(value); }
 bool BoolObject::is_truthy() { return value; }
@@ -133,7 +197,12 @@ std::string ArrayExpression::to_string() {
          "\",\n\"elements\": " + nodes_to_str(elements) + "\n}";
 }
 
-ArrayObject::ArrayObject(std::vector<Object *> ele) : elements(ele) {}
+ArrayObject::ArrayObject(std::vector<Object *> ele) : elements(ele) {
+  heap.register_finalizer(this);
+  for (auto elem : elements) {
+    heap.write_barrier(this, elem);
+  }
+}
 bool ArrayObject::is_truthy() { return elements.size() != 0; }
 DataType ArrayObject::type() { return ArrayType; }
 std::string ArrayObject::inspect() {
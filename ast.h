@@ -1,9 +1,12 @@
+#include "gc.h"
 #include "lexer.h"
 #include "tokens.h"
 
 #ifndef ast_h
 #define ast_h
 
+class Trace;
+
 class Node {
 public:
   virtual std::string statement_type() = 0;
@@ -18,6 +21,8 @@ public:
   std::string type = "Literal";
   DataType data_type;
   std::string value;
+  // Set by EscapeAnalysis when the value never leaves its statement.
+  bool temporary = false;
 };
 
 class Identifier : public Node {
@@ -27,19 +32,24 @@ public:
   std::string statement_type();
   std::string type = "Identifier";
   std::string name;
+  int slot = -1;
 };
 
 class Object {
 public:
+  virtual ~Object() = default;
   virtual DataType type() = 0;
   virtual std::string inspect() = 0;
   virtual bool is_truthy() = 0;
+  static void *operator new(size_t size);
+  static void operator delete(void *ptr);
 };
 
 class IntegerObject : public Object {
 public:
   IntegerObject();
   IntegerObject(int val);
+  static IntegerObject *make(int val);
   DataType type();
   std::string inspect();
   bool is_truthy();
@@ -69,6 +79,7 @@ class BoolObject : public Object {
 public:
   BoolObject();
   BoolObject(bool value);
+  static BoolObject *make(bool value);
   DataType type();
   std::string inspect();
   bool is_truthy();
@@ -83,6 +94,15 @@ public:
   std::string inspect();
   bool is_truthy();
   std::vector<Object *> elements;
+  bool dirty = false;
+};
+
+// Copy of a function body for the calls whose arguments have the types
+// encoded in `signature`, see function_body() in eval.cpp.
+class FunctionClone {
+public:
+  uint64_t signature;
+  std::vector<Node *> body;
 };
 
 class FunctionObject {
@@ -91,16 +111,57 @@ public:
   FunctionObject(std::vector<Node *> &b, std::vector<std::string> &p);
   std::vector<std::string> params;
   std::vector<Node *> body;
+  int num_slots = 0;
+  std::vector<FunctionClone *> clones;
+  std::unordered_map<uint64_t, int> signature_calls;
 };
 
+// A function call runs in a frame environment whose variables live in fixed
+// slots on the call stack instead of in `store`; identifiers in the function
+// body are resolved to those slots when the function is defined.
 class Environment {
 public:
   Environment();
+  Environment(Object **slots, Environment *globals);
   std::unordered_map<std::string, Object *> store;
   std::unordered_map<std::string, FunctionObject *> functions;
+  Object **slots = nullptr;
+  Environment *globals = nullptr;
+  bool returning = false;
+  FunctionObject *tail_call = nullptr;
+  bool dirty = false;
 
   Object *get_identifier(std::string name);
   void set_identifier(std::string name, Object *obj);
+  bool has(Identifier *ident);
+  Object *get(Identifier *ident);
+  void set(Identifier *ident, Object *obj);
+  FunctionObject *get_function(std::string &name);
+};
+
+// What a BinaryExpression has been specialized to by evaluate_expression()
+// after its first evaluation. QuickIntConst is an int operation whose right
+// operand is an int literal, kept in right_int.
+enum BinaryQuick {
+  QuickUnset,
+  QuickGeneric,
+  QuickInt,
+  QuickIntConst,
+  QuickFloat,
+};
+
+// Shapes NodeFuser has found a statement or expression to have, which the
+// evaluator runs in one step instead of walking the node's children:
+// FusedAddConst is `x = x + c` or `x = x - c` with an int literal c,
+// FusedNegate `x = x * -1` (c is kept in fused_constant for both),
+// FusedCompare a comparison of two identifiers and FusedModEqual
+// `e % m == k` with int literals m > 0 and k (kept in modulus and right_int).
+enum FusedShape {
+  FusedNone,
+  FusedAddConst,
+  FusedNegate,
+  FusedCompare,
+  FusedModEqual,
 };
 
 class BinaryExpression : public Node {
@@ -112,6 +173,11 @@ public:
   Node *left;
   Token op;
   Node *right;
+  BinaryQuick quick = QuickUnset;
+  int right_int = 0;
+  bool temporary = false;
+  FusedShape fused = FusedNone;
+  int modulus = 0;
 };
 
 class LetStatement : public Node {
@@ -135,6 +201,8 @@ public:
   Node *condition;
   std::vector<Node *> consequent;
   std::vector<Node *> alternate;
+  // The condition is a FusedCompare, branched on without making its value.
+  bool fused_compare = false;
 };
 
 class ReturnStatement : public Node {
@@ -144,6 +212,7 @@ public:
   std::string statement_type();
   std::string type = "ReturnStatement";
   Node *value;
+  bool tail_call = false;
 };
 
 class FunctionStatement : public Node {
@@ -168,6 +237,37 @@ public:
   std::vector<Node *> args;
 };
 
+class CountedLoop;
+class MemberExpression;
+
+// An array read `a[i + offset]` in the body of a counted loop.
+class IndexAccess {
+public:
+  MemberExpression *node;
+  int offset;
+};
+
+// A `while (i < n) { ...; i = i + step }` loop in which nothing else
+// assigns i or n, run by the evaluator with i kept in a C++ int. The
+// condition may also compare `i + cond_offset`. `body` is the block without
+// the increment and `limit` the bound if it is a literal. `unchecked_body`
+// is a copy of it whose reads in `accesses` skip their checks, run when
+// they are known to stay in bounds; `index` is i while it runs.
+class CountedLoop {
+public:
+  Identifier *counter;
+  Node *bound;
+  int limit = 0;
+  TokenType op;
+  int cond_offset = 0;
+  int step;
+  bool counter_read = false;
+  std::vector<Node *> body;
+  std::vector<IndexAccess> accesses;
+  std::vector<Node *> unchecked_body;
+  int index = 0;
+};
+
 class WhileStatement : public Node {
 public:
   WhileStatement(Node *condition, std::vector<Node *> block);
@@ -176,6 +276,12 @@ public:
   std::string type = "WhileStatement";
   Node *condition;
   std::vector<Node *> block;
+  int hotness = 0;
+  bool untraceable = false;
+  Trace *trace = nullptr;
+  bool counted_checked = false;
+  CountedLoop *counted = nullptr;
+  bool fused_compare = false;
 };
 
 class AssignmentExpression : public Node {
@@ -186,6 +292,8 @@ public:
   std::string type = "AssignmentExpression";
   Identifier ident;
   Node *value;
+  FusedShape fused = FusedNone;
+  int fused_constant = 0;
 };
 
 class ArrayExpression : public Node {
@@ -205,6 +313,10 @@ public:
   std::string type = "MemberExpression";
   Node *object;
   Node *property;
+  // Set in the copies of CountedLoop::unchecked_body: the element read is
+  // counted->index + offset, without any checks.
+  CountedLoop *counted = nullptr;
+  int offset = 0;
 };
 
 #endif // !ast_h
@@ -20,196 +20,159 @@ const std::unordered_map<std::string, TraceLogLevel> GetRaylibLogLevel = {
     {"log_fatal", LOG_FATAL},     {"log_none", LOG_NONE}};
 
 const std::unordered_map<std::string,
-                         std::function<Object *(Node *, Environment *env)>>
+                         std::function<Object *(std::vector<Object *> &args)>>
     BuiltinFunctions = {
         {"print",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           for (int i = 0; i < callNode->args.size(); ++i) {
-             if (callNode->args[i]->statement_type() == "ArrayExpression") {
-               std::cout << nodes_to_str(
-                   ((ArrayExpression *)callNode->args[i])->elements);
-               continue;
-             }
-             Object *obj = evaluate_expression(callNode->args[i], global_env);
-             std::cout << obj->inspect()
-                       << ((i == callNode->args.size() - 1) ? "" : " ");
+         [](std::vector<Object *> &args) -> Object * {
+           for (int i = 0; i < args.size(); ++i) {
+             std::cout << args[i]->inspect()
+                       << ((i == args.size() - 1) ? "" : " ");
            }
            return nullptr;
          }},
         {"rand_int",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           for (auto arg : callNode->args) {
-             Object *obj = evaluate_expression(arg, global_env);
-             std::cout << obj->inspect() << " ";
+         [](std::vector<Object *> &args) -> Object * {
+           for (auto arg : args) {
+             std::cout << arg->inspect() << " ";
            }
-           IntegerObject *obj = new IntegerObject(rand());
+           IntegerObject *obj = IntegerObject::make(rand());
            return obj;
          }},
         {"println",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           for (int i = 0; i < callNode->args.size(); ++i) {
-             if (callNode->args[i]->statement_type() == "ArrayExpression") {
-               std::cout << nodes_to_str(
-                   ((ArrayExpression *)callNode->args[i])->elements);
-               continue;
-             }
-             Object *obj = evaluate_expression(callNode->args[i], global_env);
-             std::cout << obj->inspect()
-                       << ((i == callNode->args.size() - 1) ? "" : " ");
+         [](std::vector<Object *> &args) -> Object * {
+           for (int i = 0; i < args.size(); ++i) {
+             std::cout << args[i]->inspect()
+                       << ((i == args.size() - 1) ? "" : " ");
            }
            std::cout << "\n";
            return nullptr;
          }},
         {"len",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           Object *obj = evaluate_expression(callNode->args[0], global_env);
+           Object *obj = args[0];
            if (obj->type() != StringType) {
              throw EvalError("invalid argument type, expected string");
            }
-           Object *ret = new IntegerObject(((StringObject *)obj)->value.size());
+           Object *ret =
+               IntegerObject::make(((StringObject *)obj)->value.size());
            return ret;
          }},
         {"ceil",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           Object *obj = evaluate_expression(callNode->args[0], global_env);
+           Object *obj = args[0];
            Object *ret;
            if (obj->type() == FloatType) {
-             ret = new IntegerObject((int)ceil(((FloatObject *)obj)->value));
+             ret =
+                 IntegerObject::make((int)ceil(((FloatObject *)obj)->value));
            } else if (obj->type() == IntType) {
-             ret = new IntegerObject(((IntegerObject *)obj)->value);
+             ret = IntegerObject::make(((IntegerObject *)obj)->value);
            } else {
              throw EvalError("invalid argument type, expected float or int");
            }
            return ret;
          }},
         {"floor",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           Object *obj = evaluate_expression(callNode->args[0], global_env);
+           Object *obj = args[0];
            Object *ret;
            if (obj->type() == FloatType) {
-             ret = new IntegerObject((int)floor(((FloatObject *)obj)->value));
+             ret =
+                 IntegerObject::make((int)floor(((FloatObject *)obj)->value));
            } else if (obj->type() == IntType) {
-             ret = new IntegerObject(((IntegerObject *)obj)->value);
+             ret = IntegerObject::make(((IntegerObject *)obj)->value);
            } else {
              throw EvalError("invalid argument type, expected float or int");
            }
            return ret;
          }},
         {"make_window",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 3) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 3) {
              throw EvalError("invalid number of arguments");
            }
-           int width = ((IntegerObject *)evaluate_expression(callNode->args[0],
-                                                             global_env))
-                           ->value;
-           int height = ((IntegerObject *)evaluate_expression(callNode->args[1],
-                                                              global_env))
-                            ->value;
+           int width = ((IntegerObject *)args[0])->value;
+           int height = ((IntegerObject *)args[1])->value;
 
-           std::string title = ((StringObject *)evaluate_expression(
-                                    callNode->args[2], global_env))
-                                   ->value;
+           std::string title = ((StringObject *)args[2])->value;
            InitWindow(width, height, title.c_str());
            return nullptr;
          }},
         {"begin_drawing",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 0) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 0) {
              throw EvalError("invalid number of arguments");
            }
            BeginDrawing();
            return nullptr;
          }},
         {"end_drawing",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 0) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 0) {
              throw EvalError("invalid number of arguments");
            }
            EndDrawing();
+           heap.end_frame();
            return nullptr;
          }},
         {"windows_should_close",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 0) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 0) {
              throw EvalError("invalid number of arguments");
            }
-           BoolObject *obj = new BoolObject(WindowShouldClose());
+           BoolObject *obj = BoolObject::make(WindowShouldClose());
            return obj;
          }},
         {"close_window",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 0) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 0) {
              throw EvalError("invalid number of arguments");
            }
            CloseWindow();
            return nullptr;
          }},
         {"to_int",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           float val = ((FloatObject *)evaluate_expression(callNode->args[0],
-                                                           global_env))
-                           ->value;
-           IntegerObject *obj = new IntegerObject(floor(val));
+           float val = ((FloatObject *)args[0])->value;
+           IntegerObject *obj = IntegerObject::make(floor(val));
            return obj;
          }},
         {"to_str",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           std::string s =
-               evaluate_expression(callNode->args[0], global_env)->inspect();
+           std::string s = args[0]->inspect();
 
            StringObject *obj = new StringObject(s);
            return obj;
          }},
         {"wait_time",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           float time = ((FloatObject *)evaluate_expression(callNode->args[0],
-                                                            global_env))
-                            ->value;
+           float time = ((FloatObject *)args[0])->value;
            WaitTime(time / 1000.0);
            return nullptr;
          }},
         {"clr_bg",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           std::string color = ((StringObject *)evaluate_expression(
-                                    callNode->args[0], global_env))
-                                   ->value;
+           std::string color = ((StringObject *)args[0])->value;
            if (GetRaylibColor.find(color) == GetRaylibColor.end()) {
              throw EvalError("invalid color");
            }
@@ -217,27 +180,16 @@ const std::unordered_map<std::string,
            return nullptr;
          }},
         {"draw_rec",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 5) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 5) {
              throw EvalError("invalid number of arguments");
            }
-           int posx = (int)((IntegerObject *)evaluate_expression(
-                                callNode->args[0], global_env))
-                          ->value;
+           int posx = (int)((IntegerObject *)args[0])->value;
 
-           int posy = (int)((IntegerObject *)evaluate_expression(
-                                callNode->args[1], global_env))
-                          ->value;
-           int width = (int)((IntegerObject *)evaluate_expression(
-                                 callNode->args[2], global_env))
-                           ->value;
-           int height = (int)((IntegerObject *)evaluate_expression(
-                                  callNode->args[3], global_env))
-                            ->value;
-           std::string color = ((StringObject *)evaluate_expression(
-                                    callNode->args[4], global_env))
-                                   ->value;
+           int posy = (int)((IntegerObject *)args[1])->value;
+           int width = (int)((IntegerObject *)args[2])->value;
+           int height = (int)((IntegerObject *)args[3])->value;
+           std::string color = ((StringObject *)args[4])->value;
            if (GetRaylibColor.find(color) == GetRaylibColor.end()) {
              throw EvalError("invalid color");
            }
@@ -246,27 +198,16 @@ const std::unordered_map<std::string,
            return nullptr;
          }},
         {"draw_text",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 5) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 5) {
              throw EvalError("invalid number of arguments");
            }
-           std::string text = ((StringObject *)evaluate_expression(
-                                   callNode->args[0], global_env))
-                                  ->value;
-           int posx = (int)((IntegerObject *)evaluate_expression(
-                                callNode->args[1], global_env))
-                          ->value;
+           std::string text = ((StringObject *)args[0])->value;
+           int posx = (int)((IntegerObject *)args[1])->value;
 
-           int posy = (int)((IntegerObject *)evaluate_expression(
-                                callNode->args[2], global_env))
-                          ->value;
-           int font_size = (int)((IntegerObject *)evaluate_expression(
-                                     callNode->args[3], global_env))
-                               ->value;
-           std::string color = ((StringObject *)evaluate_expression(
-                                    callNode->args[4], global_env))
-                                   ->value;
+           int posy = (int)((IntegerObject *)args[2])->value;
+           int font_size = (int)((IntegerObject *)args[3])->value;
+           std::string color = ((StringObject *)args[4])->value;
            if (GetRaylibColor.find(color) == GetRaylibColor.end()) {
              throw EvalError("invalid color");
            }
@@ -275,24 +216,15 @@ const std::unordered_map<std::string,
            return nullptr;
          }},
         {"draw_circle",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 4) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 4) {
              throw EvalError("invalid number of arguments");
            }
-           int centerX = ((IntegerObject *)evaluate_expression(
-                              callNode->args[0], global_env))
-                             ->value;
+           int centerX = ((IntegerObject *)args[0])->value;
 
-           int centerY = ((IntegerObject *)evaluate_expression(
-                              callNode->args[1], global_env))
-                             ->value;
-           float radius = (float)((FloatObject *)evaluate_expression(
-                                      callNode->args[2], global_env))
-                              ->value;
-           std::string color = ((StringObject *)evaluate_expression(
-                                    callNode->args[3], global_env))
-                                   ->value;
+           int centerY = ((IntegerObject *)args[1])->value;
+           float radius = ((FloatObject *)args[2])->value;
+           std::string color = ((StringObject *)args[3])->value;
            if (GetRaylibColor.find(color) == GetRaylibColor.end()) {
              throw EvalError("invalid color");
            }
@@ -301,31 +233,25 @@ const std::unordered_map<std::string,
            return nullptr;
          }},
         {"is_key_down",
-         [](Node *node, Environment *global_env) -> Object * {
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+         [](std::vector<Object *> &args) -> Object * {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           std::string key = ((StringObject *)evaluate_expression(
-                                  callNode->args[0], global_env))
-                                 ->value;
+           std::string key = ((StringObject *)args[0])->value;
            if (GetRaylibKey.find(key) == GetRaylibKey.end()) {
              throw EvalError("invalid key");
            }
            BoolObject *obj =
-               new BoolObject(IsKeyDown(GetRaylibKey.find(key)->second));
+               BoolObject::make(IsKeyDown(GetRaylibKey.find(key)->second));
            return obj;
          }},
         {"set_log_level",
-         [](Node *node, Environment *global_env) -> Object * {
+         [](std::vector<Object *> &args) -> Object * {
            SetTraceLogLevel(LOG_NONE);
-           CallExpression *callNode = (CallExpression *)node;
-           if (callNode->args.size() != 1) {
+           if (args.size() != 1) {
              throw EvalError("invalid number of arguments");
            }
-           std::string key = ((StringObject *)evaluate_expression(
-                                  callNode->args[0], global_env))
-                                 ->value;
+           std::string key = ((StringObject *)args[0])->value;
            if (GetRaylibLogLevel.find(key) == GetRaylibLogLevel.end()) {
              throw EvalError("invalid key");
            }
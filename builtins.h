@@ -11,7 +11,7 @@ extern const std::unordered_map<std::string, KeyboardKey> GetRaylibKey;
 extern const std::unordered_map<std::string, TraceLogLevel> GetRaylibLogLevel;
 
 extern const std::unordered_map<std::string,
-                   std::function<Object *(Node *, Environment *env)>>
+                   std::function<Object *(std::vector<Object *> &args)>>
     BuiltinFunctions;
 
 #endif // !builtin_functions_h
@@ -0,0 +1,80 @@
+#include "bytecode.h"
+#include "eval.h"
+
+const char *OpCodeNames[] = {
+    "CONST",         "NULL",         "LOAD_GLOBAL",     "STORE_GLOBAL",
+    "DEFINE_GLOBAL", "LOAD_LOCAL",   "STORE_LOCAL",     "DEFINE_LOCAL",
+    "BINARY",        "JUMP",         "JUMP_IF_FALSE",   "LOOP",
+    "CALL",          "TAIL_CALL",    "CALL_BUILTIN",    "RETURN",
+    "ARRAY",         "INDEX_GLOBAL", "INDEX_LOCAL",     "POP",
+    "DEFINE_FUNCTION", "HALT",
+};
+
+int opcode_operands(int op) {
+  switch (op) {
+  case OpCall:
+  case OpTailCall:
+  case OpCallBuiltin:
+  case OpDefineFunction: {
+    return 2;
+  }
+  case OpNull:
+  case OpReturn:
+  case OpPop:
+  case OpHalt: {
+    return 0;
+  }
+  default: {
+    return 1;
+  }
+  }
+}
+
+std::string CompiledProgram::disassemble() {
+  std::stringstream out;
+  for (int i = 0; i < constants.size(); i++) {
+    out << "const " << i << ": " << constants[i]->inspect() << "\n";
+  }
+  for (auto func : functions) {
+    out << "function " << func->name << " (params " << func->num_params
+        << ", locals " << func->num_locals << ", stack " << func->max_stack
+        << ")\n";
+    for (int pc = 0; pc < func->code.size();) {
+      int op = func->code[pc];
+      out << "  " << pc << "\t" << OpCodeNames[op];
+      for (int i = 1; i <= opcode_operands(op); i++) {
+        out << " " << func->code[pc + i];
+      }
+      out << "\n";
+      pc += 1 + opcode_operands(op);
+    }
+  }
+  return out.str();
+}
+
+void FunctionTable::define(int name, int index, size_t depth) {
+  if (depth == 1) {
+    if (table[name] >= 0) {
+      throw EvalError("function already defined");
+    }
+    table[name] = index;
+    return;
+  }
+  for (auto it = shadowed.rbegin(); it != shadowed.rend(); it++) {
+    if (it->depth < depth) {
+      break;
+    }
+    if (it->name == name) {
+      throw EvalError("function already defined");
+    }
+  }
+  shadowed.push_back(ShadowedFunction{name, table[name], depth});
+  table[name] = index;
+}
+
+void FunctionTable::restore(size_t depth) {
+  while (!shadowed.empty() && shadowed.back().depth >= depth) {
+    table[shadowed.back().name] = shadowed.back().index;
+    shadowed.pop_back();
+  }
+}
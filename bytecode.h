@@ -0,0 +1,104 @@
+#include "ast.h"
+#include "common.h"
+
+#ifndef bytecode_h
+#define bytecode_h
+
+class JitCode;
+
+// Every instruction is an opcode word followed by its operands. Jump targets
+// are absolute offsets into the function's code.
+enum OpCode {
+  OpConst,        // const_idx
+  OpNull,         //
+  OpLoadGlobal,   // global_idx
+  OpStoreGlobal,  // global_idx
+  OpDefineGlobal, // global_idx
+  OpLoadLocal,    // slot
+  OpStoreLocal,   // slot
+  OpDefineLocal,  // slot
+  OpBinary,       // TokenType
+  OpJump,         // target
+  OpJumpIfFalse,  // target
+  OpLoop,         // target, backward jump and GC safepoint
+  OpCall,         // function_name_idx, argc
+  OpTailCall,     // function_name_idx, argc
+  OpCallBuiltin,  // builtin_idx, argc
+  OpReturn,       //
+  OpArray,        // count
+  OpIndexGlobal,  // global_idx
+  OpIndexLocal,   // slot
+  OpPop,          //
+  OpDefineFunction, // function_name_idx, function_idx
+  OpHalt,         //
+  OpCount,
+};
+
+extern const char *OpCodeNames[];
+
+int opcode_operands(int op);
+
+// A word of the code the VM runs: an operand, or in place of the opcode the
+// address of its handler (the opcode itself with switch dispatch).
+union CodeWord {
+  const void *handler;
+  int operand;
+};
+
+class CompiledFunction {
+public:
+  std::string name;
+  int num_params = 0;
+  int num_locals = 0;
+  int max_stack = 0;
+  std::vector<int> code;
+  std::vector<std::string> local_names;
+  std::vector<CodeWord> threaded;
+  int hotness = 0;
+  bool jit_failed = false;
+  JitCode *jit_code = nullptr;
+};
+
+class ShadowedFunction {
+public:
+  int name;
+  int index;
+  size_t depth;
+};
+
+// Maps function names to the index of the function defining them, -1 when
+// undefined. A definition at frame depth 1 is global; one inside a function
+// only lasts until that call returns or is replaced by a tail call, when
+// leave() restores the binding it shadowed.
+class FunctionTable {
+public:
+  void resize(size_t size) { table.resize(size, -1); }
+  int operator[](int name) { return table[name]; }
+  void define(int name, int index, size_t depth);
+  void leave(size_t depth) {
+    if (!shadowed.empty() && shadowed.back().depth >= depth) {
+      restore(depth);
+    }
+  }
+
+private:
+  void restore(size_t depth);
+
+  std::vector<int> table;
+  std::vector<ShadowedFunction> shadowed;
+};
+
+// A compiled script. functions[0] is the top-level code, which keeps its
+// variables in the global slots instead of a frame.
+class CompiledProgram {
+public:
+  std::vector<Object *> constants;
+  std::vector<std::string> global_names;
+  std::vector<std::string> function_names;
+  std::vector<std::string> builtin_names;
+  std::vector<CompiledFunction *> functions;
+
+  std::string disassemble();
+};
+
+#endif // !bytecode_h
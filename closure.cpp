@@ -0,0 +1,430 @@
+#include "closure.h"
+#include "builtins.h"
+#include "eval.h"
+
+static inline void safepoint() {
+  if (heap.no_gc_depth == 0) {
+    heap.safepoint();
+  }
+}
+
+// Literals are created once. Pinned objects never move, so the closures can
+// keep pointing at them.
+static Object *constant(Literal *literal) {
+  switch (literal->data_type) {
+  case IntType: {
+    return ::new (heap.allocate_pinned(sizeof(IntegerObject)))
+        IntegerObject(std::stoi(literal->value));
+  }
+  case BoolType: {
+    return BoolObject::make(literal->value == "true");
+  }
+  case FloatType: {
+    return ::new (heap.allocate_pinned(sizeof(FloatObject)))
+        FloatObject(std::stof(literal->value));
+  }
+  case StringType: {
+    return ::new (heap.allocate_pinned(sizeof(StringObject)))
+        StringObject(literal->value);
+  }
+  default: {
+    throw EvalError("invalid literal type " + literal->type);
+  }
+  }
+}
+
+Object *call_closure(ClosureFunction *func, Object **slots) {
+  ClosureFrame frame{slots};
+  Object *ret = func->body(frame);
+  while (frame.tail_call != nullptr) {
+    ClosureFunction *next = frame.tail_call;
+    frame.slots = call_stack.reuse(frame.slots, func->num_slots, next->arity,
+                                   next->num_slots);
+    func = next;
+    frame.functions.clear();
+    frame.returning = false;
+    frame.tail_call = nullptr;
+    ret = func->body(frame);
+  }
+  call_stack.pop(func->num_slots);
+  return ret;
+}
+
+ClosureFunction *ClosureCompiler::compile(std::vector<Node *> &program) {
+  return compile_function(program, {});
+}
+
+ClosureFunction *
+ClosureCompiler::compile_function(std::vector<Node *> &body,
+                                  std::vector<std::string> params) {
+  FunctionObject funcObj(body, params);
+  resolve_slots(&funcObj);
+  ClosureFunction *func = new ClosureFunction();
+  func->arity = params.size();
+  func->num_slots = funcObj.num_slots;
+  std::unordered_set<std::string> outer_local_functions;
+  std::swap(local_functions, outer_local_functions);
+  if (!top_level) {
+    collect_local_functions(body);
+  }
+  func->body = compile_block(body);
+  std::swap(local_functions, outer_local_functions);
+  return func;
+}
+
+void ClosureCompiler::collect_local_functions(std::vector<Node *> &block) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      local_functions.insert(((FunctionStatement *)node)->ident.name);
+    } else if (type == "IfStatement") {
+      collect_local_functions(((IfStatement *)node)->consequent);
+      collect_local_functions(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      collect_local_functions(((WhileStatement *)node)->block);
+    }
+  }
+}
+
+// The function a call of name runs: one the frame defined, else the global.
+static ClosureFunction *find_local(ClosureFrame &frame,
+                                   const std::string &name,
+                                   ClosureFunction **entry) {
+  auto func = frame.functions.find(name);
+  return func != frame.functions.end() ? func->second : *entry;
+}
+
+// A bare index statement ends its block with its value, so the statements
+// after it are never compiled.
+Closure ClosureCompiler::compile_block(std::vector<Node *> &block) {
+  std::vector<Closure> statements;
+  Closure last = nullptr;
+  for (auto node : block) {
+    if (node->statement_type() == "MemberExpression") {
+      last = compile_expression(node);
+      break;
+    }
+    statements.push_back(compile_statement(node));
+  }
+  return [statements, last](ClosureFrame &frame) -> Object * {
+    for (auto &statement : statements) {
+      eval_steps++;
+      safepoint();
+      Object *ret = statement(frame);
+      if (frame.returning) {
+        return ret;
+      }
+    }
+    if (last != nullptr) {
+      eval_steps++;
+      safepoint();
+      return last(frame);
+    }
+    return nullptr;
+  };
+}
+
+Closure ClosureCompiler::compile_statement(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    int slot = letNode->ident.slot;
+    std::string name = letNode->ident.name;
+    Closure value = compile_expression(letNode->value);
+    return [slot, name, value](ClosureFrame &frame) -> Object * {
+      if (frame.slots[slot] != nullptr) {
+        throw EvalError("variable already defined: " + name);
+      }
+      frame.slots[slot] = value(frame);
+      return nullptr;
+    };
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    int slot = assNode->ident.slot;
+    Closure value = compile_expression(assNode->value);
+    return [slot, value](ClosureFrame &frame) -> Object * {
+      if (frame.slots[slot] == nullptr) {
+        throw EvalError("variable not defined");
+      }
+      frame.slots[slot] = value(frame);
+      return nullptr;
+    };
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    Closure condition = compile_expression(ifNode->condition);
+    Closure consequent = compile_block(ifNode->consequent);
+    Closure alternate = ifNode->alternate.empty()
+                            ? nullptr
+                            : compile_block(ifNode->alternate);
+    return [condition, consequent,
+            alternate](ClosureFrame &frame) -> Object * {
+      if (condition(frame)->is_truthy()) {
+        return consequent(frame);
+      } else if (alternate != nullptr) {
+        return alternate(frame);
+      }
+      return nullptr;
+    };
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    Closure condition = compile_expression(whileNode->condition);
+    Closure body = compile_block(whileNode->block);
+    return [condition, body](ClosureFrame &frame) -> Object * {
+      while (condition(frame)->is_truthy()) {
+        Object *ret = body(frame);
+        if (frame.returning) {
+          return ret;
+        }
+      }
+      return nullptr;
+    };
+  } else if (type == "FunctionStatement") {
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    std::vector<std::string> params;
+    for (auto param : funcNode->params) {
+      params.push_back(param->name);
+    }
+    bool outer_top_level = top_level;
+    top_level = false;
+    ClosureFunction *func = compile_function(funcNode->block, params);
+    top_level = outer_top_level;
+    std::string name = funcNode->ident.name;
+    if (!top_level) {
+      return [name, func](ClosureFrame &frame) -> Object * {
+        if (!frame.functions.emplace(name, func).second) {
+          throw EvalError("function already defined");
+        }
+        return nullptr;
+      };
+    }
+    ClosureFunction **entry = &functions[name];
+    return [entry, func](ClosureFrame &frame) -> Object * {
+      if (*entry != nullptr) {
+        throw EvalError("function already defined");
+      }
+      *entry = func;
+      return nullptr;
+    };
+  } else if (type == "CallExpression") {
+    return compile_expression(node);
+  } else if (type == "ReturnStatement") {
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    if (retNode->tail_call && !top_level) {
+      // Leaves the arguments above the frame for call_closure().
+      CallExpression *callNode = (CallExpression *)retNode->value;
+      std::string name = callNode->callee.name;
+      ClosureFunction **entry = &functions[name];
+      std::vector<Closure> args;
+      for (auto arg : callNode->args) {
+        args.push_back(compile_expression(arg));
+      }
+      bool local = local_functions.count(name) > 0;
+      return [entry, name, args, local](ClosureFrame &frame) -> Object * {
+        ClosureFunction *func =
+            local ? find_local(frame, name, entry) : *entry;
+        if (func == nullptr) {
+          throw EvalError("function " + name + " not defined");
+        }
+        if (args.size() != func->arity) {
+          throw EvalError("invalid number of arguments");
+        }
+        frame.returning = true;
+        Object **slots = call_stack.push(args.size());
+        for (int i = 0; i < args.size(); i++) {
+          slots[i] = args[i](frame);
+        }
+        frame.tail_call = func;
+        return nullptr;
+      };
+    }
+    Closure value = compile_expression(retNode->value);
+    return [value](ClosureFrame &frame) -> Object * {
+      frame.returning = true;
+      return value(frame);
+    };
+  }
+  return [](ClosureFrame &frame) -> Object * { return nullptr; };
+}
+
+Closure ClosureCompiler::compile_expression(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    return compile_binary((BinaryExpression *)node);
+  } else if (type == "Literal") {
+    Object *obj = constant((Literal *)node);
+    return [obj](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      return obj;
+    };
+  } else if (type == "Identifier") {
+    int slot = ((Identifier *)node)->slot;
+    std::string name = ((Identifier *)node)->name;
+    return [slot, name](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      Object *obj = frame.slots[slot];
+      if (obj == nullptr) {
+        throw EvalError("undefined identifier: " + name);
+      }
+      return obj;
+    };
+  } else if (type == "CallExpression") {
+    return compile_call((CallExpression *)node);
+  } else if (type == "ArrayExpression") {
+    std::vector<Closure> elements;
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      elements.push_back(compile_expression(elem));
+    }
+    return [elements](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      std::vector<Object *> arr;
+      heap.no_gc_depth++;
+      for (auto &elem : elements) {
+        arr.push_back(elem(frame));
+      }
+      heap.no_gc_depth--;
+      return new ArrayObject(arr);
+    };
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    int slot = ((Identifier *)memNode->object)->slot;
+    Closure property = compile_expression(memNode->property);
+    return [slot, property](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      Object *prop = property(frame);
+      ArrayObject *value = (ArrayObject *)frame.slots[slot];
+      if (value == nullptr) {
+        throw EvalError("object not defined");
+      }
+      if (prop->type() != IntType) {
+        throw EvalError("invalid property type");
+      }
+      int index = ((IntegerObject *)prop)->value;
+      if (index < 0 || index >= value->elements.size()) {
+        throw EvalError("index out of bounds");
+      }
+      return value->elements[index];
+    };
+  }
+  return [type](ClosureFrame &frame) -> Object * {
+    throw EvalError("invalid initialization value " + type);
+  };
+}
+
+// The operator is a template argument so that the int case compiles down to
+// the bare operation. An int literal on the right is folded into the
+// closure of the left operand.
+template <TokenType op>
+static Closure binary(Closure left, Closure right, Object *right_int) {
+  if (right_int != nullptr) {
+    int value = ((IntegerObject *)right_int)->value;
+    return [left, value, right_int](ClosureFrame &frame) -> Object * {
+      eval_steps += 2;
+      Object *l = left(frame);
+      if (l->type() == IntType) {
+        return IntegerObject::make(
+            evaluate_primary_op(((IntegerObject *)l)->value, value, op));
+      }
+      return evaluate_operator(l, right_int, op);
+    };
+  }
+  return [left, right](ClosureFrame &frame) -> Object * {
+    eval_steps++;
+    Object *l = left(frame);
+    heap.no_gc_depth++;
+    Object *r = right(frame);
+    heap.no_gc_depth--;
+    if (l->type() == IntType && r->type() == IntType) {
+      return IntegerObject::make(evaluate_primary_op(
+          ((IntegerObject *)l)->value, ((IntegerObject *)r)->value, op));
+    }
+    return evaluate_operator(l, r, op);
+  };
+}
+
+Closure ClosureCompiler::compile_binary(BinaryExpression *bNode) {
+  Closure left = compile_expression(bNode->left);
+  Closure right = compile_expression(bNode->right);
+  Object *right_int = nullptr;
+  if (bNode->right->statement_type() == "Literal" &&
+      ((Literal *)bNode->right)->data_type == IntType) {
+    right_int = constant((Literal *)bNode->right);
+  }
+  switch (bNode->op.type) {
+  case Plus:
+    return binary<Plus>(left, right, right_int);
+  case Minus:
+    return binary<Minus>(left, right, right_int);
+  case Mul:
+    return binary<Mul>(left, right, right_int);
+  case Div:
+    return binary<Div>(left, right, right_int);
+  case Mod:
+    return binary<Mod>(left, right, right_int);
+  case And:
+    return binary<And>(left, right, right_int);
+  case Or:
+    return binary<Or>(left, right, right_int);
+  case Lt:
+    return binary<Lt>(left, right, right_int);
+  case Lte:
+    return binary<Lte>(left, right, right_int);
+  case Gt:
+    return binary<Gt>(left, right, right_int);
+  case Gte:
+    return binary<Gte>(left, right, right_int);
+  case Equal:
+    return binary<Equal>(left, right, right_int);
+  case NotEqual:
+    return binary<NotEqual>(left, right, right_int);
+  default: {
+    TokenType op = bNode->op.type;
+    return [left, right, op](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      Object *l = left(frame);
+      heap.no_gc_depth++;
+      Object *r = right(frame);
+      heap.no_gc_depth--;
+      return evaluate_operator(l, r, op);
+    };
+  }
+  }
+}
+
+Closure ClosureCompiler::compile_call(CallExpression *callNode) {
+  std::vector<Closure> args;
+  for (auto arg : callNode->args) {
+    args.push_back(compile_expression(arg));
+  }
+  auto builtin = BuiltinFunctions.find(callNode->callee.name);
+  if (builtin != BuiltinFunctions.end()) {
+    auto *code = &builtin->second;
+    return [code, args](ClosureFrame &frame) -> Object * {
+      eval_steps++;
+      std::vector<Object *> values;
+      heap.no_gc_depth++;
+      for (auto &arg : args) {
+        values.push_back(arg(frame));
+      }
+      heap.no_gc_depth--;
+      return (*code)(values);
+    };
+  }
+  std::string name = callNode->callee.name;
+  ClosureFunction **entry = &functions[name];
+  bool local = local_functions.count(name) > 0;
+  return [entry, name, args, local](ClosureFrame &frame) -> Object * {
+    eval_steps++;
+    ClosureFunction *func = local ? find_local(frame, name, entry) : *entry;
+    if (func == nullptr) {
+      throw EvalError("function " + name + " not defined");
+    }
+    if (args.size() != func->arity) {
+      throw EvalError("invalid number of arguments");
+    }
+    Object **slots = call_stack.push(func->num_slots);
+    for (int i = 0; i < args.size(); i++) {
+      slots[i] = args[i](frame);
+    }
+    return call_closure(func, slots);
+  };
+}
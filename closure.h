@@ -0,0 +1,61 @@
+#include "ast.h"
+#include "common.h"
+#include <unordered_set>
+
+#ifndef closure_h
+#define closure_h
+
+class ClosureFunction;
+
+// The frame a closure runs in. Like Environment for a function call, but
+// the top-level code gets slots too since its variables are resolved the
+// same way.
+class ClosureFrame {
+public:
+  Object **slots;
+  bool returning = false;
+  ClosureFunction *tail_call = nullptr;
+  // Functions defined by function statements in this call.
+  std::unordered_map<std::string, ClosureFunction *> functions;
+};
+
+// A node compiled to a C++ lambda; running it is a single call.
+using Closure = std::function<Object *(ClosureFrame &frame)>;
+
+class ClosureFunction {
+public:
+  Closure body;
+  int arity = 0;
+  int num_slots = 0;
+};
+
+// Compiles every node of the program once into a closure with everything
+// evaluate() looks up while it runs bound up front: variable slots,
+// constants, builtins, the function table entry of callees and the
+// operator. As in evaluate(), a function statement inside a function only
+// defines it for the rest of that call, so only calls of the names a
+// function defines itself look in the frame first.
+class ClosureCompiler {
+public:
+  ClosureFunction *compile(std::vector<Node *> &program);
+
+private:
+  Closure compile_block(std::vector<Node *> &block);
+  Closure compile_statement(Node *node);
+  Closure compile_expression(Node *node);
+  Closure compile_binary(BinaryExpression *bNode);
+  Closure compile_call(CallExpression *callNode);
+  ClosureFunction *compile_function(std::vector<Node *> &body,
+                                    std::vector<std::string> params);
+  void collect_local_functions(std::vector<Node *> &block);
+
+  std::unordered_map<std::string, ClosureFunction *> functions;
+  std::unordered_set<std::string> local_functions;
+  bool top_level = true;
+};
+
+// Runs func on a frame pushed onto the CallStack, following its tail calls,
+// and pops the frame.
+Object *call_closure(ClosureFunction *func, Object **slots);
+
+#endif // !closure_h
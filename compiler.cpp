@@ -0,0 +1,257 @@
+#include "compiler.h"
+#include "builtins.h"
+#include "eval.h"
+#include "utils.h"
+
+CompiledProgram *Compiler::compile(std::vector<Node *> &nodes) {
+  program = new CompiledProgram();
+  current = new CompiledFunction();
+  current->name = "<main>";
+  program->functions.push_back(current);
+  block_exits.push_back({});
+  compile_block(nodes);
+  emit(OpHalt, 0);
+  block_exits.pop_back();
+  return program;
+}
+
+void Compiler::compile_function(FunctionStatement *funcNode) {
+  CompiledFunction *outer = current;
+  std::unordered_map<std::string, int> outer_locals = locals;
+  std::vector<std::vector<int>> outer_exits = block_exits;
+  int outer_depth = depth;
+
+  current = new CompiledFunction();
+  current->name = funcNode->ident.name;
+  current->num_params = funcNode->params.size();
+  int index = program->functions.size();
+  program->functions.push_back(current);
+  locals.clear();
+  for (auto param : funcNode->params) {
+    locals[param->name] = current->local_names.size();
+    current->local_names.push_back(param->name);
+  }
+  current->num_locals = current->local_names.size();
+  block_exits = {{}};
+  depth = 0;
+  compile_block(funcNode->block);
+  emit(OpNull, 1);
+  emit(OpReturn, -1);
+
+  current = outer;
+  locals = outer_locals;
+  block_exits = outer_exits;
+  depth = outer_depth;
+  emit(OpDefineFunction, function_name(funcNode->ident.name), index, 0);
+}
+
+void Compiler::compile_block(std::vector<Node *> &block) {
+  for (auto node : block) {
+    if (node != nullptr) {
+      compile_statement(node);
+    }
+  }
+}
+
+void Compiler::compile_statement(Node *node) {
+  std::string type = node->statement_type();
+  bool in_function = current != program->functions[0];
+  int statement_depth = depth;
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    compile_expression(letNode->value);
+    compile_store(&letNode->ident, OpDefineGlobal, OpDefineLocal);
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    compile_expression(assNode->value);
+    compile_store(&assNode->ident, OpStoreGlobal, OpStoreLocal);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    compile_expression(ifNode->condition);
+    int else_jump = emit(OpJumpIfFalse, 0, -1);
+    block_exits.push_back({});
+    compile_block(ifNode->consequent);
+    int end_jump = emit(OpJump, 0, 0);
+    patch(else_jump, current->code.size());
+    compile_block(ifNode->alternate);
+    patch(end_jump, current->code.size());
+    for (auto exit : block_exits.back()) {
+      patch(exit, current->code.size());
+    }
+    block_exits.pop_back();
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    int start = current->code.size();
+    compile_expression(whileNode->condition);
+    int end_jump = emit(OpJumpIfFalse, 0, -1);
+    block_exits.push_back({});
+    compile_block(whileNode->block);
+    emit(OpLoop, start, 0);
+    patch(end_jump, current->code.size());
+    for (auto exit : block_exits.back()) {
+      patch(exit, start);
+    }
+    block_exits.pop_back();
+  } else if (type == "FunctionStatement") {
+    compile_function((FunctionStatement *)node);
+  } else if (type == "CallExpression") {
+    compile_call((CallExpression *)node, false);
+    emit(OpPop, -1);
+  } else if (type == "ReturnStatement") {
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    if (!in_function) {
+      compile_expression(retNode->value);
+      emit(OpPop, -1);
+      emit(OpHalt, 0);
+    } else if (retNode->value->statement_type() == "CallExpression") {
+      compile_call((CallExpression *)retNode->value, true);
+    } else {
+      compile_expression(retNode->value);
+      emit(OpReturn, -1);
+    }
+  } else if (type == "MemberExpression") {
+    // A bare index statement ends the block it is in, like in evaluate().
+    compile_expression(node);
+    if (block_exits.size() > 1) {
+      emit(OpPop, -1);
+      block_exits.back().push_back(emit(OpJump, 0, 0));
+    } else if (in_function) {
+      emit(OpReturn, -1);
+    } else {
+      emit(OpPop, -1);
+      emit(OpHalt, 0);
+    }
+  }
+  depth = statement_depth;
+}
+
+void Compiler::compile_expression(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    emit(OpConst, add_constant((Literal *)node), 1);
+  } else if (type == "Identifier") {
+    compile_load((Identifier *)node);
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    compile_expression(bNode->left);
+    compile_expression(bNode->right);
+    emit(OpBinary, bNode->op.type, -1);
+  } else if (type == "CallExpression") {
+    compile_call((CallExpression *)node, false);
+  } else if (type == "ArrayExpression") {
+    ArrayExpression *arrNode = (ArrayExpression *)node;
+    for (auto elem : arrNode->elements) {
+      compile_expression(elem);
+    }
+    emit(OpArray, arrNode->elements.size(), 1 - arrNode->elements.size());
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    compile_expression(memNode->property);
+    std::string &name = ((Identifier *)memNode->object)->name;
+    if (current == program->functions[0]) {
+      emit(OpIndexGlobal, global_slot(name), 0);
+    } else {
+      emit(OpIndexLocal, local_slot(name), 0);
+    }
+  } else {
+    throw EvalError("invalid initialization value " + type);
+  }
+}
+
+void Compiler::compile_call(CallExpression *callNode, bool tail) {
+  for (auto arg : callNode->args) {
+    compile_expression(arg);
+  }
+  int argc = callNode->args.size();
+  if (BuiltinFunctions.find(callNode->callee.name) != BuiltinFunctions.end()) {
+    emit(OpCallBuiltin, builtin(callNode->callee.name), argc, 1 - argc);
+    if (tail) {
+      emit(OpReturn, -1);
+    }
+    return;
+  }
+  emit(tail ? OpTailCall : OpCall, function_name(callNode->callee.name), argc,
+       1 - argc);
+}
+
+void Compiler::compile_load(Identifier *ident) {
+  if (current == program->functions[0]) {
+    emit(OpLoadGlobal, global_slot(ident->name), 1);
+  } else {
+    emit(OpLoadLocal, local_slot(ident->name), 1);
+  }
+}
+
+void Compiler::compile_store(Identifier *ident, OpCode global_op,
+                             OpCode local_op) {
+  if (current == program->functions[0]) {
+    emit(global_op, global_slot(ident->name), -1);
+  } else {
+    emit(local_op, local_slot(ident->name), -1);
+  }
+}
+
+int Compiler::emit(int op, int effect) {
+  int at = current->code.size();
+  current->code.push_back(op);
+  depth += effect;
+  current->max_stack = std::max(current->max_stack, depth);
+  return at;
+}
+
+int Compiler::emit(int op, int operand, int effect) {
+  int at = emit(op, effect);
+  current->code.push_back(operand);
+  return at;
+}
+
+int Compiler::emit(int op, int operand1, int operand2, int effect) {
+  int at = emit(op, effect);
+  current->code.push_back(operand1);
+  current->code.push_back(operand2);
+  return at;
+}
+
+void Compiler::patch(int at, int target) { current->code[at + 1] = target; }
+
+int Compiler::add_constant(Literal *literal) {
+  std::string key = std::to_string(literal->data_type) + ":" + literal->value;
+  if (constants.find(key) == constants.end()) {
+    constants[key] = program->constants.size();
+    program->constants.push_back(get_obj_from_literal(literal));
+  }
+  return constants[key];
+}
+
+int Compiler::global_slot(std::string &name) {
+  if (globals.find(name) == globals.end()) {
+    globals[name] = program->global_names.size();
+    program->global_names.push_back(name);
+  }
+  return globals[name];
+}
+
+int Compiler::local_slot(std::string &name) {
+  if (locals.find(name) == locals.end()) {
+    locals[name] = current->local_names.size();
+    current->local_names.push_back(name);
+    current->num_locals = current->local_names.size();
+  }
+  return locals[name];
+}
+
+int Compiler::function_name(std::string &name) {
+  if (functions.find(name) == functions.end()) {
+    functions[name] = program->function_names.size();
+    program->function_names.push_back(name);
+  }
+  return functions[name];
+}
+
+int Compiler::builtin(std::string &name) {
+  if (builtins.find(name) == builtins.end()) {
+    builtins[name] = program->builtin_names.size();
+    program->builtin_names.push_back(name);
+  }
+  return builtins[name];
+}
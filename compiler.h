@@ -0,0 +1,45 @@
+#include "ast.h"
+#include "bytecode.h"
+#include "common.h"
+
+#ifndef compiler_h
+#define compiler_h
+
+// Compiles the Parser output into a CompiledProgram for the stack VM.
+// Variables are resolved at compile time: top-level code uses global slots,
+// function bodies use frame slots, parameters first.
+class Compiler {
+public:
+  CompiledProgram *compile(std::vector<Node *> &program);
+
+private:
+  void compile_function(FunctionStatement *funcNode);
+  void compile_block(std::vector<Node *> &block);
+  void compile_statement(Node *node);
+  void compile_expression(Node *node);
+  void compile_call(CallExpression *callNode, bool tail);
+  void compile_load(Identifier *ident);
+  void compile_store(Identifier *ident, OpCode global_op, OpCode local_op);
+
+  int emit(int op, int effect);
+  int emit(int op, int operand, int effect);
+  int emit(int op, int operand1, int operand2, int effect);
+  void patch(int at, int target);
+  int add_constant(Literal *literal);
+  int global_slot(std::string &name);
+  int local_slot(std::string &name);
+  int function_name(std::string &name);
+  int builtin(std::string &name);
+
+  CompiledProgram *program;
+  CompiledFunction *current;
+  std::unordered_map<std::string, int> locals;
+  std::unordered_map<std::string, int> globals;
+  std::unordered_map<std::string, int> functions;
+  std::unordered_map<std::string, int> builtins;
+  std::unordered_map<std::string, int> constants;
+  std::vector<std::vector<int>> block_exits;
+  int depth = 0;
+};
+
+#endif // !compiler_h
@@ -0,0 +1,254 @@
+#include "cse.h"
+
+void CseEliminator::run(std::vector<Node *> &program) {
+  eliminate_body(program, {});
+  while (!functions.empty()) {
+    FunctionStatement *funcNode = functions.back();
+    functions.pop_back();
+    eliminate_body(funcNode->block, funcNode->params);
+  }
+}
+
+void CseEliminator::eliminate_body(std::vector<Node *> &body,
+                                   std::vector<Identifier *> params) {
+  types.infer(body, params);
+  for (auto entry : entries) {
+    delete entry;
+  }
+  entries.clear();
+  before.clear();
+  temp_lets.clear();
+  eliminate_block(body, {});
+  body.insert(body.begin(), temp_lets.begin(), temp_lets.end());
+}
+
+// `available` is copied: what becomes available in a block is forgotten
+// after it.
+void CseEliminator::eliminate_block(std::vector<Node *> &block,
+                                    std::vector<CseEntry *> available) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement" || type == "AssignmentExpression") {
+      // The variable holds the value until it is assigned again.
+      Node **value = type == "LetStatement"
+                         ? &((LetStatement *)node)->value
+                         : &((AssignmentExpression *)node)->value;
+      std::string &name = type == "LetStatement"
+                              ? ((LetStatement *)node)->ident.name
+                              : ((AssignmentExpression *)node)->ident.name;
+      if (reuse(value, available)) {
+        kill(name, available);
+        continue;
+      }
+      if ((*value)->statement_type() != "BinaryExpression") {
+        eliminate_expression(value, node, available);
+        kill(name, available);
+        continue;
+      }
+      BinaryExpression *bNode = (BinaryExpression *)*value;
+      eliminate_expression(&bNode->left, node, available);
+      eliminate_expression(&bNode->right, node, available);
+      kill(name, available);
+      CseEntry *entry = make_entry(*value);
+      if (entry != nullptr && entry->inputs.count(name) == 0) {
+        entry->holder = name;
+        available.push_back(entry);
+      }
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      eliminate_expression(&ifNode->condition, node, available);
+      eliminate_block(ifNode->consequent, available);
+      eliminate_block(ifNode->alternate, available);
+      std::unordered_set<std::string> assigned;
+      collect_assigned(ifNode->consequent, assigned);
+      collect_assigned(ifNode->alternate, assigned);
+      for (auto &name : assigned) {
+        kill(name, available);
+      }
+    } else if (type == "WhileStatement") {
+      // Only what no iteration assigns stays available. The condition is
+      // evaluated again every iteration, so nothing in it is recorded.
+      WhileStatement *whileNode = (WhileStatement *)node;
+      std::unordered_set<std::string> assigned;
+      collect_assigned(whileNode->block, assigned);
+      for (auto &name : assigned) {
+        kill(name, available);
+      }
+      eliminate_expression(&whileNode->condition, nullptr, available);
+      eliminate_block(whileNode->block, available);
+    } else if (type == "ReturnStatement") {
+      eliminate_expression(&((ReturnStatement *)node)->value, node, available);
+    } else if (type == "CallExpression") {
+      for (auto &arg : ((CallExpression *)node)->args) {
+        eliminate_expression(&arg, node, available);
+      }
+    } else if (type == "MemberExpression") {
+      eliminate_expression(&((MemberExpression *)node)->property, node,
+                           available);
+    } else if (type == "FunctionStatement") {
+      functions.push_back((FunctionStatement *)node);
+    }
+  }
+
+  std::vector<Node *> rebuilt;
+  for (auto node : block) {
+    emit(node, rebuilt);
+  }
+  block = rebuilt;
+}
+
+// Adds the temporaries assigned before node, and what they need first.
+void CseEliminator::emit(Node *node, std::vector<Node *> &block) {
+  auto found = before.find(node);
+  if (found != before.end()) {
+    for (auto assignment : found->second) {
+      emit(assignment, block);
+    }
+  }
+  block.push_back(node);
+}
+
+// Replaces repeated expressions in the expression at location and records
+// the others as available, unless anchor is null.
+void CseEliminator::eliminate_expression(Node **location, Node *anchor,
+                                         std::vector<CseEntry *> &available) {
+  Node *node = *location;
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    if (reuse(location, available)) {
+      return;
+    }
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    eliminate_expression(&bNode->left, anchor, available);
+    eliminate_expression(&bNode->right, anchor, available);
+    if (anchor == nullptr) {
+      return;
+    }
+    CseEntry *entry = make_entry(node);
+    if (entry != nullptr) {
+      entry->location = location;
+      entry->anchor = anchor;
+      available.push_back(entry);
+    }
+  } else if (type == "CallExpression") {
+    for (auto &arg : ((CallExpression *)node)->args) {
+      eliminate_expression(&arg, anchor, available);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto &elem : ((ArrayExpression *)node)->elements) {
+      eliminate_expression(&elem, anchor, available);
+    }
+  } else if (type == "MemberExpression") {
+    eliminate_expression(&((MemberExpression *)node)->property, anchor,
+                         available);
+  }
+}
+
+static bool contains(Node *node, Node **location) {
+  std::vector<Node **> children;
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    children = {&((BinaryExpression *)node)->left,
+                &((BinaryExpression *)node)->right};
+  } else if (type == "CallExpression") {
+    for (auto &arg : ((CallExpression *)node)->args) {
+      children.push_back(&arg);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto &elem : ((ArrayExpression *)node)->elements) {
+      children.push_back(&elem);
+    }
+  } else if (type == "MemberExpression") {
+    children = {&((MemberExpression *)node)->property};
+  }
+  for (auto child : children) {
+    if (child == location || contains(*child, location)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Replaces the expression at location by the holder of an available equal
+// one. The first reuse moves the first occurrence into a temporary assigned
+// in front of its statement.
+bool CseEliminator::reuse(Node **location,
+                          std::vector<CseEntry *> &available) {
+  Node *node = *location;
+  if (node->statement_type() != "BinaryExpression") {
+    return false;
+  }
+  HoistType type = types.type_of(node);
+  if (type != HoistInt && type != HoistFloat) {
+    return false;
+  }
+  std::unordered_set<std::string> inputs;
+  std::string key = key_of(node, inputs);
+  for (auto entry : available) {
+    if (entry->key != key) {
+      continue;
+    }
+    if (entry->holder.empty()) {
+      entry->holder = "cse" + std::to_string(temps++);
+      Literal *zero = type == HoistInt ? new Literal("0", IntType)
+                                       : new Literal("0.0", FloatType);
+      temp_lets.push_back(new LetStatement(Identifier(entry->holder), zero));
+      types.types[entry->holder] = type;
+      Node *value = *entry->location;
+      AssignmentExpression *assignment =
+          new AssignmentExpression(Identifier(entry->holder), value);
+      before[entry->anchor].push_back(assignment);
+      *entry->location = new Identifier(entry->holder);
+      // Occurrences inside the moved expression are computed there now.
+      for (auto other : entries) {
+        if (other->location != nullptr && contains(value, other->location)) {
+          other->anchor = assignment;
+        }
+      }
+    }
+    *location = new Identifier(entry->holder);
+    eliminated++;
+    return true;
+  }
+  return false;
+}
+
+CseEntry *CseEliminator::make_entry(Node *node) {
+  HoistType type = types.type_of(node);
+  if (type != HoistInt && type != HoistFloat) {
+    return nullptr;
+  }
+  CseEntry *entry = new CseEntry();
+  entry->key = key_of(node, entry->inputs);
+  entries.push_back(entry);
+  return entry;
+}
+
+void CseEliminator::kill(const std::string &name,
+                         std::vector<CseEntry *> &available) {
+  for (size_t i = 0; i < available.size();) {
+    if (available[i]->inputs.count(name) > 0 ||
+        available[i]->holder == name) {
+      available.erase(available.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+// Equal keys mean equal values while the variables in inputs keep theirs.
+std::string CseEliminator::key_of(Node *node,
+                                  std::unordered_set<std::string> &inputs) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    Literal *lit = (Literal *)node;
+    return std::to_string(lit->data_type) + ":" + lit->value;
+  } else if (type == "Identifier") {
+    inputs.insert(((Identifier *)node)->name);
+    return "$" + ((Identifier *)node)->name;
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  return "(" + key_of(bNode->left, inputs) + " " +
+         std::to_string(bNode->op.type) + " " +
+         key_of(bNode->right, inputs) + ")";
+}
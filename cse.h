@@ -0,0 +1,51 @@
+#include "ast.h"
+#include "common.h"
+#include "licm.h"
+
+#ifndef cse_h
+#define cse_h
+
+// A binary expression whose value is available. `holder` is the variable
+// with its value: the one it was assigned to, or a temporary assigned
+// before `anchor` once the expression at `location` is reused.
+class CseEntry {
+public:
+  std::string key;
+  std::unordered_set<std::string> inputs;
+  Node **location = nullptr;
+  Node *anchor = nullptr;
+  std::string holder;
+};
+
+// Reuses the value of a binary expression computed earlier in the same
+// block, or in a block around it, as long as none of its variables has been
+// assigned since. Like LoopHoister it only touches int and float arithmetic
+// that can't fail, so computing the first occurrence into a temporary at the
+// start of its statement can't be noticed.
+class CseEliminator {
+public:
+  void run(std::vector<Node *> &program);
+  int eliminated = 0;
+
+private:
+  void eliminate_body(std::vector<Node *> &body,
+                      std::vector<Identifier *> params);
+  void eliminate_block(std::vector<Node *> &block,
+                       std::vector<CseEntry *> available);
+  void eliminate_expression(Node **location, Node *anchor,
+                            std::vector<CseEntry *> &available);
+  bool reuse(Node **location, std::vector<CseEntry *> &available);
+  CseEntry *make_entry(Node *node);
+  void kill(const std::string &name, std::vector<CseEntry *> &available);
+  std::string key_of(Node *node, std::unordered_set<std::string> &inputs);
+  void emit(Node *node, std::vector<Node *> &block);
+
+  ArithmeticTypes types;
+  std::vector<CseEntry *> entries;
+  std::unordered_map<Node *, std::vector<Node *>> before;
+  std::vector<Node *> temp_lets;
+  int temps = 0;
+  std::vector<FunctionStatement *> functions;
+};
+
+#endif // !cse_h
@@ -0,0 +1,240 @@
+#include "deadcode.h"
+#include "eval.h"
+#include "utils.h"
+
+void DeadCodeEliminator::run(std::vector<Node *> &program) {
+  nodes_before = count_block(program);
+  eliminate_block(program);
+
+  // Functions are reachable from the calls outside any function, then from
+  // the calls in the bodies of reachable functions.
+  collect_functions(program);
+  std::vector<std::string> calls;
+  for (auto node : program) {
+    if (node->statement_type() != "FunctionStatement") {
+      collect_calls(node, calls);
+    }
+  }
+  while (!calls.empty()) {
+    std::string name = calls.back();
+    calls.pop_back();
+    if (!called.insert(name).second) {
+      continue;
+    }
+    for (auto funcNode : functions[name]) {
+      for (auto node : funcNode->block) {
+        if (node->statement_type() != "FunctionStatement") {
+          collect_calls(node, calls);
+        }
+      }
+    }
+  }
+  drop_functions(program, false);
+  nodes_after = count_block(program);
+}
+
+// Returns whether the block always returns.
+bool DeadCodeEliminator::eliminate_block(std::vector<Node *> &block) {
+  std::vector<Node *> kept;
+  bool returns = false;
+  for (size_t i = 0; i < block.size(); i++) {
+    Node *node = block[i];
+    std::string type = node->statement_type();
+    if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      bool consequent = eliminate_block(ifNode->consequent);
+      bool alternate = eliminate_block(ifNode->alternate);
+      Object *condition = constant_value(ifNode->condition);
+      if (condition != nullptr) {
+        std::vector<Node *> &taken = condition->is_truthy()
+                                         ? ifNode->consequent
+                                         : ifNode->alternate;
+        // A member expression only ends the if's block, spliced it would
+        // end the enclosing one, so such an if just loses its untaken side.
+        if (taken.empty() ||
+            taken.back()->statement_type() != "MemberExpression") {
+          block.insert(block.begin() + i + 1, taken.begin(), taken.end());
+          continue;
+        }
+        (condition->is_truthy() ? ifNode->alternate : ifNode->consequent)
+            .clear();
+      }
+      kept.push_back(node);
+      if (consequent && alternate) {
+        returns = true;
+        break;
+      }
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      eliminate_block(whileNode->block);
+      Object *condition = constant_value(whileNode->condition);
+      if (condition == nullptr || condition->is_truthy()) {
+        kept.push_back(node);
+      }
+    } else if (type == "FunctionStatement") {
+      eliminate_block(((FunctionStatement *)node)->block);
+      kept.push_back(node);
+    } else {
+      kept.push_back(node);
+      if (type == "ReturnStatement") {
+        returns = true;
+        break;
+      }
+      // Ends the block without returning from the function.
+      if (type == "MemberExpression") {
+        break;
+      }
+    }
+  }
+  block = kept;
+  return returns;
+}
+
+// The value of a condition made of literals that can't fail, or nullptr.
+Object *DeadCodeEliminator::constant_value(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    return get_obj_from_literal((Literal *)node);
+  }
+  if (type != "BinaryExpression") {
+    return nullptr;
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  if (bNode->op.type == Div || bNode->op.type == Mod) {
+    return nullptr;
+  }
+  Object *left = constant_value(bNode->left);
+  Object *right = constant_value(bNode->right);
+  if (left == nullptr || right == nullptr) {
+    return nullptr;
+  }
+  try {
+    return evaluate_operator(left, right, bNode->op);
+  } catch (std::exception &) {
+    return nullptr;
+  }
+}
+
+void DeadCodeEliminator::collect_functions(std::vector<Node *> &block) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      FunctionStatement *funcNode = (FunctionStatement *)node;
+      functions[funcNode->ident.name].push_back(funcNode);
+      collect_functions(funcNode->block);
+    } else if (type == "IfStatement") {
+      collect_functions(((IfStatement *)node)->consequent);
+      collect_functions(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      collect_functions(((WhileStatement *)node)->block);
+    }
+  }
+}
+
+// Nested function statements are left to the reachability walk.
+void DeadCodeEliminator::collect_calls(Node *node,
+                                       std::vector<std::string> &calls) {
+  std::string type = node->statement_type();
+  if (type == "CallExpression") {
+    CallExpression *callNode = (CallExpression *)node;
+    calls.push_back(callNode->callee.name);
+    for (auto arg : callNode->args) {
+      collect_calls(arg, calls);
+    }
+  } else if (type == "BinaryExpression") {
+    collect_calls(((BinaryExpression *)node)->left, calls);
+    collect_calls(((BinaryExpression *)node)->right, calls);
+  } else if (type == "LetStatement") {
+    collect_calls(((LetStatement *)node)->value, calls);
+  } else if (type == "AssignmentExpression") {
+    collect_calls(((AssignmentExpression *)node)->value, calls);
+  } else if (type == "ReturnStatement") {
+    collect_calls(((ReturnStatement *)node)->value, calls);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    collect_calls(ifNode->condition, calls);
+    for (auto child : ifNode->consequent) {
+      collect_calls(child, calls);
+    }
+    for (auto child : ifNode->alternate) {
+      collect_calls(child, calls);
+    }
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    collect_calls(whileNode->condition, calls);
+    for (auto child : whileNode->block) {
+      collect_calls(child, calls);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      collect_calls(elem, calls);
+    }
+  } else if (type == "MemberExpression") {
+    collect_calls(((MemberExpression *)node)->property, calls);
+  }
+}
+
+// A function statement in a loop body can run more than once, which fails
+// whether or not anything calls the function, so it is kept.
+void DeadCodeEliminator::drop_functions(std::vector<Node *> &block,
+                                        bool in_loop) {
+  std::erase_if(block, [&](Node *node) {
+    if (in_loop || node->statement_type() != "FunctionStatement") {
+      return false;
+    }
+    std::string &name = ((FunctionStatement *)node)->ident.name;
+    return called.count(name) == 0 && functions[name].size() == 1;
+  });
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      drop_functions(((FunctionStatement *)node)->block, false);
+    } else if (type == "IfStatement") {
+      drop_functions(((IfStatement *)node)->consequent, in_loop);
+      drop_functions(((IfStatement *)node)->alternate, in_loop);
+    } else if (type == "WhileStatement") {
+      drop_functions(((WhileStatement *)node)->block, true);
+    }
+  }
+}
+
+int DeadCodeEliminator::count_nodes(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    return 1 + count_nodes(((BinaryExpression *)node)->left) +
+           count_nodes(((BinaryExpression *)node)->right);
+  } else if (type == "LetStatement") {
+    return 1 + count_nodes(((LetStatement *)node)->value);
+  } else if (type == "AssignmentExpression") {
+    return 1 + count_nodes(((AssignmentExpression *)node)->value);
+  } else if (type == "ReturnStatement") {
+    return 1 + count_nodes(((ReturnStatement *)node)->value);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    return 1 + count_nodes(ifNode->condition) +
+           count_block(ifNode->consequent) + count_block(ifNode->alternate);
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    return 1 + count_nodes(whileNode->condition) +
+           count_block(whileNode->block);
+  } else if (type == "FunctionStatement") {
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    return 1 + funcNode->params.size() + count_block(funcNode->block);
+  } else if (type == "CallExpression") {
+    return 1 + count_block(((CallExpression *)node)->args);
+  } else if (type == "ArrayExpression") {
+    return 1 + count_block(((ArrayExpression *)node)->elements);
+  } else if (type == "MemberExpression") {
+    return 1 + count_nodes(((MemberExpression *)node)->object) +
+           count_nodes(((MemberExpression *)node)->property);
+  }
+  return 1;
+}
+
+int DeadCodeEliminator::count_block(std::vector<Node *> &block) {
+  int count = 0;
+  for (auto node : block) {
+    count += count_nodes(node);
+  }
+  return count;
+}
@@ -0,0 +1,36 @@
+#include "ast.h"
+#include "common.h"
+#include <unordered_set>
+
+#ifndef deadcode_h
+#define deadcode_h
+
+// Removes what can never run: statements after a `return` (or after an `if`
+// returning on both sides) and after a member expression ending its block,
+// the untaken side of an `if` and the body of a `while` whose condition is
+// made of literals, and the functions no reachable code calls. A taken side
+// is spliced into the enclosing block, which is the scope it ran in anyway,
+// unless it ends in a member expression that would then end that block.
+// Conditions that could fail, like a division, are left alone, and so are
+// functions defined more than once or inside a loop since defining them
+// again fails.
+class DeadCodeEliminator {
+public:
+  void run(std::vector<Node *> &program);
+  int nodes_before = 0;
+  int nodes_after = 0;
+
+private:
+  bool eliminate_block(std::vector<Node *> &block);
+  Object *constant_value(Node *node);
+  void collect_functions(std::vector<Node *> &block);
+  void collect_calls(Node *node, std::vector<std::string> &calls);
+  void drop_functions(std::vector<Node *> &block, bool in_loop);
+  int count_nodes(Node *node);
+  int count_block(std::vector<Node *> &block);
+
+  std::unordered_map<std::string, std::vector<FunctionStatement *>> functions;
+  std::unordered_set<std::string> called;
+};
+
+#endif // !deadcode_h
@@ -0,0 +1,21 @@
+#ifndef dispatch_h
+#define dispatch_h
+
+// The VM loops use direct threading when the compiler supports labels as
+// values: every instruction carries the address of its handler and each
+// handler ends in its own indirect jump to the next one, so the branch
+// predictor gets one jump site per opcode instead of the single one of a
+// switch. Building with -DWHIMSIA_SWITCH_DISPATCH selects the portable switch
+// loop instead.
+#if defined(__GNUC__) && !defined(WHIMSIA_SWITCH_DISPATCH)
+#define WHIMSIA_THREADED
+#endif
+
+#ifdef WHIMSIA_THREADED
+#define HANDLER(op) handler_##op:
+#define HANDLER_ADDRESS(op) &&handler_##op
+#else
+#define HANDLER(op) case op:
+#endif
+
+#endif // !dispatch_h
@@ -0,0 +1,761 @@
+#include "emitter.h"
+#include "builtins.h"
+#include "eval.h"
+#include <algorithm>
+
+static bool native_op(TokenType op) {
+  return op == Plus || op == Minus || op == Mul || op == Div || op == Mod ||
+         op == And || op == Or || op == Lt || op == Lte || op == Gt ||
+         op == Gte || op == Equal || op == NotEqual;
+}
+
+static std::string op_symbol(TokenType op) {
+  switch (op) {
+  case Plus:
+    return "+";
+  case Minus:
+    return "-";
+  case Mul:
+    return "*";
+  case Div:
+    return "/";
+  case Mod:
+    return "%";
+  case And:
+    return "&&";
+  case Or:
+    return "||";
+  case Lt:
+    return "<";
+  case Lte:
+    return "<=";
+  case Gt:
+    return ">";
+  case Gte:
+    return ">=";
+  case Equal:
+    return "==";
+  default:
+    return "!=";
+  }
+}
+
+static std::string op_name(TokenType op) {
+  switch (op) {
+  case Plus:
+    return "Plus";
+  case Minus:
+    return "Minus";
+  case Mul:
+    return "Mul";
+  case Div:
+    return "Div";
+  case Mod:
+    return "Mod";
+  case Pow:
+    return "Pow";
+  case And:
+    return "And";
+  case Or:
+    return "Or";
+  case Lt:
+    return "Lt";
+  case Lte:
+    return "Lte";
+  case Gt:
+    return "Gt";
+  case Gte:
+    return "Gte";
+  case Equal:
+    return "Equal";
+  case NotEqual:
+    return "NotEqual";
+  default:
+    return "(TokenType)" + std::to_string(op);
+  }
+}
+
+static std::string cpp_string(std::string &value) {
+  std::string str = "\"";
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      str += '\\';
+      str += c;
+    } else if (c < 0x20 || c >= 0x7f) {
+      char octal[5];
+      snprintf(octal, sizeof(octal), "\\%03o", c);
+      str += octal;
+    } else {
+      str += c;
+    }
+  }
+  return str + "\"";
+}
+
+static std::string float_literal(float value) {
+  char hex[64];
+  snprintf(hex, sizeof(hex), "%af", value);
+  return hex;
+}
+
+static void assigned_names(std::vector<Node *> &block,
+                           std::vector<std::string> &names) {
+  for (auto node : block) {
+    if (node == nullptr) {
+      continue;
+    }
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      names.push_back(((LetStatement *)node)->ident.name);
+    } else if (type == "AssignmentExpression") {
+      names.push_back(((AssignmentExpression *)node)->ident.name);
+    } else if (type == "IfStatement") {
+      assigned_names(((IfStatement *)node)->consequent, names);
+      assigned_names(((IfStatement *)node)->alternate, names);
+    } else if (type == "WhileStatement") {
+      assigned_names(((WhileStatement *)node)->block, names);
+    }
+  }
+}
+
+std::string CppEmitter::emit(std::vector<Node *> &program,
+                             std::string source) {
+  collect_functions(program);
+  for (auto funcNode : functions) {
+    tail_calling[funcNode] = has_tail_call(funcNode->block, funcNode);
+  }
+  std::string bodies;
+  for (auto funcNode : functions) {
+    bodies += emit_function(funcNode);
+  }
+
+  scope = CppScope();
+  scope.frame = "globals";
+  std::string decls = infer_scope(program, {});
+  out.clear();
+  indent = 1;
+  temps = 0;
+  emit_block(program, 0, -1);
+  // Frames are only named when they are used and discarded results are cast
+  // to void, so the output builds cleanly with warnings on.
+  bodies += std::string("static void program(Object **") +
+            (scope.frame_used ? "globals" : "") + ") {\n" + decls + out +
+            "}\n";
+
+  std::string code = "// Generated by whimsia --emit-cpp from " + source +
+                     ".\n#include \"aot.h\"\n\n";
+  for (auto &name : function_names) {
+    code += "static AotFunction *fn_" + name + " = nullptr;\n";
+  }
+  for (auto funcNode : functions) {
+    std::string name = function_name(funcNode);
+    code += "static Object *" + name + "(Object **frame);\n";
+    code += "static AotFunction " + name + "_info = {" + name + ", " +
+            std::to_string(funcNode->params.size()) + ", " +
+            std::to_string(function_slots[funcNode]) + "};\n";
+  }
+  code += "\n" + bodies + "\nint main() { return aot_main(program, " +
+          std::to_string(scope.slots.size()) + "); }\n";
+  return code;
+}
+
+// Numbers every function statement, nested ones included, and resolves the
+// frame slots of its body the way evaluate() does when it is defined.
+void CppEmitter::collect_functions(std::vector<Node *> &block) {
+  for (auto node : block) {
+    if (node == nullptr) {
+      continue;
+    }
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      FunctionStatement *funcNode = (FunctionStatement *)node;
+      std::vector<std::string> params;
+      for (auto param : funcNode->params) {
+        params.push_back(param->name);
+      }
+      FunctionObject funcObj(funcNode->block, params);
+      resolve_slots(&funcObj);
+      function_slots[funcNode] = funcObj.num_slots;
+      function_index[funcNode] = functions.size();
+      functions.push_back(funcNode);
+      definitions[funcNode->ident.name].push_back(funcNode);
+      add_function_name(funcNode->ident.name);
+      collect_functions(funcNode->block);
+    } else if (type == "IfStatement") {
+      collect_functions(((IfStatement *)node)->consequent);
+      collect_functions(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      collect_functions(((WhileStatement *)node)->block);
+    }
+  }
+}
+
+void CppEmitter::collect_local_functions(std::vector<Node *> &block) {
+  for (auto node : block) {
+    if (node == nullptr) {
+      continue;
+    }
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      scope.local_functions.insert(((FunctionStatement *)node)->ident.name);
+    } else if (type == "IfStatement") {
+      collect_local_functions(((IfStatement *)node)->consequent);
+      collect_local_functions(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      collect_local_functions(((WhileStatement *)node)->block);
+    }
+  }
+}
+
+// Whether the block ends the function with a call that is not a call of
+// itself, which emit_call() can't turn into a jump.
+bool CppEmitter::has_tail_call(std::vector<Node *> &block,
+                               FunctionStatement *funcNode) {
+  for (auto node : block) {
+    if (node == nullptr) {
+      continue;
+    }
+    std::string type = node->statement_type();
+    if (type == "ReturnStatement" &&
+        ((ReturnStatement *)node)->value->statement_type() ==
+            "CallExpression") {
+      std::string &name =
+          ((CallExpression *)((ReturnStatement *)node)->value)->callee.name;
+      if (BuiltinFunctions.find(name) == BuiltinFunctions.end() &&
+          (definitions[name].size() != 1 ||
+           definitions[name][0] != funcNode)) {
+        return true;
+      }
+    } else if (type == "IfStatement") {
+      if (has_tail_call(((IfStatement *)node)->consequent, funcNode) ||
+          has_tail_call(((IfStatement *)node)->alternate, funcNode)) {
+        return true;
+      }
+    } else if (type == "WhileStatement") {
+      if (has_tail_call(((WhileStatement *)node)->block, funcNode)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Infers the variable types of the current scope and returns the
+// declarations of its native variables. Variables start out untyped and
+// widen to CppObject as soon as they are assigned two different types.
+std::string CppEmitter::infer_scope(std::vector<Node *> &block,
+                                    std::vector<std::string> params) {
+  std::vector<std::string> names;
+  assigned_names(block, names);
+  for (auto &name : names) {
+    scope.types[name] = CppNone;
+  }
+  for (auto &param : params) {
+    scope.types[param] = CppObject;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    infer_types(block, changed);
+  }
+  std::vector<std::string> natives;
+  for (auto &[name, type] : scope.types) {
+    if (type == CppInt || type == CppFloat) {
+      natives.push_back(name);
+    }
+  }
+  std::sort(natives.begin(), natives.end());
+  std::string decls;
+  for (auto &name : natives) {
+    decls += std::string("  ") +
+             (scope.types[name] == CppInt ? "int v_" : "float v_") + name +
+             " = 0;\n  bool d_" + name + " = false;\n";
+  }
+  for (auto it = scope.types.begin(); it != scope.types.end();) {
+    if (it->second == CppInt || it->second == CppFloat) {
+      it++;
+    } else {
+      it = scope.types.erase(it);
+    }
+  }
+  return decls;
+}
+
+void CppEmitter::infer_types(std::vector<Node *> &block, bool &changed) {
+  for (auto node : block) {
+    if (node == nullptr) {
+      continue;
+    }
+    std::string type = node->statement_type();
+    Identifier *ident = nullptr;
+    Node *value = nullptr;
+    if (type == "LetStatement") {
+      ident = &((LetStatement *)node)->ident;
+      value = ((LetStatement *)node)->value;
+    } else if (type == "AssignmentExpression") {
+      ident = &((AssignmentExpression *)node)->ident;
+      value = ((AssignmentExpression *)node)->value;
+    } else if (type == "IfStatement") {
+      infer_types(((IfStatement *)node)->consequent, changed);
+      infer_types(((IfStatement *)node)->alternate, changed);
+    } else if (type == "WhileStatement") {
+      infer_types(((WhileStatement *)node)->block, changed);
+    }
+    if (ident == nullptr) {
+      continue;
+    }
+    CppType old = scope.types[ident->name];
+    CppType assigned = type_of(value);
+    CppType joined = old == CppNone          ? assigned
+                     : assigned == CppNone   ? old
+                     : old == assigned       ? old
+                                             : CppObject;
+    if (joined != CppNone && joined != CppInt && joined != CppFloat) {
+      joined = CppObject;
+    }
+    if (joined != old) {
+      scope.types[ident->name] = joined;
+      changed = true;
+    }
+  }
+}
+
+// The type evaluate_operator() gives a value, CppObject when it isn't known
+// or has to stay boxed.
+CppType CppEmitter::type_of(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    switch (((Literal *)node)->data_type) {
+    case IntType:
+      return CppInt;
+    case FloatType:
+      return CppFloat;
+    case BoolType:
+      return CppBool;
+    default:
+      return CppObject;
+    }
+  } else if (type == "Identifier") {
+    auto var = scope.types.find(((Identifier *)node)->name);
+    return var == scope.types.end() ? CppObject : var->second;
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    CppType left = type_of(bNode->left);
+    CppType right = type_of(bNode->right);
+    if (left == CppObject || right == CppObject || !native_op(bNode->op.type)) {
+      return CppObject;
+    }
+    if (left == CppNone || right == CppNone) {
+      return CppNone;
+    }
+    if (left == CppFloat || right == CppFloat) {
+      return bNode->op.type == Mod ? CppObject : CppFloat;
+    }
+    return CppInt;
+  }
+  return CppObject;
+}
+
+std::string CppEmitter::emit_function(FunctionStatement *funcNode) {
+  scope = CppScope();
+  scope.func = funcNode;
+  scope.frame = "frame";
+  std::vector<std::string> params;
+  for (auto param : funcNode->params) {
+    params.push_back(param->name);
+  }
+  std::string decls = infer_scope(funcNode->block, params);
+  collect_local_functions(funcNode->block);
+  for (auto &name : scope.local_functions) {
+    decls += "  AotFunction *lf_" + name + " = nullptr;\n";
+  }
+  out.clear();
+  indent = 1;
+  temps = 0;
+  emit_block(funcNode->block, 1, -1);
+  line("return nullptr;");
+  return "static Object *" + function_name(funcNode) + "(Object **" +
+         (scope.frame_used ? "frame" : "") + ") {\n" + decls +
+         (scope.tail_entry ? "entry:\n" : "") + out + "}\n\n";
+}
+
+// level is 0 for the top-level code, 1 for a function body and 2 for the
+// blocks of if and while statements, which a bare index statement leaves
+// through label.
+void CppEmitter::emit_block(std::vector<Node *> &block, int level,
+                            int label) {
+  for (auto node : block) {
+    if (node != nullptr) {
+      emit_statement(node, level, label);
+    }
+  }
+}
+
+void CppEmitter::emit_statement(Node *node, int level, int label) {
+  std::string type = node->statement_type();
+  line("aot_safepoint();");
+  line("{");
+  indent++;
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    emit_store(&letNode->ident, letNode->value, true);
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    emit_store(&assNode->ident, assNode->value, false);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    int end = new_label();
+    CppType cond_type;
+    std::string cond = emit_expression(ifNode->condition, cond_type);
+    line("if (" + truthy(cond, cond_type) + ") {");
+    indent++;
+    emit_block(ifNode->consequent, 2, end);
+    indent--;
+    if (!ifNode->alternate.empty()) {
+      line("} else {");
+      indent++;
+      emit_block(ifNode->alternate, 2, end);
+      indent--;
+    }
+    line("}");
+    emit_label(end);
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    int end = new_label();
+    line("while (true) {");
+    indent++;
+    CppType cond_type;
+    std::string cond = emit_expression(whileNode->condition, cond_type);
+    line("if (!" + truthy(cond, cond_type) + ") {");
+    line("  break;");
+    line("}");
+    emit_block(whileNode->block, 2, end);
+    emit_label(end);
+    indent--;
+    line("}");
+  } else if (type == "FunctionStatement") {
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    // Inside a function the definition only lasts for the call, like in
+    // evaluate().
+    std::string table =
+        (scope.func == nullptr ? "fn_" : "lf_") + funcNode->ident.name;
+    line("if (" + table + " != nullptr) {");
+    line("  aot_error(\"function already defined\");");
+    line("}");
+    line(table + " = &" + function_name(funcNode) + "_info;");
+  } else if (type == "CallExpression") {
+    line("(void)" + emit_call((CallExpression *)node, false) + ";");
+  } else if (type == "ReturnStatement") {
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    CppType value_type;
+    if (scope.func == nullptr) {
+      line("(void)" + emit_expression(retNode->value, value_type) + ";");
+      line("return;");
+    } else if (retNode->value->statement_type() == "CallExpression") {
+      std::string value = emit_call((CallExpression *)retNode->value, true);
+      if (!value.empty()) {
+        line("return " + value + ";");
+      }
+    } else {
+      std::string value = emit_expression(retNode->value, value_type);
+      line("return " + boxed(value, value_type) + ";");
+    }
+  } else if (type == "MemberExpression") {
+    // A bare index statement ends the block it is in, like in the VM.
+    CppType value_type;
+    std::string value = emit_expression(node, value_type);
+    if (level == 2) {
+      line("(void)" + value + ";");
+      line("goto end" + std::to_string(label) + ";");
+      label_used[label] = true;
+    } else if (level == 1) {
+      line("return " + value + ";");
+    } else {
+      line("(void)" + value + ";");
+      line("return;");
+    }
+  }
+  indent--;
+  line("}");
+}
+
+std::string CppEmitter::emit_expression(Node *node, CppType &type) {
+  std::string node_type = node->statement_type();
+  if (node_type == "Literal") {
+    Literal *literal = (Literal *)node;
+    type = type_of(node);
+    switch (literal->data_type) {
+    case IntType:
+      return std::to_string(std::stoi(literal->value));
+    case FloatType:
+      return float_literal(std::stof(literal->value));
+    case BoolType:
+      return literal->value == "true" ? "true" : "false";
+    default: {
+      std::string t = temp();
+      line("Object *" + t + " = new StringObject(" +
+           cpp_string(literal->value) + ");");
+      return t;
+    }
+    }
+  } else if (node_type == "Identifier") {
+    return emit_load((Identifier *)node, type);
+  } else if (node_type == "BinaryExpression") {
+    return emit_binary((BinaryExpression *)node, type);
+  } else if (node_type == "CallExpression") {
+    type = CppObject;
+    return emit_call((CallExpression *)node, false);
+  } else if (node_type == "ArrayExpression") {
+    type = CppObject;
+    std::string elements = temp();
+    line("std::vector<Object *> " + elements + ";");
+    line("heap.no_gc_depth++;");
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      CppType elem_type;
+      std::string value = emit_expression(elem, elem_type);
+      line(elements + ".push_back(" + boxed(value, elem_type) + ");");
+    }
+    line("heap.no_gc_depth--;");
+    std::string t = temp();
+    line("Object *" + t + " = new ArrayObject(" + elements + ");");
+    return t;
+  } else if (node_type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    Identifier *ident = (Identifier *)memNode->object;
+    CppType prop_type;
+    std::string prop = emit_expression(memNode->property, prop_type);
+    std::string arr = temp();
+    if (scope.types.find(ident->name) != scope.types.end()) {
+      line("Object *" + arr + " = d_" + ident->name + " ? " +
+           boxed("v_" + ident->name, scope.types[ident->name]) +
+           " : nullptr;");
+    } else {
+      line("Object *" + arr + " = " + slot(ident) + ";");
+    }
+    std::string index = temp();
+    line("int " + index + " = aot_index(" + arr + ", " +
+         boxed(prop, prop_type) + ");");
+    std::string t = temp();
+    line("Object *" + t + " = ((ArrayObject *)" + arr + ")->elements[" +
+         index + "];");
+    type = CppObject;
+    return t;
+  }
+  throw EvalError("invalid initialization value " + node_type);
+}
+
+// Operands of a known type are combined natively, anything else goes
+// through evaluate_operator() with the right operand evaluated under
+// no_gc_depth like in evaluate_expression().
+std::string CppEmitter::emit_binary(BinaryExpression *bNode, CppType &type) {
+  type = type_of(bNode);
+  CppType left_type, right_type;
+  if (type == CppInt || type == CppFloat) {
+    std::string left = emit_expression(bNode->left, left_type);
+    std::string right = emit_expression(bNode->right, right_type);
+    std::string t = temp();
+    if (type == CppInt) {
+      line("int " + t + " = " + left + " " + op_symbol(bNode->op.type) + " " +
+           right + ";");
+    } else {
+      line("float " + t + " = (float)" + left + " " +
+           op_symbol(bNode->op.type) + " (float)" + right + ";");
+    }
+    return t;
+  }
+  std::string left = emit_expression(bNode->left, left_type);
+  std::string boxed_left = temp();
+  line("Object *" + boxed_left + " = " + boxed(left, left_type) + ";");
+  line("heap.no_gc_depth++;");
+  std::string right = emit_expression(bNode->right, right_type);
+  line("heap.no_gc_depth--;");
+  std::string t = temp();
+  line("Object *" + t + " = evaluate_operator(" + boxed_left + ", " +
+       boxed(right, right_type) + ", " + op_name(bNode->op.type) + ");");
+  type = CppObject;
+  return t;
+}
+
+// Returns the result, or an empty string after a tail call. A tail call of
+// the current function reuses the frame and jumps back to its entry, any
+// other one is left to aot_call().
+std::string CppEmitter::emit_call(CallExpression *callNode, bool tail) {
+  std::string &name = callNode->callee.name;
+  int argc = callNode->args.size();
+  if (BuiltinFunctions.find(name) != BuiltinFunctions.end()) {
+    std::string args = temp();
+    line("std::vector<Object *> " + args + ";");
+    line("heap.no_gc_depth++;");
+    for (auto arg : callNode->args) {
+      CppType arg_type;
+      std::string value = emit_expression(arg, arg_type);
+      line(args + ".push_back(" + boxed(value, arg_type) + ");");
+    }
+    line("heap.no_gc_depth--;");
+    std::string builtin = temp();
+    line("static auto &" + builtin + " = BuiltinFunctions.at(\"" + name +
+         "\");");
+    std::string t = temp();
+    line("Object *" + t + " = " + builtin + "(" + args + ");");
+    return t;
+  }
+  add_function_name(name);
+  FunctionStatement *target =
+      definitions[name].size() == 1 ? definitions[name][0] : nullptr;
+  std::string callee = temp();
+  std::string check = "aot_callee(" + function_table(name) + ", \"" + name +
+                      "\", " + std::to_string(argc) + ")";
+  bool direct = target != nullptr &&
+                (tail ? target == scope.func : !tail_calling[target]);
+  line(direct ? check + ";" : "AotFunction *" + callee + " = " + check + ";");
+  std::string slots = target != nullptr
+                          ? std::to_string(function_slots[target])
+                          : callee + "->slots";
+  if (tail) {
+    std::string args = temp();
+    line("Object **" + args + " = call_stack.push(" + std::to_string(argc) +
+         ");");
+    for (int i = 0; i < argc; i++) {
+      CppType arg_type;
+      std::string value = emit_expression(callNode->args[i], arg_type);
+      line(args + "[" + std::to_string(i) + "] = " + boxed(value, arg_type) +
+           ";");
+    }
+    if (target == nullptr || target != scope.func) {
+      line("aot_tail_call = " + callee + ";");
+      line("return nullptr;");
+      return "";
+    }
+    scope.frame_used = true;
+    line("call_stack.reuse(frame, " + slots + ", " + std::to_string(argc) +
+         ", " + slots + ");");
+    for (auto &[var, type] : scope.types) {
+      line("d_" + var + " = false;");
+    }
+    for (auto &local : scope.local_functions) {
+      line("lf_" + local + " = nullptr;");
+    }
+    line("goto entry;");
+    scope.tail_entry = true;
+    return "";
+  }
+  std::string frame = temp();
+  line("Object **" + frame + " = call_stack.push(" + slots + ");");
+  for (int i = 0; i < argc; i++) {
+    CppType arg_type;
+    std::string value = emit_expression(callNode->args[i], arg_type);
+    line(frame + "[" + std::to_string(i) + "] = " + boxed(value, arg_type) +
+         ";");
+  }
+  std::string t = temp();
+  if (target != nullptr && !tail_calling[target]) {
+    line("Object *" + t + " = " + function_name(target) + "(" + frame + ");");
+    line("call_stack.pop(" + slots + ");");
+  } else {
+    line("Object *" + t + " = aot_call(" + callee + ", " + frame + ");");
+  }
+  return t;
+}
+
+// The table entry a call of name goes through: the function the current
+// function defined itself, if it did, else the global one.
+std::string CppEmitter::function_table(std::string &name) {
+  if (scope.local_functions.count(name) == 0) {
+    return "fn_" + name;
+  }
+  return "(lf_" + name + " != nullptr ? lf_" + name + " : fn_" + name + ")";
+}
+
+std::string CppEmitter::emit_load(Identifier *ident, CppType &type) {
+  std::string &name = ident->name;
+  if (scope.types.find(name) != scope.types.end()) {
+    type = scope.types[name];
+    line("aot_check_read(d_" + name + ", \"" + name + "\");");
+    return "v_" + name;
+  }
+  type = CppObject;
+  std::string t = temp();
+  line("Object *" + t + " = " + slot(ident) + ";");
+  line("aot_check_read(" + t + " != nullptr, \"" + name + "\");");
+  return t;
+}
+
+void CppEmitter::emit_store(Identifier *ident, Node *value, bool define) {
+  std::string &name = ident->name;
+  bool native = scope.types.find(name) != scope.types.end();
+  std::string defined = native ? "d_" + name : slot(ident) + " != nullptr";
+  if (define) {
+    line("aot_check_let(" + defined + ", \"" + name + "\");");
+  } else {
+    line("aot_check_assign(" + defined + ");");
+  }
+  CppType type;
+  std::string result = emit_expression(value, type);
+  if (native) {
+    line("v_" + name + " = " + result + ";");
+    line("d_" + name + " = true;");
+  } else {
+    line(slot(ident) + " = " + boxed(result, type) + ";");
+  }
+}
+
+std::string CppEmitter::boxed(std::string value, CppType type) {
+  switch (type) {
+  case CppInt:
+    return "IntegerObject::make(" + value + ")";
+  case CppFloat:
+    return "new FloatObject(" + value + ")";
+  case CppBool:
+    return "BoolObject::make(" + value + ")";
+  default:
+    return value;
+  }
+}
+
+std::string CppEmitter::truthy(std::string value, CppType type) {
+  if (type == CppObject) {
+    return value + "->is_truthy()";
+  }
+  return "(" + value + " != 0)";
+}
+
+std::string CppEmitter::slot(Identifier *ident) {
+  scope.frame_used = true;
+  if (scope.func != nullptr) {
+    return "frame[" + std::to_string(ident->slot) + "]";
+  }
+  if (scope.slots.find(ident->name) == scope.slots.end()) {
+    int index = scope.slots.size();
+    scope.slots[ident->name] = index;
+  }
+  return "globals[" + std::to_string(scope.slots[ident->name]) + "]";
+}
+
+std::string CppEmitter::function_name(FunctionStatement *funcNode) {
+  return "f" + std::to_string(function_index[funcNode]) + "_" +
+         funcNode->ident.name;
+}
+
+void CppEmitter::add_function_name(std::string &name) {
+  if (std::find(function_names.begin(), function_names.end(), name) ==
+      function_names.end()) {
+    function_names.push_back(name);
+  }
+}
+
+std::string CppEmitter::temp() { return "t" + std::to_string(temps++); }
+
+int CppEmitter::new_label() {
+  label_used.push_back(false);
+  return label_used.size() - 1;
+}
+
+void CppEmitter::emit_label(int label) {
+  if (label_used[label]) {
+    line("end" + std::to_string(label) + ":;");
+  }
+}
+
+void CppEmitter::line(std::string code) {
+  out += std::string(indent * 2, ' ') + code + "\n";
+}
@@ -0,0 +1,74 @@
+#include "ast.h"
+#include "common.h"
+#include <set>
+
+#ifndef emitter_h
+#define emitter_h
+
+enum CppType { CppNone, CppInt, CppFloat, CppBool, CppObject };
+
+// Variables of the top-level code or of one function. Boxed variables live
+// in the frame (the globals for top-level code), types holds the ones that
+// became native ints and floats. local_functions are the names the
+// function's own function statements define for the rest of the call.
+class CppScope {
+public:
+  FunctionStatement *func = nullptr;
+  std::string frame;
+  std::unordered_map<std::string, int> slots;
+  std::unordered_map<std::string, CppType> types;
+  std::set<std::string> local_functions;
+  bool tail_entry = false;
+  bool frame_used = false;
+};
+
+// Translates the Parser output to a C++ translation unit running against
+// aot.h, with the semantics of the stack VM. Variables that are only ever
+// assigned ints, or only floats, become native locals; calls to functions
+// defined once go straight to their C++ function.
+class CppEmitter {
+public:
+  std::string emit(std::vector<Node *> &program, std::string source);
+
+private:
+  void collect_functions(std::vector<Node *> &block);
+  void collect_local_functions(std::vector<Node *> &block);
+  bool has_tail_call(std::vector<Node *> &block, FunctionStatement *funcNode);
+  std::string infer_scope(std::vector<Node *> &block,
+                          std::vector<std::string> params);
+  void infer_types(std::vector<Node *> &block, bool &changed);
+  CppType type_of(Node *node);
+  std::string emit_function(FunctionStatement *funcNode);
+  void emit_block(std::vector<Node *> &block, int level, int label);
+  void emit_statement(Node *node, int level, int label);
+  std::string emit_expression(Node *node, CppType &type);
+  std::string emit_binary(BinaryExpression *bNode, CppType &type);
+  std::string emit_call(CallExpression *callNode, bool tail);
+  std::string function_table(std::string &name);
+  std::string emit_load(Identifier *ident, CppType &type);
+  void emit_store(Identifier *ident, Node *value, bool define);
+  std::string boxed(std::string value, CppType type);
+  std::string truthy(std::string value, CppType type);
+  std::string slot(Identifier *ident);
+  std::string function_name(FunctionStatement *funcNode);
+  void add_function_name(std::string &name);
+  std::string temp();
+  int new_label();
+  void emit_label(int label);
+  void line(std::string code);
+
+  std::vector<FunctionStatement *> functions;
+  std::unordered_map<FunctionStatement *, int> function_index;
+  std::unordered_map<FunctionStatement *, int> function_slots;
+  std::unordered_map<FunctionStatement *, bool> tail_calling;
+  std::unordered_map<std::string, std::vector<FunctionStatement *>>
+      definitions;
+  std::vector<std::string> function_names;
+  CppScope scope;
+  std::string out;
+  int indent = 0;
+  int temps = 0;
+  std::vector<bool> label_used;
+};
+
+#endif // !emitter_h
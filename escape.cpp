@@ -0,0 +1,82 @@
+#include "escape.h"
+#include "builtins.h"
+
+void EscapeAnalysis::run(std::vector<Node *> &program) {
+  analyze_block(program);
+  // A node shared by several places is only temporary if it is in all.
+  for (auto node : candidates) {
+    if (escaping.count(node) > 0) {
+      continue;
+    }
+    if (node->statement_type() == "Literal") {
+      ((Literal *)node)->temporary = true;
+    } else {
+      ((BinaryExpression *)node)->temporary = true;
+    }
+    escaping.insert(node);
+    temporaries++;
+  }
+  candidates.clear();
+}
+
+void EscapeAnalysis::analyze_block(std::vector<Node *> &block) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      analyze_expression(((LetStatement *)node)->value, true);
+    } else if (type == "AssignmentExpression") {
+      analyze_expression(((AssignmentExpression *)node)->value, true);
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      analyze_expression(ifNode->condition, false);
+      analyze_block(ifNode->consequent);
+      analyze_block(ifNode->alternate);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      analyze_expression(whileNode->condition, false);
+      analyze_block(whileNode->block);
+    } else if (type == "FunctionStatement") {
+      analyze_block(((FunctionStatement *)node)->block);
+    } else if (type == "CallExpression") {
+      // The result of a call statement is dropped.
+      analyze_expression(node, false);
+    } else {
+      // A return, or a member expression ending its block, hands its value
+      // to the caller.
+      analyze_expression(type == "ReturnStatement"
+                             ? ((ReturnStatement *)node)->value
+                             : node,
+                         true);
+    }
+  }
+}
+
+void EscapeAnalysis::analyze_expression(Node *node, bool escapes) {
+  std::string type = node->statement_type();
+  if (type == "Literal" || type == "BinaryExpression") {
+    if (escapes) {
+      escaping.insert(node);
+    } else {
+      candidates.push_back(node);
+    }
+  }
+  if (type == "BinaryExpression") {
+    // evaluate_operator() only reads its operands.
+    analyze_expression(((BinaryExpression *)node)->left, false);
+    analyze_expression(((BinaryExpression *)node)->right, false);
+  } else if (type == "CallExpression") {
+    // Builtins always return a new or cached object, script functions keep
+    // their arguments in their slots.
+    CallExpression *callNode = (CallExpression *)node;
+    bool builtin = BuiltinFunctions.count(callNode->callee.name) > 0;
+    for (auto arg : callNode->args) {
+      analyze_expression(arg, !builtin);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      analyze_expression(elem, true);
+    }
+  } else if (type == "MemberExpression") {
+    analyze_expression(((MemberExpression *)node)->property, false);
+  }
+}
@@ -0,0 +1,28 @@
+#include "ast.h"
+#include "common.h"
+#include <unordered_set>
+
+#ifndef escape_h
+#define escape_h
+
+// Finds the binary expressions and literals whose values never leave the
+// statement evaluating them: operands, conditions, array indexes and the
+// arguments of builtins, none of which keeps or returns its arguments. A
+// value escapes when it is stored into a variable, an array or the frame of
+// a script function, or returned. The others are marked `temporary` and
+// evaluate() builds them in the heap's scratch area, released as soon as
+// their statement is done.
+class EscapeAnalysis {
+public:
+  void run(std::vector<Node *> &program);
+  int temporaries = 0;
+
+private:
+  void analyze_block(std::vector<Node *> &block);
+  void analyze_expression(Node *node, bool escapes);
+
+  std::unordered_set<Node *> escaping;
+  std::vector<Node *> candidates;
+};
+
+#endif // !escape_h
@@ -1,83 +1,589 @@
 #include "eval.h"
 #include "builtins.h"
+#include "trace.h"
 #include "utils.h"
+#include <climits>
 
 EvalError::EvalError(std::string err)
     : error_msg("error while evaluating: " + err) {}
 const char *EvalError::what() const noexcept { return error_msg.c_str(); }
 
+CallStack call_stack(1 << 20);
+
+size_t eval_steps = 0;
+
+CallStack::CallStack(size_t capacity) : capacity(capacity) {
+  slots = new Object *[capacity];
+}
+
+Object **CallStack::push(int size) {
+  if (top + size > capacity) {
+    throw EvalError("stack overflow");
+  }
+  Object **frame = slots + top;
+  std::fill(frame, frame + size, nullptr);
+  top += size;
+  return frame;
+}
+
+void CallStack::pop(int size) { top -= size; }
+
+void CallStack::register_roots() {
+  heap.root_ranges.push_back(RootRange{slots, &top});
+}
+
+// Reuses the frame on top of the stack for a tail call whose arguments were
+// pushed right above it.
+Object **CallStack::reuse(Object **frame, int size, int argc, int new_size) {
+  if (frame - slots + new_size > capacity) {
+    throw EvalError("stack overflow");
+  }
+  std::copy(frame + size, frame + size + argc, frame);
+  std::fill(frame + argc, frame + new_size, nullptr);
+  top = frame - slots + new_size;
+  return frame;
+}
+
+// Assigns a frame slot to every variable of a function. Parameters get the
+// first slots in order, nested function statements are resolved when they
+// are defined.
+class SlotResolver {
+public:
+  std::unordered_map<std::string, int> slots;
+  int size = 0;
+
+  void resolve_ident(Identifier *ident) {
+    if (slots.find(ident->name) == slots.end()) {
+      slots[ident->name] = size++;
+    }
+    ident->slot = slots[ident->name];
+  }
+
+  void resolve_block(std::vector<Node *> &block) {
+    for (auto node : block) {
+      resolve_node(node);
+    }
+  }
+
+  void resolve_node(Node *node) {
+    if (node == nullptr) {
+      return;
+    }
+    std::string type = node->statement_type();
+    if (type == "Identifier") {
+      resolve_ident((Identifier *)node);
+    } else if (type == "LetStatement") {
+      resolve_ident(&((LetStatement *)node)->ident);
+      resolve_node(((LetStatement *)node)->value);
+    } else if (type == "AssignmentExpression") {
+      resolve_ident(&((AssignmentExpression *)node)->ident);
+      resolve_node(((AssignmentExpression *)node)->value);
+    } else if (type == "BinaryExpression") {
+      resolve_node(((BinaryExpression *)node)->left);
+      resolve_node(((BinaryExpression *)node)->right);
+    } else if (type == "CallExpression") {
+      resolve_block(((CallExpression *)node)->args);
+    } else if (type == "MemberExpression") {
+      resolve_node(((MemberExpression *)node)->object);
+      resolve_node(((MemberExpression *)node)->property);
+    } else if (type == "ArrayExpression") {
+      resolve_block(((ArrayExpression *)node)->elements);
+    } else if (type == "IfStatement") {
+      resolve_node(((IfStatement *)node)->condition);
+      resolve_block(((IfStatement *)node)->consequent);
+      resolve_block(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      resolve_node(((WhileStatement *)node)->condition);
+      resolve_block(((WhileStatement *)node)->block);
+    } else if (type == "ReturnStatement") {
+      ReturnStatement *retNode = (ReturnStatement *)node;
+      resolve_node(retNode->value);
+      retNode->tail_call =
+          retNode->value->statement_type() == "CallExpression" &&
+          BuiltinFunctions.find(((CallExpression *)retNode->value)
+                                    ->callee.name) == BuiltinFunctions.end();
+    }
+  }
+};
+
+void resolve_slots(FunctionObject *func) {
+  SlotResolver resolver;
+  for (auto param : func->params) {
+    resolver.slots[param] = resolver.size++;
+  }
+  resolver.resolve_block(func->body);
+  func->num_slots = resolver.size;
+}
+
+// Calls with the same argument types this often get a copy of the function
+// body of their own, at most MaxClones per function.
+const int SpecializeThreshold = 100;
+const int MaxClones = 4;
+
+// Copies a function body for known parameter types. Binary expressions
+// whose operands are int or float literals, parameters that the body never
+// assigns or other such expressions start out quickened, so they skip
+// their first generic evaluation and never see other signatures' types.
+class Specializer {
+public:
+  std::unordered_map<std::string, DataType> types;
+
+  void forget_assigned(std::vector<Node *> &block) {
+    for (auto node : block) {
+      std::string type = node->statement_type();
+      if (type == "LetStatement") {
+        types.erase(((LetStatement *)node)->ident.name);
+      } else if (type == "AssignmentExpression") {
+        types.erase(((AssignmentExpression *)node)->ident.name);
+      } else if (type == "IfStatement") {
+        forget_assigned(((IfStatement *)node)->consequent);
+        forget_assigned(((IfStatement *)node)->alternate);
+      } else if (type == "WhileStatement") {
+        forget_assigned(((WhileStatement *)node)->block);
+      }
+    }
+  }
+
+  // The type an expression of the copy is known to have, or -1.
+  int type_of(Node *node) {
+    std::string type = node->statement_type();
+    if (type == "Literal") {
+      return ((Literal *)node)->data_type;
+    } else if (type == "Identifier") {
+      auto known = types.find(((Identifier *)node)->name);
+      return known == types.end() ? -1 : known->second;
+    } else if (type == "BinaryExpression") {
+      BinaryQuick quick = ((BinaryExpression *)node)->quick;
+      return quick == QuickInt || quick == QuickIntConst ? IntType
+             : quick == QuickFloat                       ? FloatType
+                                                         : -1;
+    }
+    return -1;
+  }
+
+  std::vector<Node *> clone_block(std::vector<Node *> &block) {
+    std::vector<Node *> copy;
+    for (auto node : block) {
+      copy.push_back(clone(node));
+    }
+    return copy;
+  }
+
+  Node *clone(Node *node) {
+    std::string type = node->statement_type();
+    if (type == "Literal") {
+      return new Literal(*(Literal *)node);
+    } else if (type == "Identifier") {
+      return new Identifier(*(Identifier *)node);
+    } else if (type == "BinaryExpression") {
+      BinaryExpression *copy = new BinaryExpression(*(BinaryExpression *)node);
+      copy->left = clone(copy->left);
+      copy->right = clone(copy->right);
+      copy->quick = QuickUnset;
+      int left = type_of(copy->left), right = type_of(copy->right);
+      if (left == IntType && right == IntType) {
+        copy->quick = QuickInt;
+        if (copy->right->statement_type() == "Literal") {
+          copy->quick = QuickIntConst;
+          copy->right_int = std::stoi(((Literal *)copy->right)->value);
+        }
+      } else if (left == FloatType && right == FloatType &&
+                 copy->op.type != Mod) {
+        copy->quick = QuickFloat;
+      }
+      return copy;
+    } else if (type == "LetStatement") {
+      LetStatement *copy = new LetStatement(*(LetStatement *)node);
+      copy->value = clone(copy->value);
+      return copy;
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *copy =
+          new AssignmentExpression(*(AssignmentExpression *)node);
+      copy->value = clone(copy->value);
+      return copy;
+    } else if (type == "IfStatement") {
+      IfStatement *copy = new IfStatement(*(IfStatement *)node);
+      copy->condition = clone(copy->condition);
+      copy->consequent = clone_block(copy->consequent);
+      copy->alternate = clone_block(copy->alternate);
+      return copy;
+    } else if (type == "WhileStatement") {
+      WhileStatement *copy = new WhileStatement(*(WhileStatement *)node);
+      copy->condition = clone(copy->condition);
+      copy->block = clone_block(copy->block);
+      copy->hotness = 0;
+      copy->untraceable = false;
+      copy->trace = nullptr;
+      copy->counted_checked = false;
+      copy->counted = nullptr;
+      return copy;
+    } else if (type == "ReturnStatement") {
+      ReturnStatement *copy = new ReturnStatement(*(ReturnStatement *)node);
+      copy->value = clone(copy->value);
+      return copy;
+    } else if (type == "CallExpression") {
+      CallExpression *copy = new CallExpression(*(CallExpression *)node);
+      copy->args = clone_block(copy->args);
+      return copy;
+    } else if (type == "ArrayExpression") {
+      ArrayExpression *copy = new ArrayExpression(*(ArrayExpression *)node);
+      copy->elements = clone_block(copy->elements);
+      return copy;
+    } else if (type == "MemberExpression") {
+      MemberExpression *copy = new MemberExpression(*(MemberExpression *)node);
+      copy->object = clone(copy->object);
+      copy->property = clone(copy->property);
+      return copy;
+    }
+    // Nested function statements are only read when they run.
+    return node;
+  }
+};
+
+// The body to run for the arguments in frame: the clone for their types if
+// there is one, else the generic body. Signatures pack three bits per
+// argument type; calls whose arguments include no int or float aren't
+// specialized.
+static std::vector<Node *> &function_body(FunctionObject *funcObj,
+                                          Object **frame) {
+  size_t argc = funcObj->params.size();
+  if (argc == 0 || argc > 20) {
+    return funcObj->body;
+  }
+  uint64_t signature = 1;
+  bool numeric = false;
+  for (size_t i = 0; i < argc; i++) {
+    if (frame[i] == nullptr) {
+      return funcObj->body;
+    }
+    DataType type = frame[i]->type();
+    numeric = numeric || type == IntType || type == FloatType;
+    signature = signature << 3 | type;
+  }
+  for (auto clone : funcObj->clones) {
+    if (clone->signature == signature) {
+      return clone->body;
+    }
+  }
+  if (!numeric || funcObj->clones.size() >= MaxClones ||
+      ++funcObj->signature_calls[signature] < SpecializeThreshold) {
+    return funcObj->body;
+  }
+  Specializer specializer;
+  for (size_t i = 0; i < argc; i++) {
+    specializer.types[funcObj->params[i]] = frame[i]->type();
+  }
+  specializer.forget_assigned(funcObj->body);
+  FunctionClone *clone = new FunctionClone();
+  clone->signature = signature;
+  clone->body = specializer.clone_block(funcObj->body);
+  funcObj->clones.push_back(clone);
+  funcObj->signature_calls.clear();
+  return clone->body;
+}
+
+static FunctionObject *find_function(CallExpression *callNode,
+                                     Environment *env) {
+  FunctionObject *funcObj = env->get_function(callNode->callee.name);
+  if (funcObj == nullptr) {
+    throw EvalError("function " + callNode->callee.name + " not defined");
+  }
+  if (callNode->args.size() != funcObj->params.size()) {
+    throw EvalError("invalid number of arguments");
+  }
+  return funcObj;
+}
+
+// A `return f(...)` in the body leaves its arguments on top of the frame and
+// sets env->tail_call, the loop then rebinds the same frame instead of
+// recursing.
+static Object *call_function(FunctionObject *funcObj, CallExpression *callNode,
+                             Environment *env) {
+  Object **frame = call_stack.push(funcObj->num_slots);
+  for (int i = 0; i < callNode->args.size(); i++) {
+    frame[i] = evaluate_expression(callNode->args[i], env);
+  }
+  Environment func_env(frame, env->globals ? env->globals : env);
+  Object *ret = evaluate(function_body(funcObj, frame), &func_env);
+  while (func_env.tail_call != nullptr) {
+    FunctionObject *next = func_env.tail_call;
+    frame = call_stack.reuse(frame, funcObj->num_slots, next->params.size(),
+                             next->num_slots);
+    funcObj = next;
+    func_env.functions.clear();
+    func_env.returning = false;
+    func_env.tail_call = nullptr;
+    ret = evaluate(function_body(funcObj, frame), &func_env);
+  }
+  call_stack.pop(funcObj->num_slots);
+  return ret;
+}
+
+static int as_int(Object *obj) {
+  switch (obj->type()) {
+  case IntType: {
+    return ((IntegerObject *)obj)->value;
+  }
+  case BoolType: {
+    return ((BoolObject *)obj)->value;
+  }
+  default: {
+    return std::stoi(obj->inspect());
+  }
+  }
+}
+
+static float as_float(Object *obj) {
+  switch (obj->type()) {
+  case IntType: {
+    return ((IntegerObject *)obj)->value;
+  }
+  case FloatType: {
+    return ((FloatObject *)obj)->value;
+  }
+  case BoolType: {
+    return ((BoolObject *)obj)->value;
+  }
+  default: {
+    return std::stof(obj->inspect());
+  }
+  }
+}
+
 Object *evaluate_operator(Object *left, Object *right, Token op) {
+  return evaluate_operator(left, right, op.type);
+}
+
+Object *evaluate_operator(Object *left, Object *right, TokenType op) {
   // if (left->type() != right->type()) {
   // std::cout << "WARNING: type mismatch while operating\n";
   // throw EvalError("type mismatch while operating");
   // }
   if ((left->type() == StringType || right->type() == StringType) &&
-      op.type == Plus) {
+      op == Plus) {
     return new StringObject(left->inspect() + right->inspect());
   } else if (left->type() == FloatType || right->type() == FloatType) {
     FloatObject *left_float;
-    if (op.type == Mod) {
+    if (op == Mod) {
       throw EvalError("cannot use % on floats");
     }
-    return new FloatObject(evaluate_primary_op(
-        std::stof(left->inspect()), std::stof(right->inspect()), op.type));
+    return new FloatObject(
+        evaluate_primary_op(as_float(left), as_float(right), op));
   } else if (left->type() == IntType || right->type() == IntType) {
-    return new IntegerObject(evaluate_primary_op(
-        std::stoi(left->inspect()), std::stoi(right->inspect()), op.type));
+    return IntegerObject::make(
+        evaluate_primary_op(as_int(left), as_int(right), op));
   } else if (left->type() == BoolType || right->type() == BoolType) {
-    return new IntegerObject(evaluate_primary_op(
-        (int)left->is_truthy(), (int)right->is_truthy(), op.type));
+    return IntegerObject::make(evaluate_primary_op(
+        (int)left->is_truthy(), (int)right->is_truthy(), op));
   }
   throw EvalError("unknown operator");
   return nullptr;
 }
 
+// The vtable pointer tells the class of an object without a virtual call.
+static const void *vtable(Object *obj) { return *(const void **)obj; }
+
+static IntegerObject int_probe(0);
+static FloatObject float_probe(0);
+static const void *const IntVtable = vtable(&int_probe);
+static const void *const FloatVtable = vtable(&float_probe);
+
+// Specializes a binary expression to the operand types it first saw. The
+// specialized forms only check the vtables of their operands and go back to
+// QuickGeneric for good when that check fails.
+static void quicken(BinaryExpression *bNode, Object *left, Object *right) {
+  bNode->quick = QuickGeneric;
+  if (vtable(left) == IntVtable && vtable(right) == IntVtable) {
+    bNode->quick = QuickInt;
+    if (bNode->right->statement_type() == "Literal") {
+      bNode->quick = QuickIntConst;
+      bNode->right_int = ((IntegerObject *)right)->value;
+    }
+  } else if (vtable(left) == FloatVtable && vtable(right) == FloatVtable &&
+             bNode->op.type != Mod) {
+    bNode->quick = QuickFloat;
+  }
+}
+
+static Object *identifier_value(Identifier *ident, Environment *env) {
+  Object *obj = env->get(ident);
+  if (obj == nullptr) {
+    throw EvalError("undefined identifier: " + ident->name);
+  }
+  return obj;
+}
+
+// Branches on a FusedCompare without making its value.
+static bool compare_identifiers(BinaryExpression *bNode, Environment *env) {
+  Object *left = identifier_value((Identifier *)bNode->left, env);
+  Object *right = identifier_value((Identifier *)bNode->right, env);
+  TokenType op = bNode->op.type;
+  if (vtable(left) == IntVtable && vtable(right) == IntVtable) {
+    return evaluate_primary_op(((IntegerObject *)left)->value,
+                               ((IntegerObject *)right)->value, op);
+  }
+  if (vtable(left) == FloatVtable && vtable(right) == FloatVtable) {
+    return evaluate_primary_op(((FloatObject *)left)->value,
+                               ((FloatObject *)right)->value, op);
+  }
+  return evaluate_operator(left, right, op)->is_truthy();
+}
+
+static bool condition_holds(Node *condition, bool fused_compare,
+                            Environment *env) {
+  if (fused_compare) {
+    return compare_identifiers((BinaryExpression *)condition, env);
+  }
+  return evaluate_expression(condition, env)->is_truthy();
+}
+
+// Evaluates a FusedCompare or FusedModEqual reading its operands directly.
+// Only ints take the short way, anything else goes through
+// evaluate_operator() like the nodes it was made of.
+static Object *evaluate_fused(BinaryExpression *bNode, Environment *env) {
+  if (bNode->fused == FusedCompare) {
+    Object *left = identifier_value((Identifier *)bNode->left, env);
+    Object *right = identifier_value((Identifier *)bNode->right, env);
+    if (vtable(left) == IntVtable && vtable(right) == IntVtable) {
+      return IntegerObject::make(
+          evaluate_primary_op(((IntegerObject *)left)->value,
+                              ((IntegerObject *)right)->value, bNode->op.type));
+    }
+    ScratchScope scope(bNode->temporary);
+    return evaluate_operator(left, right, bNode->op);
+  }
+  BinaryExpression *modNode = (BinaryExpression *)bNode->left;
+  Object *value = evaluate_expression(modNode->left, env);
+  if (vtable(value) == IntVtable) {
+    return IntegerObject::make(((IntegerObject *)value)->value %
+                                   bNode->modulus ==
+                               bNode->right_int);
+  }
+  ScratchScope scope(bNode->temporary);
+  Object *remainder = evaluate_operator(
+      value, IntegerObject::make(bNode->modulus), modNode->op);
+  return evaluate_operator(remainder, IntegerObject::make(bNode->right_int),
+                           bNode->op);
+}
+
+// Runs a FusedAddConst or FusedNegate assignment, `x = x op c`.
+static void assign_fused(AssignmentExpression *assNode, Environment *env) {
+  if (!env->has(&assNode->ident)) {
+    throw EvalError("variable not defined");
+  }
+  Object *obj = identifier_value(&assNode->ident, env);
+  TokenType op = ((BinaryExpression *)assNode->value)->op.type;
+  int constant = assNode->fused_constant;
+  Object *result;
+  if (vtable(obj) == IntVtable) {
+    result = IntegerObject::make(
+        evaluate_primary_op(((IntegerObject *)obj)->value, constant, op));
+  } else if (vtable(obj) == FloatVtable) {
+    result = new FloatObject(evaluate_primary_op(
+        ((FloatObject *)obj)->value, (float)constant, op));
+  } else {
+    result = evaluate_operator(obj, IntegerObject::make(constant), op);
+  }
+  env->set(&assNode->ident, result);
+}
+
+static Object *evaluate_binary(BinaryExpression *bNode, Environment *env) {
+  if (bNode->fused != FusedNone) {
+    return evaluate_fused(bNode, env);
+  }
+  Object *left = evaluate_expression(bNode->left, env);
+  TokenType op = bNode->op.type;
+  if (bNode->quick == QuickIntConst) {
+    if (vtable(left) == IntVtable) {
+      ScratchScope scope(bNode->temporary);
+      return IntegerObject::make(evaluate_primary_op(
+          ((IntegerObject *)left)->value, bNode->right_int, op));
+    }
+    bNode->quick = QuickGeneric;
+  }
+  heap.no_gc_depth++;
+  Object *right = evaluate_expression(bNode->right, env);
+  heap.no_gc_depth--;
+  ScratchScope scope(bNode->temporary);
+  switch (bNode->quick) {
+  case QuickInt: {
+    if (vtable(left) == IntVtable && vtable(right) == IntVtable) {
+      return IntegerObject::make(evaluate_primary_op(
+          ((IntegerObject *)left)->value, ((IntegerObject *)right)->value,
+          op));
+    }
+    bNode->quick = QuickGeneric;
+    break;
+  }
+  case QuickFloat: {
+    if (vtable(left) == FloatVtable && vtable(right) == FloatVtable) {
+      return new FloatObject(evaluate_primary_op(
+          ((FloatObject *)left)->value, ((FloatObject *)right)->value, op));
+    }
+    bNode->quick = QuickGeneric;
+    break;
+  }
+  case QuickUnset: {
+    quicken(bNode, left, right);
+    break;
+  }
+  default: {
+    break;
+  }
+  }
+  return evaluate_operator(left, right, bNode->op);
+}
+
 Object *evaluate_expression(Node *node, Environment *env) {
+  eval_steps++;
   if (node->statement_type() == "BinaryExpression") {
-    BinaryExpression *bNode = (BinaryExpression *)node;
-    Object *left = evaluate_expression(bNode->left, env);
-    Object *right = evaluate_expression(bNode->right, env);
-    return evaluate_operator(left, right, bNode->op);
+    return evaluate_binary((BinaryExpression *)node, env);
   } else if (node->statement_type() == "Literal") {
+    ScratchScope scope(((Literal *)node)->temporary);
     Object *obj = get_obj_from_literal((Literal *)node);
     if (obj == nullptr) {
       throw EvalError("invalid literal type " + ((Literal *)node)->type);
     }
     return obj;
   } else if (node->statement_type() == "Identifier") {
-    Object *obj = env->get_identifier(((Identifier *)node)->name);
+    Object *obj = env->get((Identifier *)node);
     if (obj == nullptr) {
       throw EvalError("undefined identifier: " + ((Identifier *)node)->name);
     }
     return obj;
   } else if (node->statement_type() == "CallExpression") {
     CallExpression *callNode = (CallExpression *)node;
-    if (BuiltinFunctions.find(callNode->callee.name) !=
-        BuiltinFunctions.end()) {
-      return BuiltinFunctions.find(callNode->callee.name)->second(node, env);
-    }
-    if (env->functions.find(callNode->callee.name) == env->functions.end()) {
-      throw EvalError("function " + callNode->callee.name + " not defined");
-    }
-    FunctionObject *funcObj =
-        (FunctionObject *)env->functions[callNode->callee.name];
-    if (callNode->args.size() != funcObj->params.size()) {
-      throw EvalError("invalid number of arguments");
+    auto builtin = BuiltinFunctions.find(callNode->callee.name);
+    if (builtin != BuiltinFunctions.end()) {
+      std::vector<Object *> args;
+      heap.no_gc_depth++;
+      for (auto arg : callNode->args) {
+        args.push_back(evaluate_expression(arg, env));
+      }
+      heap.no_gc_depth--;
+      return builtin->second(args);
     }
-    int i = 0;
-    Environment *func_env = new Environment();
-    for (auto param : funcObj->params) {
-      func_env->store[param] = evaluate_expression(callNode->args[i], env);
+    return call_function(find_function(callNode, env), callNode, env);
+  } else if (node->statement_type() == "ArrayExpression") {
+    std::vector<Object *> arr;
+    heap.no_gc_depth++;
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      arr.push_back(evaluate_expression(elem, env));
     }
-    return evaluate(funcObj->body, func_env);
+    heap.no_gc_depth--;
+    return new ArrayObject(arr);
   } else if (node->statement_type() == "MemberExpression") {
     MemberExpression *memNode = (MemberExpression *)node;
-    std::string object = ((Identifier *)memNode->object)->name;
-    if (env->store.find(object) == env->store.end()) {
-      throw EvalError("object not defined");
+    if (memNode->counted != nullptr) {
+      return ((ArrayObject *)env->get((Identifier *)memNode->object))
+          ->elements[memNode->counted->index + memNode->offset];
     }
-    ArrayObject *value = (ArrayObject *)env->store[object];
     Object *prop = evaluate_expression(memNode->property, env);
+    ArrayObject *value =
+        (ArrayObject *)env->get((Identifier *)memNode->object);
+    if (value == nullptr) {
+      throw EvalError("object not defined");
+    }
     if (prop->type() != IntType) {
       throw EvalError("invalid property type");
     }
@@ -91,41 +597,304 @@ Object *evaluate_expression(Node *node, Environment *env) {
   return nullptr;
 }
 
-Object *evaluate(std::vector<Node *> program, Environment *env) {
+static bool int_literal(Node *node, int &value) {
+  if (node->statement_type() != "Literal" ||
+      ((Literal *)node)->data_type != IntType) {
+    return false;
+  }
+  try {
+    value = std::stoi(((Literal *)node)->value);
+  } catch (std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+// Whether node is the counter i, or `i + c` or `i - c` with an int literal
+// c, setting offset to 0, c or -c.
+static bool counter_offset(Node *node, CountedLoop *loop, int &offset) {
+  std::string type = node->statement_type();
+  if (type == "Identifier") {
+    offset = 0;
+    return ((Identifier *)node)->name == loop->counter->name;
+  }
+  if (type != "BinaryExpression") {
+    return false;
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  TokenType op = bNode->op.type;
+  if ((op != Plus && op != Minus) ||
+      bNode->left->statement_type() != "Identifier" ||
+      ((Identifier *)bNode->left)->name != loop->counter->name ||
+      !int_literal(bNode->right, offset) || offset == INT_MIN) {
+    return false;
+  }
+  offset = op == Plus ? offset : -offset;
+  return true;
+}
+
+// Collects the variables the body assigns, whether it reads the counter and
+// the array reads indexed by it.
+static void scan_counted(Node *node, CountedLoop *loop,
+                         std::vector<std::string> &assigned) {
+  std::string type = node->statement_type();
+  if (type == "Identifier") {
+    if (((Identifier *)node)->name == loop->counter->name) {
+      loop->counter_read = true;
+    }
+  } else if (type == "LetStatement") {
+    assigned.push_back(((LetStatement *)node)->ident.name);
+    scan_counted(((LetStatement *)node)->value, loop, assigned);
+  } else if (type == "AssignmentExpression") {
+    assigned.push_back(((AssignmentExpression *)node)->ident.name);
+    scan_counted(((AssignmentExpression *)node)->value, loop, assigned);
+  } else if (type == "BinaryExpression") {
+    scan_counted(((BinaryExpression *)node)->left, loop, assigned);
+    scan_counted(((BinaryExpression *)node)->right, loop, assigned);
+  } else if (type == "CallExpression") {
+    for (auto arg : ((CallExpression *)node)->args) {
+      scan_counted(arg, loop, assigned);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      scan_counted(elem, loop, assigned);
+    }
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    int offset;
+    if (counter_offset(memNode->property, loop, offset)) {
+      loop->accesses.push_back(IndexAccess{memNode, offset});
+    }
+    scan_counted(memNode->object, loop, assigned);
+    scan_counted(memNode->property, loop, assigned);
+  } else if (type == "ReturnStatement") {
+    scan_counted(((ReturnStatement *)node)->value, loop, assigned);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    scan_counted(ifNode->condition, loop, assigned);
+    for (auto child : ifNode->consequent) {
+      scan_counted(child, loop, assigned);
+    }
+    for (auto child : ifNode->alternate) {
+      scan_counted(child, loop, assigned);
+    }
+  } else if (type == "WhileStatement") {
+    scan_counted(((WhileStatement *)node)->condition, loop, assigned);
+    for (auto child : ((WhileStatement *)node)->block) {
+      scan_counted(child, loop, assigned);
+    }
+  }
+}
+
+// Recognizes a counted loop: a comparison of a variable, or of the variable
+// plus or minus an int literal, with a variable or an int literal, and a
+// body ending in a constant increment of the variable. A bare index
+// statement in the body would skip the increment, so it rules the loop out
+// like any other assignment of i or n. Array reads indexed by i get a copy
+// of the body to run when they are known to be in bounds.
+static CountedLoop *counted_loop(WhileStatement *whileNode) {
+  std::vector<Node *> &block = whileNode->block;
+  if (whileNode->condition->statement_type() != "BinaryExpression" ||
+      block.empty() ||
+      block.back()->statement_type() != "AssignmentExpression") {
+    return nullptr;
+  }
+  BinaryExpression *cond = (BinaryExpression *)whileNode->condition;
+  TokenType op = cond->op.type;
+  if (op != Lt && op != Lte && op != Gt && op != Gte && op != NotEqual) {
+    return nullptr;
+  }
+  AssignmentExpression *inc = (AssignmentExpression *)block.back();
+  CountedLoop *loop = new CountedLoop();
+  loop->counter = &inc->ident;
+  loop->bound = cond->right;
+  loop->op = op;
+  int step;
+  bool valid = counter_offset(cond->left, loop, loop->cond_offset) &&
+               counter_offset(inc->value, loop, step) &&
+               inc->value->statement_type() == "BinaryExpression" &&
+               (int_literal(loop->bound, loop->limit) ||
+                (loop->bound->statement_type() == "Identifier" &&
+                 ((Identifier *)loop->bound)->name != loop->counter->name));
+  if (valid) {
+    loop->step = step;
+    loop->body.assign(block.begin(), block.end() - 1);
+    std::vector<std::string> assigned;
+    for (auto child : loop->body) {
+      if (child->statement_type() == "MemberExpression") {
+        valid = false;
+      }
+      scan_counted(child, loop, assigned);
+    }
+    for (auto &name : assigned) {
+      if (name == loop->counter->name ||
+          (loop->bound->statement_type() == "Identifier" &&
+           name == ((Identifier *)loop->bound)->name)) {
+        valid = false;
+      }
+      for (size_t i = 0; i < loop->accesses.size();) {
+        if (((Identifier *)loop->accesses[i].node->object)->name == name) {
+          loop->accesses.erase(loop->accesses.begin() + i);
+        } else {
+          i++;
+        }
+      }
+    }
+  }
+  if (!valid) {
+    delete loop;
+    return nullptr;
+  }
+  if (!loop->accesses.empty()) {
+    // The copies take what is set on the originals for the duration.
+    for (auto &access : loop->accesses) {
+      access.node->counted = loop;
+      access.node->offset = access.offset;
+    }
+    Specializer specializer;
+    loop->unchecked_body = specializer.clone_block(loop->body);
+    for (auto &access : loop->accesses) {
+      access.node->counted = nullptr;
+      access.node->offset = 0;
+    }
+  }
+  return loop;
+}
+
+// Whether every array read indexed by i stays in bounds for all the values
+// i takes from start on. Only loops counting up to a < or <= bound, or down
+// to a > or >= bound, whose i and i + cond_offset stay ints all the way are
+// worked out.
+static bool indices_in_bounds(CountedLoop *loop, int start, int limit,
+                              Environment *env) {
+  int64_t step = loop->step;
+  int64_t bound = (int64_t)limit - loop->cond_offset;
+  int64_t low, high, exit;
+  if (step > 0 && (loop->op == Lt || loop->op == Lte)) {
+    high = loop->op == Lt ? bound - 1 : bound;
+    if (start > high) {
+      return false;
+    }
+    low = start;
+    high = start + (high - start) / step * step;
+    exit = high + step;
+  } else if (step < 0 && (loop->op == Gt || loop->op == Gte)) {
+    low = loop->op == Gt ? bound + 1 : bound;
+    if (start < low) {
+      return false;
+    }
+    high = start;
+    low = start - (start - low) / -step * -step;
+    exit = low + step;
+  } else {
+    return false;
+  }
+  for (int64_t value : {low, high, exit}) {
+    if (value < INT_MIN || value > INT_MAX ||
+        value + loop->cond_offset < INT_MIN ||
+        value + loop->cond_offset > INT_MAX) {
+      return false;
+    }
+  }
+  for (auto &access : loop->accesses) {
+    Object *array = env->get((Identifier *)access.node->object);
+    if (array == nullptr || array->type() != ArrayType ||
+        low + access.offset < 0 ||
+        high + access.offset >= ((ArrayObject *)array)->elements.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Runs a counted loop, storing i only where the body reads it and once at
+// the end. Returns false without doing anything when i or n isn't an int,
+// the loop then runs the usual way.
+static bool run_counted_loop(CountedLoop *loop, Environment *env,
+                             Object *&ret) {
+  Object *start = env->get(loop->counter);
+  if (start == nullptr || vtable(start) != IntVtable) {
+    return false;
+  }
+  int limit = loop->limit;
+  if (loop->bound->statement_type() == "Identifier") {
+    Object *bound = env->get((Identifier *)loop->bound);
+    if (bound == nullptr || vtable(bound) != IntVtable) {
+      return false;
+    }
+    limit = ((IntegerObject *)bound)->value;
+  }
+  int counter = ((IntegerObject *)start)->value;
+  std::vector<Node *> *body = &loop->body;
+  if (!loop->accesses.empty() &&
+      indices_in_bounds(loop, counter, limit, env)) {
+    body = &loop->unchecked_body;
+  }
+  // A recursive call can run the same loop inside the body.
+  int outer_index = loop->index;
+  size_t scratch = heap.scratch_top;
+  ret = nullptr;
+  while (evaluate_primary_op(
+      evaluate_primary_op(counter, loop->cond_offset, Plus), limit,
+      loop->op)) {
+    heap.release_scratch(scratch);
+    if (loop->counter_read) {
+      env->set(loop->counter, IntegerObject::make(counter));
+    }
+    loop->index = counter;
+    ret = evaluate(*body, env);
+    if (env->returning) {
+      break;
+    }
+    counter = evaluate_primary_op(counter, loop->step, Plus);
+  }
+  loop->index = outer_index;
+  env->set(loop->counter, IntegerObject::make(counter));
+  return true;
+}
+
+Object *evaluate(std::vector<Node *> &program, Environment *env) {
+  // Whatever the previous statement left in the scratch area is dead.
+  size_t scratch = heap.scratch_top;
   for (auto node : program) {
+    eval_steps++;
+    if (heap.scratch_top != scratch) {
+      heap.release_scratch(scratch);
+    }
+    if (heap.no_gc_depth == 0) {
+      heap.safepoint();
+    }
     std::string type = node->statement_type();
     if (type == "LetStatement") {
       LetStatement *letNode = (LetStatement *)node;
       std::string name = letNode->ident.name;
-      if (env->store.find(name) != env->store.end()) {
+      if (env->has(&letNode->ident)) {
         throw EvalError("variable already defined: " + name);
       }
-      if (letNode->value->statement_type() == "ArrayExpression") {
-        ArrayExpression *arrNode = (ArrayExpression *)letNode->value;
-        std::vector<Object *> arr;
-        for (auto elem : arrNode->elements) {
-          arr.push_back(evaluate_expression(elem, env));
-        }
-        env->store[name] = new ArrayObject(arr);
-        continue;
-      }
       Object *obj = evaluate_expression(letNode->value, env);
-      env->store[name] = obj;
+      env->set(&letNode->ident, obj);
     } else if (type == "AssignmentExpression") {
       AssignmentExpression *assNode = (AssignmentExpression *)node;
-      std::string name = assNode->ident.name;
-      if (env->store.find(name) == env->store.end()) {
+      if (assNode->fused != FusedNone) {
+        assign_fused(assNode, env);
+        continue;
+      }
+      if (!env->has(&assNode->ident)) {
         throw EvalError("variable not defined");
       }
       Object *obj = evaluate_expression(assNode->value, env);
-      env->store[name] = obj;
+      env->set(&assNode->ident, obj);
     } else if (type == "IfStatement") {
       IfStatement *ifNode = (IfStatement *)node;
       // std::cout << "if statement\n";
-      if (evaluate_expression(ifNode->condition, env)->is_truthy()) {
-        evaluate(ifNode->consequent, env);
+      Object *ret = nullptr;
+      if (condition_holds(ifNode->condition, ifNode->fused_compare, env)) {
+        ret = evaluate(ifNode->consequent, env);
       } else if (ifNode->alternate.size() > 0) {
-        evaluate(ifNode->alternate, env);
+        ret = evaluate(ifNode->alternate, env);
+      }
+      if (env->returning) {
+        return ret;
       }
     } else if (type == "FunctionStatement") {
       FunctionStatement *funcNode = (FunctionStatement *)node;
@@ -133,23 +902,57 @@ Object *evaluate(std::vector<Node *> program, Environment *env) {
       if (env->functions.find(name) != env->functions.end()) {
         throw EvalError("function already defined");
       }
-      std::unordered_map<std::string, Object *> params;
       std::vector<std::string> params_vec;
       for (auto param : funcNode->params) {
         params_vec.push_back(param->name);
       }
 
       FunctionObject *funcObj = new FunctionObject(funcNode->block, params_vec);
+      resolve_slots(funcObj);
       env->functions[name] = funcObj;
     } else if (type == "CallExpression") {
       evaluate_expression(node, env);
     } else if (type == "WhileStatement") {
       WhileStatement *whileNode = (WhileStatement *)node;
-      while (evaluate_expression(whileNode->condition, env)->is_truthy()) {
-        evaluate(whileNode->block, env);
+      // Loops the tracing JIT may compile are left to it.
+      if (trace_jit == nullptr) {
+        if (!whileNode->counted_checked) {
+          whileNode->counted = counted_loop(whileNode);
+          whileNode->counted_checked = true;
+        }
+        Object *ret;
+        if (whileNode->counted != nullptr &&
+            run_counted_loop(whileNode->counted, env, ret)) {
+          if (env->returning) {
+            return ret;
+          }
+          continue;
+        }
+      }
+      while (condition_holds(whileNode->condition, whileNode->fused_compare,
+                             env)) {
+        heap.release_scratch(scratch);
+        Object *ret = evaluate(whileNode->block, env);
+        if (env->returning) {
+          return ret;
+        }
+        if (trace_jit != nullptr) {
+          trace_jit->loop(whileNode, env);
+        }
       }
     } else if (type == "ReturnStatement") {
       ReturnStatement *retNode = (ReturnStatement *)node;
+      env->returning = true;
+      if (retNode->tail_call && env->slots != nullptr) {
+        CallExpression *callNode = (CallExpression *)retNode->value;
+        FunctionObject *funcObj = find_function(callNode, env);
+        Object **args = call_stack.push(callNode->args.size());
+        for (int i = 0; i < callNode->args.size(); i++) {
+          args[i] = evaluate_expression(callNode->args[i], env);
+        }
+        env->tail_call = funcObj;
+        return nullptr;
+      }
       return evaluate_expression(retNode->value, env);
     } else if (type == "MemberExpression") {
       return evaluate_expression(node, env);
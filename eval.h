@@ -62,9 +62,33 @@ VarType evaluate_primary_op(VarType x, VarType y, TokenType op) {
   throw EvalError("unknown operator");
 }
 
+// Contiguous stack holding the slots of every active script function frame.
+class CallStack {
+public:
+  CallStack(size_t capacity);
+  Object **push(int size);
+  void pop(int size);
+  Object **reuse(Object **frame, int size, int argc, int new_size);
+  void register_roots();
+
+private:
+  Object **slots;
+  size_t capacity;
+  size_t top = 0;
+};
+
+extern CallStack call_stack;
+
+// Statements and expressions evaluated so far, reported by --exec-stats.
+extern size_t eval_steps;
+
+void resolve_slots(FunctionObject *func);
+
 Object *evaluate_operator(Object *left, Object *right, Token op);
 
-Object *evaluate(std::vector<Node *> program, Environment *env);
+Object *evaluate_operator(Object *left, Object *right, TokenType op);
+
+Object *evaluate(std::vector<Node *> &program, Environment *env);
 
 Object *evaluate_expression(Node *node, Environment *env);
 
@@ -0,0 +1,208 @@
+#include "fuse.h"
+#include <algorithm>
+
+// Whether node is an int literal, and its value.
+static bool int_literal(Node *node, int &value) {
+  if (node->statement_type() != "Literal" ||
+      ((Literal *)node)->data_type != IntType) {
+    return false;
+  }
+  try {
+    value = std::stoi(((Literal *)node)->value);
+  } catch (std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+static bool is_comparison(TokenType op) {
+  return op == Lt || op == Lte || op == Gt || op == Gte || op == Equal ||
+         op == NotEqual;
+}
+
+void NodeFuser::run(std::vector<Node *> &program) { fuse_block(program); }
+
+void NodeFuser::fuse_block(std::vector<Node *> &block) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      fuse_expression(((LetStatement *)node)->value);
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *assNode = (AssignmentExpression *)node;
+      fuse_expression(assNode->value);
+      if (assNode->value->statement_type() != "BinaryExpression") {
+        continue;
+      }
+      BinaryExpression *bNode = (BinaryExpression *)assNode->value;
+      int constant;
+      if (bNode->left->statement_type() != "Identifier" ||
+          ((Identifier *)bNode->left)->name != assNode->ident.name ||
+          !int_literal(bNode->right, constant)) {
+        continue;
+      }
+      if (bNode->op.type == Plus || bNode->op.type == Minus) {
+        assNode->fused = FusedAddConst;
+      } else if (bNode->op.type == Mul && constant == -1) {
+        assNode->fused = FusedNegate;
+      } else {
+        continue;
+      }
+      assNode->fused_constant = constant;
+      fused++;
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      fuse_expression(ifNode->condition);
+      ifNode->fused_compare =
+          ifNode->condition->statement_type() == "BinaryExpression" &&
+          ((BinaryExpression *)ifNode->condition)->fused == FusedCompare;
+      fuse_block(ifNode->consequent);
+      fuse_block(ifNode->alternate);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      fuse_expression(whileNode->condition);
+      whileNode->fused_compare =
+          whileNode->condition->statement_type() == "BinaryExpression" &&
+          ((BinaryExpression *)whileNode->condition)->fused == FusedCompare;
+      fuse_block(whileNode->block);
+    } else if (type == "FunctionStatement") {
+      fuse_block(((FunctionStatement *)node)->block);
+    } else if (type == "ReturnStatement") {
+      fuse_expression(((ReturnStatement *)node)->value);
+    } else {
+      fuse_expression(node);
+    }
+  }
+}
+
+void NodeFuser::fuse_expression(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "CallExpression") {
+    for (auto arg : ((CallExpression *)node)->args) {
+      fuse_expression(arg);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      fuse_expression(elem);
+    }
+  } else if (type == "MemberExpression") {
+    fuse_expression(((MemberExpression *)node)->property);
+  }
+  if (type != "BinaryExpression") {
+    return;
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  fuse_expression(bNode->left);
+  fuse_expression(bNode->right);
+  if (is_comparison(bNode->op.type) &&
+      bNode->left->statement_type() == "Identifier" &&
+      bNode->right->statement_type() == "Identifier") {
+    bNode->fused = FusedCompare;
+    fused++;
+    return;
+  }
+  int modulus, expected;
+  if (bNode->op.type != Equal || !int_literal(bNode->right, expected) ||
+      bNode->left->statement_type() != "BinaryExpression") {
+    return;
+  }
+  BinaryExpression *modNode = (BinaryExpression *)bNode->left;
+  if (modNode->op.type == Mod && int_literal(modNode->right, modulus) &&
+      modulus > 0) {
+    bNode->fused = FusedModEqual;
+    bNode->modulus = modulus;
+    bNode->right_int = expected;
+    fused++;
+  }
+}
+
+void ShapeCounter::count(std::vector<Node *> &program) {
+  for (auto node : program) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      LetStatement *letNode = (LetStatement *)node;
+      counts["let x = " + shape(letNode->value, letNode->ident.name, 0)]++;
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *assNode = (AssignmentExpression *)node;
+      counts["x = " + shape(assNode->value, assNode->ident.name, 0)]++;
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      counts["if (" + shape(ifNode->condition, "", 0) + ")"]++;
+      count(ifNode->consequent);
+      count(ifNode->alternate);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      counts["while (" + shape(whileNode->condition, "", 0) + ")"]++;
+      count(whileNode->block);
+    } else if (type == "FunctionStatement") {
+      counts["func"]++;
+      count(((FunctionStatement *)node)->block);
+    } else if (type == "ReturnStatement") {
+      counts["return " + shape(((ReturnStatement *)node)->value, "", 0)]++;
+    } else {
+      counts[shape(node, "", 0)]++;
+    }
+  }
+}
+
+std::string ShapeCounter::shape(Node *node, const std::string &assigned,
+                                int depth) {
+  std::string type = node->statement_type();
+  if (type == "Identifier") {
+    return ((Identifier *)node)->name == assigned ? "x" : "id";
+  } else if (type == "Literal") {
+    Literal *literal = (Literal *)node;
+    if (literal->data_type == IntType &&
+        (literal->value == "-1" || literal->value == "0" ||
+         literal->value == "1")) {
+      return literal->value;
+    }
+    switch (literal->data_type) {
+    case IntType: {
+      return "int";
+    }
+    case FloatType: {
+      return "float";
+    }
+    case StringType: {
+      return "str";
+    }
+    default: {
+      return "bool";
+    }
+    }
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    return shape(memNode->object, assigned, depth) + "[" +
+           shape(memNode->property, assigned, depth + 1) + "]";
+  } else if (type == "CallExpression") {
+    return "call";
+  } else if (type == "ArrayExpression") {
+    return "[...]";
+  } else if (type != "BinaryExpression") {
+    return type;
+  }
+  if (depth >= 2) {
+    return "expr";
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  std::string text = shape(bNode->left, assigned, depth + 1) + " " +
+                     bNode->op.literal + " " +
+                     shape(bNode->right, assigned, depth + 1);
+  return depth > 0 ? "(" + text + ")" : text;
+}
+
+// The shapes from the most to the least frequent.
+std::string ShapeCounter::report() {
+  std::vector<std::pair<int, std::string>> sorted;
+  for (auto &[text, count] : counts) {
+    sorted.push_back({-count, text});
+  }
+  std::sort(sorted.begin(), sorted.end());
+  std::string out;
+  for (auto &[count, text] : sorted) {
+    std::string number = std::to_string(-count);
+    out += std::string(6 - std::min<size_t>(6, number.size()), ' ') + number +
+           "  " + text + "\n";
+  }
+  return out;
+}
@@ -0,0 +1,38 @@
+#include "ast.h"
+#include "common.h"
+#include <map>
+
+#ifndef fuse_h
+#define fuse_h
+
+// Marks the statements and expressions of the shapes in FusedShape so that
+// the evaluator runs them in one step, without evaluating their operands as
+// separate nodes or making the intermediate objects. Nodes keep their type
+// and children, so the other engines and passes still see the plain tree;
+// it runs last, right before the ast engine evaluates the program.
+class NodeFuser {
+public:
+  void run(std::vector<Node *> &program);
+  int fused = 0;
+
+private:
+  void fuse_block(std::vector<Node *> &block);
+  void fuse_expression(Node *node);
+};
+
+// Counts the shapes of the statements of some scripts for --shape-stats,
+// to find out which are worth fusing. Identifiers become `x` when they are
+// the variable being assigned and `id` otherwise, literals their type (but
+// -1, 0 and 1 stay as they are) and expressions nested deeper than two
+// operators `expr`.
+class ShapeCounter {
+public:
+  void count(std::vector<Node *> &program);
+  std::string report();
+
+private:
+  std::string shape(Node *node, const std::string &assigned, int depth);
+  std::map<std::string, int> counts;
+};
+
+#endif // !fuse_h
@@ -0,0 +1,283 @@
+#include "gc.h"
+#include "ast.h"
+
+Heap heap(1 << 20);
+
+static GcHeader *header_of(Object *obj) { return (GcHeader *)obj - 1; }
+
+static size_t align_size(size_t size) { return (size + 15) & ~(size_t)15; }
+
+Heap::Heap(size_t nursery_size) {
+  nursery = (char *)::operator new(nursery_size);
+  nursery_top = nursery;
+  nursery_end = nursery + nursery_size;
+  nursery_limit = nursery + nursery_size / 4 * 3;
+  major_threshold = 8 << 20;
+  scratch = (char *)::operator new(ScratchSize);
+}
+
+void *Heap::allocate(size_t size) {
+  size_t total = align_size(sizeof(GcHeader) + size);
+  if (scratch_allocating && scratch_top + total <= ScratchSize) {
+    GcHeader *header = (GcHeader *)(scratch + scratch_top);
+    scratch_top += total;
+    scratch_allocations++;
+    header->size = size;
+    header->marked = true;
+    header->forwarded = false;
+    header->next = nullptr;
+    return header + 1;
+  }
+  allocations++;
+  if (promoting || nursery_top + total > nursery_end) {
+    collect_requested = true;
+    return allocate_old(size);
+  }
+  GcHeader *header = (GcHeader *)nursery_top;
+  nursery_top += total;
+  if (nursery_top > nursery_limit) {
+    collect_requested = true;
+  }
+  header->size = size;
+  header->marked = false;
+  header->forwarded = false;
+  header->next = nullptr;
+  return header + 1;
+}
+
+void *Heap::allocate_pinned(size_t size) {
+  GcHeader *header = (GcHeader *)::operator new(sizeof(GcHeader) + size);
+  header->size = size;
+  header->marked = true;
+  header->forwarded = false;
+  header->next = nullptr;
+  return header + 1;
+}
+
+void Heap::release_scratch(size_t mark) {
+  while (!scratch_finalizers.empty() &&
+         (char *)scratch_finalizers.back() >= scratch + mark) {
+    scratch_finalizers.back()->~Object();
+    scratch_finalizers.pop_back();
+  }
+  scratch_top = mark;
+}
+
+void *Heap::allocate_old(size_t size) {
+  size_t total = align_size(sizeof(GcHeader) + size);
+  size_t size_class = total / 16 - 1;
+  GcHeader *header;
+  if (size_class >= SizeClasses) {
+    header = (GcHeader *)::operator new(total);
+  } else if (free_lists[size_class] != nullptr) {
+    header = free_lists[size_class];
+    free_lists[size_class] = header->next;
+  } else {
+    if (slab_end - slab_top < (ptrdiff_t)total) {
+      slab_top = (char *)::operator new(SlabSize);
+      slab_end = slab_top + SlabSize;
+    }
+    header = (GcHeader *)slab_top;
+    slab_top += total;
+  }
+  header->size = size;
+  header->marked = false;
+  header->forwarded = false;
+  header->next = old_objects;
+  old_objects = header;
+  old_bytes += size;
+  return header + 1;
+}
+
+void Heap::free_old(GcHeader *header) {
+  old_bytes -= header->size;
+  size_t size_class = align_size(sizeof(GcHeader) + header->size) / 16 - 1;
+  if (size_class >= SizeClasses) {
+    ::operator delete(header);
+    return;
+  }
+  header->next = free_lists[size_class];
+  free_lists[size_class] = header;
+}
+
+// Only reached when a constructor throws, everything else dies in bulk.
+void Heap::release(void *ptr) {
+  GcHeader *header = (GcHeader *)ptr - 1;
+  if ((char *)header >= nursery && (char *)header < nursery_end) {
+    return;
+  }
+  for (GcHeader **link = &old_objects; *link != nullptr;
+       link = &(*link)->next) {
+    if (*link == header) {
+      *link = header->next;
+      free_old(header);
+      return;
+    }
+  }
+}
+
+bool Heap::is_young(Object *obj) {
+  return (char *)obj >= nursery && (char *)obj < nursery_end;
+}
+
+void Heap::register_finalizer(Object *obj) {
+  if (is_young(obj)) {
+    finalizers.push_back(obj);
+  } else if ((char *)obj >= scratch && (char *)obj < scratch + ScratchSize) {
+    scratch_finalizers.push_back(obj);
+  }
+}
+
+void Heap::write_barrier(Environment *env, Object *value) {
+  if (value != nullptr && !env->dirty && is_young(value)) {
+    env->dirty = true;
+    remembered_envs.push_back(env);
+  }
+}
+
+void Heap::write_barrier(ArrayObject *arr, Object *value) {
+  if (value != nullptr && !promoting && !arr->dirty && !is_young(arr) &&
+      is_young(value)) {
+    arr->dirty = true;
+    remembered_arrays.push_back(arr);
+  }
+}
+
+void Heap::safepoint() {
+  if (!collect_requested) {
+    return;
+  }
+  minor_collect();
+  if (old_bytes > major_threshold) {
+    major_collect();
+  }
+}
+
+void Heap::end_frame() {
+  if (frame_arena) {
+    collect_requested = true;
+  }
+}
+
+Object *Heap::copy_to_old(Object *obj) {
+  promoting = true;
+  Object *copy = nullptr;
+  switch (obj->type()) {
+  case IntType: {
+    copy = IntegerObject::make(((IntegerObject *)obj)->value);
+    break;
+  }
+  case FloatType: {
+    copy = new FloatObject(((FloatObject *)obj)->value);
+    break;
+  }
+  case StringType: {
+    copy = new StringObject(std::move(((StringObject *)obj)->value));
+    break;
+  }
+  case BoolType: {
+    copy = BoolObject::make(((BoolObject *)obj)->value);
+    break;
+  }
+  case ArrayType: {
+    copy = new ArrayObject(std::move(((ArrayObject *)obj)->elements));
+    break;
+  }
+  }
+  promoting = false;
+  return copy;
+}
+
+Object *Heap::evacuate(Object *obj) {
+  if (obj == nullptr || !is_young(obj)) {
+    return obj;
+  }
+  GcHeader *header = header_of(obj);
+  if (header->forwarded) {
+    return (Object *)(header->next + 1);
+  }
+  Object *copy = copy_to_old(obj);
+  header->forwarded = true;
+  header->next = header_of(copy);
+  promoted_objects++;
+  if (copy->type() == ArrayType) {
+    scan_list.push_back(copy);
+  }
+  return copy;
+}
+
+void Heap::minor_collect() {
+  for (auto env : remembered_envs) {
+    for (auto &entry : env->store) {
+      entry.second = evacuate(entry.second);
+    }
+    env->dirty = false;
+  }
+  for (auto arr : remembered_arrays) {
+    for (auto &elem : arr->elements) {
+      elem = evacuate(elem);
+    }
+    arr->dirty = false;
+  }
+  for (auto range : root_ranges) {
+    for (size_t i = 0; i < *range.size; i++) {
+      range.begin[i] = evacuate(range.begin[i]);
+    }
+  }
+  while (!scan_list.empty()) {
+    ArrayObject *arr = (ArrayObject *)scan_list.back();
+    scan_list.pop_back();
+    for (auto &elem : arr->elements) {
+      elem = evacuate(elem);
+    }
+  }
+  for (auto obj : finalizers) {
+    obj->~Object();
+  }
+  finalizers.clear();
+  remembered_envs.clear();
+  remembered_arrays.clear();
+  nursery_top = nursery;
+  collect_requested = false;
+  minor_collections++;
+}
+
+void Heap::mark(Object *obj) {
+  if (obj == nullptr || header_of(obj)->marked) {
+    return;
+  }
+  header_of(obj)->marked = true;
+  if (obj->type() == ArrayType) {
+    for (auto elem : ((ArrayObject *)obj)->elements) {
+      mark(elem);
+    }
+  }
+}
+
+// Expects an empty nursery, so it always runs right after minor_collect().
+void Heap::major_collect() {
+  for (auto env : roots) {
+    for (auto &entry : env->store) {
+      mark(entry.second);
+    }
+  }
+  for (auto range : root_ranges) {
+    for (size_t i = 0; i < *range.size; i++) {
+      mark(range.begin[i]);
+    }
+  }
+  GcHeader **link = &old_objects;
+  while (*link != nullptr) {
+    GcHeader *header = *link;
+    if (header->marked) {
+      header->marked = false;
+      link = &header->next;
+      continue;
+    }
+    *link = header->next;
+    ((Object *)(header + 1))->~Object();
+    free_old(header);
+  }
+  major_threshold = std::max(major_threshold, old_bytes * 2);
+  major_collections++;
+}
@@ -0,0 +1,127 @@
+#include "common.h"
+
+#ifndef gc_h
+#define gc_h
+
+class Object;
+class ArrayObject;
+class Environment;
+
+const int SizeClasses = 8;
+const size_t SlabSize = 64 << 10;
+const size_t ScratchSize = 64 << 10;
+
+// Every heap object is preceded by a header. In the nursery `next` holds the
+// forwarding address once the object has been promoted, in the old space it
+// links all old objects together for sweeping.
+class GcHeader {
+public:
+  uint32_t size;
+  bool marked;
+  bool forwarded;
+  GcHeader *next;
+};
+
+// Generational heap: objects are bump allocated in the nursery and survivors
+// are copied into the old space by a minor collection. Environments and old
+// ArrayObjects act as cards; storing a young object into one of them marks it
+// so a minor collection only scans what changed since the last one.
+//
+// Collections only happen at evaluate() statement boundaries while no C++
+// frame holds an object the collector can't see (no_gc_depth == 0). The live
+// objects are then the ones reachable from `roots` and `root_ranges`; ranges
+// have no write barrier and are scanned in full by every collection.
+//
+// In frame arena mode the nursery doubles as a per-frame arena for render
+// loops: end_drawing() schedules a collection at the next statement boundary,
+// so everything the frame allocated that was not stored into a variable is
+// released at once.
+//
+// The old space serves small objects from per size class free lists carved
+// out of slabs, so promotion and sweeping don't go through malloc. Pinned
+// objects (cached small integers and booleans) live outside both spaces and
+// are never collected.
+//
+// Values EscapeAnalysis found never leave their statement are allocated in
+// the scratch area instead, while a ScratchScope is alive. It is a stack:
+// evaluate() releases what its previous statement left there before the next
+// one runs. Scratch objects look pinned to the collector, which never sees
+// them anyway. When the area is full, allocation falls back to the nursery.
+class RootRange {
+public:
+  Object **begin;
+  size_t *size;
+};
+
+class Heap {
+public:
+  Heap(size_t nursery_size);
+  void *allocate(size_t size);
+  void *allocate_pinned(size_t size);
+  void release_scratch(size_t mark);
+  void release(void *ptr);
+  bool is_young(Object *obj);
+  void register_finalizer(Object *obj);
+  void write_barrier(Environment *env, Object *value);
+  void write_barrier(ArrayObject *arr, Object *value);
+  void safepoint();
+  void end_frame();
+  void minor_collect();
+  void major_collect();
+
+  int no_gc_depth = 0;
+  bool frame_arena = false;
+  bool scratch_allocating = false;
+  size_t scratch_top = 0;
+  std::vector<Environment *> roots;
+  std::vector<RootRange> root_ranges;
+
+  size_t allocations = 0;
+  size_t minor_collections = 0;
+  size_t major_collections = 0;
+  size_t promoted_objects = 0;
+  size_t scratch_allocations = 0;
+
+private:
+  void *allocate_old(size_t size);
+  void free_old(GcHeader *header);
+  Object *copy_to_old(Object *obj);
+  Object *evacuate(Object *obj);
+  void mark(Object *obj);
+
+  char *nursery;
+  char *nursery_top;
+  char *nursery_limit;
+  char *nursery_end;
+  char *scratch;
+  bool promoting = false;
+  bool collect_requested = false;
+  GcHeader *old_objects = nullptr;
+  GcHeader *free_lists[SizeClasses] = {};
+  char *slab_top = nullptr;
+  char *slab_end = nullptr;
+  size_t old_bytes = 0;
+  size_t major_threshold;
+  std::vector<Environment *> remembered_envs;
+  std::vector<ArrayObject *> remembered_arrays;
+  std::vector<Object *> finalizers;
+  std::vector<Object *> scratch_finalizers;
+  std::vector<Object *> scan_list;
+};
+
+extern Heap heap;
+
+// Sends the allocations made while it is alive to the scratch area when
+// `temporary` is set.
+class ScratchScope {
+public:
+  ScratchScope(bool temporary) : previous(heap.scratch_allocating) {
+    heap.scratch_allocating = temporary;
+  }
+  ~ScratchScope() { heap.scratch_allocating = previous; }
+
+private:
+  bool previous;
+};
+
+#endif // !gc_h
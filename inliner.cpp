@@ -0,0 +1,413 @@
+#include "inliner.h"
+#include "builtins.h"
+
+// Templates of up to InlineAlwaysSize nodes are inlined at every call,
+// larger ones only while the nodes they add stay within InlineGrowth.
+const int InlineAlwaysSize = 12;
+const int InlineGrowth = 256;
+const int InlineMaxSize = 48;
+
+static int node_size(Node *node) {
+  std::string type = node->statement_type();
+  int size = 1;
+  if (type == "BinaryExpression") {
+    size += node_size(((BinaryExpression *)node)->left);
+    size += node_size(((BinaryExpression *)node)->right);
+  } else if (type == "CallExpression") {
+    for (auto arg : ((CallExpression *)node)->args) {
+      size += node_size(arg);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      size += node_size(elem);
+    }
+  } else if (type == "MemberExpression") {
+    size += 1 + node_size(((MemberExpression *)node)->property);
+  }
+  return size;
+}
+
+// Counts the identifiers an expression reads and the functions it calls.
+// Returns false for anything that isn't an expression.
+static bool collect(Node *node, std::unordered_map<std::string, int> &uses,
+                    std::unordered_map<std::string, bool> &indexed,
+                    std::vector<std::string> &callees) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    return true;
+  } else if (type == "Identifier") {
+    uses[((Identifier *)node)->name]++;
+    return true;
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    return collect(bNode->left, uses, indexed, callees) &&
+           collect(bNode->right, uses, indexed, callees);
+  } else if (type == "CallExpression") {
+    CallExpression *callNode = (CallExpression *)node;
+    callees.push_back(callNode->callee.name);
+    for (auto arg : callNode->args) {
+      if (!collect(arg, uses, indexed, callees)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      if (!collect(elem, uses, indexed, callees)) {
+        return false;
+      }
+    }
+    return true;
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    std::string &name = ((Identifier *)memNode->object)->name;
+    uses[name]++;
+    indexed[name] = true;
+    return collect(memNode->property, uses, indexed, callees);
+  }
+  return false;
+}
+
+void Inliner::run(std::vector<Node *> &program) {
+  count_definitions(program, true);
+  for (auto node : program) {
+    if (node->statement_type() != "FunctionStatement") {
+      break;
+    }
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    std::string &name = funcNode->ident.name;
+    if (definitions[name] != 1 ||
+        BuiltinFunctions.find(name) != BuiltinFunctions.end()) {
+      continue;
+    }
+    InlineTemplate tmpl;
+    if (make_template(funcNode, tmpl)) {
+      templates[name] = tmpl;
+    }
+  }
+  if (templates.empty()) {
+    return;
+  }
+  for (auto node : program) {
+    count_sites(node);
+  }
+  inline_block(program);
+}
+
+// Function statements anywhere in the top-level code, nested blocks
+// included, define global functions.
+void Inliner::count_definitions(std::vector<Node *> &block, bool top_level) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "FunctionStatement") {
+      FunctionStatement *funcNode = (FunctionStatement *)node;
+      definitions[funcNode->ident.name]++;
+      if (top_level) {
+        top_level_definitions[funcNode->ident.name]++;
+      }
+      count_definitions(funcNode->block, false);
+    } else if (type == "IfStatement") {
+      count_definitions(((IfStatement *)node)->consequent, top_level);
+      count_definitions(((IfStatement *)node)->alternate, top_level);
+    } else if (type == "WhileStatement") {
+      count_definitions(((WhileStatement *)node)->block, top_level);
+    }
+  }
+}
+
+void Inliner::count_sites(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "CallExpression") {
+    CallExpression *callNode = (CallExpression *)node;
+    auto tmpl = templates.find(callNode->callee.name);
+    if (tmpl != templates.end()) {
+      tmpl->second.sites++;
+    }
+    for (auto arg : callNode->args) {
+      count_sites(arg);
+    }
+  } else if (type == "BinaryExpression") {
+    count_sites(((BinaryExpression *)node)->left);
+    count_sites(((BinaryExpression *)node)->right);
+  } else if (type == "ArrayExpression") {
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      count_sites(elem);
+    }
+  } else if (type == "MemberExpression") {
+    count_sites(((MemberExpression *)node)->property);
+  } else if (type == "LetStatement") {
+    count_sites(((LetStatement *)node)->value);
+  } else if (type == "AssignmentExpression") {
+    count_sites(((AssignmentExpression *)node)->value);
+  } else if (type == "ReturnStatement") {
+    count_sites(((ReturnStatement *)node)->value);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    count_sites(ifNode->condition);
+    for (auto child : ifNode->consequent) {
+      count_sites(child);
+    }
+    for (auto child : ifNode->alternate) {
+      count_sites(child);
+    }
+  } else if (type == "WhileStatement") {
+    count_sites(((WhileStatement *)node)->condition);
+    for (auto child : ((WhileStatement *)node)->block) {
+      count_sites(child);
+    }
+  } else if (type == "FunctionStatement") {
+    for (auto child : ((FunctionStatement *)node)->block) {
+      count_sites(child);
+    }
+  }
+}
+
+// Leading lets are substituted into the expressions after them, so each has
+// to be free of calls and read exactly once. What is left may only read the
+// parameters and call builtins or functions that are only ever defined
+// globally, which resolve the same from any caller.
+bool Inliner::make_template(FunctionStatement *funcNode,
+                            InlineTemplate &tmpl) {
+  std::vector<Node *> &body = funcNode->block;
+  for (auto param : funcNode->params) {
+    tmpl.params.push_back(param->name);
+  }
+  if (body.empty()) {
+    return false;
+  }
+  std::unordered_map<std::string, Node *> lets;
+  if (body.back()->statement_type() == "ReturnStatement") {
+    for (size_t i = 0; i + 1 < body.size(); i++) {
+      if (body[i]->statement_type() != "LetStatement") {
+        return false;
+      }
+    }
+    for (size_t i = 0; i + 1 < body.size(); i++) {
+      LetStatement *letNode = (LetStatement *)body[i];
+      std::unordered_map<std::string, int> uses;
+      std::unordered_map<std::string, bool> indexed;
+      std::vector<std::string> callees;
+      if (!collect(letNode->value, uses, indexed, callees) ||
+          !callees.empty()) {
+        return false;
+      }
+      uses.clear();
+      for (size_t j = i + 1; j + 1 < body.size(); j++) {
+        collect(((LetStatement *)body[j])->value, uses, indexed, callees);
+      }
+      collect(((ReturnStatement *)body.back())->value, uses, indexed,
+              callees);
+      std::string &name = letNode->ident.name;
+      if (uses[name] != 1 || indexed[name] || lets.count(name) ||
+          std::find(tmpl.params.begin(), tmpl.params.end(), name) !=
+              tmpl.params.end()) {
+        return false;
+      }
+      lets[name] = substitute(letNode->value, lets);
+    }
+    tmpl.expression = substitute(((ReturnStatement *)body.back())->value, lets);
+  } else {
+    for (auto node : body) {
+      if (node->statement_type() != "CallExpression") {
+        return false;
+      }
+      tmpl.statements.push_back(substitute(node, lets));
+    }
+  }
+
+  std::vector<std::string> callees;
+  std::vector<Node *> nodes = tmpl.statements;
+  if (tmpl.expression != nullptr) {
+    nodes.push_back(tmpl.expression);
+  }
+  for (auto node : nodes) {
+    if (!collect(node, tmpl.uses, tmpl.indexed, callees)) {
+      return false;
+    }
+    tmpl.size += node_size(node);
+  }
+  for (auto &[name, count] : tmpl.uses) {
+    if (std::find(tmpl.params.begin(), tmpl.params.end(), name) ==
+        tmpl.params.end()) {
+      return false;
+    }
+  }
+  for (auto &callee : callees) {
+    if (callee == funcNode->ident.name ||
+        (BuiltinFunctions.find(callee) == BuiltinFunctions.end() &&
+         definitions[callee] != top_level_definitions[callee])) {
+      return false;
+    }
+  }
+  return tmpl.size <= InlineMaxSize;
+}
+
+// Arguments have to be literals or identifiers. An identifier has to be
+// read by the body, otherwise reading an undefined one would no longer fail.
+InlineTemplate *Inliner::template_for(CallExpression *callNode) {
+  std::string &name = callNode->callee.name;
+  auto found = templates.find(name);
+  if (found == templates.end() ||
+      std::find(chain.begin(), chain.end(), name) != chain.end()) {
+    return nullptr;
+  }
+  InlineTemplate *tmpl = &found->second;
+  if (callNode->args.size() != tmpl->params.size()) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < callNode->args.size(); i++) {
+    std::string type = callNode->args[i]->statement_type();
+    std::string &param = tmpl->params[i];
+    if (type == "Identifier") {
+      if (tmpl->uses[param] == 0) {
+        return nullptr;
+      }
+    } else if (type != "Literal" || tmpl->indexed[param]) {
+      return nullptr;
+    }
+  }
+  if (tmpl->size > InlineAlwaysSize &&
+      tmpl->size * tmpl->sites > InlineGrowth) {
+    return nullptr;
+  }
+  return tmpl;
+}
+
+void Inliner::inline_block(std::vector<Node *> &block) {
+  for (size_t i = 0; i < block.size(); i++) {
+    Node *node = block[i];
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      LetStatement *letNode = (LetStatement *)node;
+      letNode->value = inline_expression(letNode->value);
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *assNode = (AssignmentExpression *)node;
+      assNode->value = inline_expression(assNode->value);
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      ifNode->condition = inline_expression(ifNode->condition);
+      inline_block(ifNode->consequent);
+      inline_block(ifNode->alternate);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      whileNode->condition = inline_expression(whileNode->condition);
+      inline_block(whileNode->block);
+    } else if (type == "ReturnStatement") {
+      ReturnStatement *retNode = (ReturnStatement *)node;
+      retNode->value = inline_expression(retNode->value);
+    } else if (type == "FunctionStatement") {
+      inline_block(((FunctionStatement *)node)->block);
+    } else if (type == "MemberExpression") {
+      MemberExpression *memNode = (MemberExpression *)node;
+      memNode->property = inline_expression(memNode->property);
+    } else if (type == "CallExpression") {
+      // A call statement is replaced by the body's call statements, or by
+      // the returned call whose value is dropped either way.
+      CallExpression *callNode = (CallExpression *)node;
+      for (auto &arg : callNode->args) {
+        arg = inline_expression(arg);
+      }
+      InlineTemplate *tmpl = template_for(callNode);
+      if (tmpl == nullptr) {
+        continue;
+      }
+      std::vector<Node *> statements = tmpl->statements;
+      if (tmpl->expression != nullptr) {
+        if (tmpl->expression->statement_type() != "CallExpression") {
+          continue;
+        }
+        statements.push_back(tmpl->expression);
+      }
+      std::unordered_map<std::string, Node *> args;
+      for (size_t j = 0; j < callNode->args.size(); j++) {
+        args[tmpl->params[j]] = callNode->args[j];
+      }
+      for (auto &statement : statements) {
+        statement = substitute(statement, args);
+      }
+      inlined++;
+      chain.push_back(callNode->callee.name);
+      inline_block(statements);
+      chain.pop_back();
+      block.erase(block.begin() + i);
+      block.insert(block.begin() + i, statements.begin(), statements.end());
+      i += statements.size() - 1;
+    }
+  }
+}
+
+// Returns the node to use in place of node.
+Node *Inliner::inline_expression(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    bNode->left = inline_expression(bNode->left);
+    bNode->right = inline_expression(bNode->right);
+  } else if (type == "ArrayExpression") {
+    for (auto &elem : ((ArrayExpression *)node)->elements) {
+      elem = inline_expression(elem);
+    }
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    memNode->property = inline_expression(memNode->property);
+  } else if (type == "CallExpression") {
+    CallExpression *callNode = (CallExpression *)node;
+    for (auto &arg : callNode->args) {
+      arg = inline_expression(arg);
+    }
+    InlineTemplate *tmpl = template_for(callNode);
+    if (tmpl == nullptr || tmpl->expression == nullptr) {
+      return node;
+    }
+    std::unordered_map<std::string, Node *> args;
+    for (size_t i = 0; i < callNode->args.size(); i++) {
+      args[tmpl->params[i]] = callNode->args[i];
+    }
+    inlined++;
+    chain.push_back(callNode->callee.name);
+    Node *body = inline_expression(substitute(tmpl->expression, args));
+    chain.pop_back();
+    return body;
+  }
+  return node;
+}
+
+// Copies an expression, or a call statement, replacing the identifiers in
+// args by their value.
+Node *Inliner::substitute(Node *node,
+                          std::unordered_map<std::string, Node *> &args) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    return new Literal(*(Literal *)node);
+  } else if (type == "Identifier") {
+    auto arg = args.find(((Identifier *)node)->name);
+    if (arg != args.end()) {
+      std::unordered_map<std::string, Node *> none;
+      return substitute(arg->second, none);
+    }
+    return new Identifier(*(Identifier *)node);
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *copy = new BinaryExpression(*(BinaryExpression *)node);
+    copy->left = substitute(copy->left, args);
+    copy->right = substitute(copy->right, args);
+    return copy;
+  } else if (type == "CallExpression") {
+    CallExpression *copy = new CallExpression(*(CallExpression *)node);
+    for (auto &arg : copy->args) {
+      arg = substitute(arg, args);
+    }
+    return copy;
+  } else if (type == "ArrayExpression") {
+    ArrayExpression *copy = new ArrayExpression(*(ArrayExpression *)node);
+    for (auto &elem : copy->elements) {
+      elem = substitute(elem, args);
+    }
+    return copy;
+  } else if (type == "MemberExpression") {
+    MemberExpression *copy = new MemberExpression(*(MemberExpression *)node);
+    copy->object = substitute(copy->object, args);
+    copy->property = substitute(copy->property, args);
+    return copy;
+  }
+  return node;
+}
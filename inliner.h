@@ -0,0 +1,47 @@
+#include "ast.h"
+#include "common.h"
+
+#ifndef inliner_h
+#define inliner_h
+
+// Inlined form of a small function: a call becomes `expression`, or as a
+// statement `statements`, with the parameters replaced by the arguments.
+class InlineTemplate {
+public:
+  std::vector<std::string> params;
+  Node *expression = nullptr;
+  std::vector<Node *> statements;
+  std::unordered_map<std::string, int> uses;
+  std::unordered_map<std::string, bool> indexed;
+  int size = 0;
+  int sites = 0;
+};
+
+// Replaces calls of small non-recursive functions by their bodies before
+// the program runs. Only functions whose body is a single return (after
+// lets that can be substituted forward) or a list of call statements are
+// inlined, and only when they are defined once, at the top of the program
+// before anything else runs. Their parameters are substituted by the
+// arguments, which have to be literals or identifiers so that nothing is
+// evaluated twice or out of order.
+class Inliner {
+public:
+  void run(std::vector<Node *> &program);
+  int inlined = 0;
+
+private:
+  void count_definitions(std::vector<Node *> &block, bool top_level);
+  void count_sites(Node *node);
+  bool make_template(FunctionStatement *funcNode, InlineTemplate &tmpl);
+  InlineTemplate *template_for(CallExpression *callNode);
+  void inline_block(std::vector<Node *> &block);
+  Node *inline_expression(Node *node);
+  Node *substitute(Node *node, std::unordered_map<std::string, Node *> &args);
+
+  std::unordered_map<std::string, int> definitions;
+  std::unordered_map<std::string, int> top_level_definitions;
+  std::unordered_map<std::string, InlineTemplate> templates;
+  std::vector<std::string> chain;
+};
+
+#endif // !inliner_h
@@ -0,0 +1,313 @@
+#include "jit.h"
+#include "builtins.h"
+#include "eval.h"
+#include "gc.h"
+
+// Register assignment of the generated code, all callee saved:
+//   rbx  vm->sp while in machine code, written back around calls into the VM
+//   r12  vm->stack
+//   r13  the frame's locals, stack + base
+//   r14  vm->globals
+//   r15  vm
+const Reg Sp = RBX;
+const Reg Stack = R12;
+const Reg Locals = R13;
+const Reg Globals = R14;
+const Reg Vm = R15;
+
+const void *JitCode::address(int pc) { return memory + offsets[pc]; }
+
+Jit::Jit(VM *vm) : vm(vm) { sp_offset = (char *)&vm->sp - (char *)vm; }
+
+void Jit::undefined(const std::string *name) {
+  throw EvalError("undefined identifier: " + *name);
+}
+
+void Jit::not_defined() { throw EvalError("variable not defined"); }
+
+void Jit::already_defined(const std::string *name) {
+  throw EvalError("variable already defined: " + *name);
+}
+
+void Jit::binary(VM *vm, int op) {
+  Object *right = vm->stack[--vm->sp];
+  vm->stack[vm->sp - 1] =
+      evaluate_operator(vm->stack[vm->sp - 1], right, (TokenType)op);
+}
+
+bool Jit::truthy(Object *value) { return value->is_truthy(); }
+
+void Jit::loop() {
+  if (heap.no_gc_depth == 0) {
+    heap.safepoint();
+  }
+}
+
+void Jit::call(VM *vm, int name, int argc) {
+  CompiledFunction *callee = vm->enter(name, argc, false);
+  if (heap.no_gc_depth == 0) {
+    heap.safepoint();
+  }
+  if (vm->native(callee)) {
+    vm->run_native(0);
+  } else {
+    vm->interpret(vm->frames.size() - 1);
+  }
+}
+
+void Jit::call_builtin(VM *vm, int index, int argc) {
+  vm->args.assign(vm->stack + vm->sp - argc, vm->stack + vm->sp);
+  vm->sp -= argc;
+  vm->stack[vm->sp++] = (*vm->builtins[index])(vm->args);
+}
+
+void Jit::ret(VM *vm) {
+  Object *ret = vm->stack[vm->sp - 1];
+  vm->sp = vm->frames.back().base;
+  vm->function_table.leave(vm->frames.size());
+  vm->frames.pop_back();
+  vm->stack[vm->sp++] = ret;
+}
+
+void Jit::array(VM *vm, int count) {
+  std::vector<Object *> elements(vm->stack + vm->sp - count,
+                                 vm->stack + vm->sp);
+  vm->sp -= count;
+  vm->stack[vm->sp++] = new ArrayObject(elements);
+}
+
+void Jit::index(VM *vm, Object *indexed) {
+  ArrayObject *value = (ArrayObject *)indexed;
+  Object *prop = vm->stack[vm->sp - 1];
+  if (value == nullptr) {
+    throw EvalError("object not defined");
+  }
+  if (prop->type() != IntType) {
+    throw EvalError("invalid property type");
+  }
+  int index = ((IntegerObject *)prop)->value;
+  if (index < 0 || index >= value->elements.size()) {
+    throw EvalError("index out of bounds");
+  }
+  vm->stack[vm->sp - 1] = value->elements[index];
+}
+
+void Jit::define_function(VM *vm, int name, int index) {
+  vm->function_table.define(name, index, vm->frames.size());
+}
+
+void Jit::store_sp(Assembler &as) { as.mov(Mem(Vm, sp_offset), Sp); }
+
+void Jit::load_sp(Assembler &as) { as.mov(Sp, Mem(Vm, sp_offset)); }
+
+// Calls helper(vm, a, b) with the VM's sp up to date.
+void Jit::call_vm(Assembler &as, void *helper, int a, int b) {
+  store_sp(as);
+  as.mov(RDI, Vm);
+  as.mov_imm32(RSI, a);
+  as.mov_imm32(RDX, b);
+  as.call(helper);
+  load_sp(as);
+}
+
+void Jit::emit_check(Assembler &as, Mem slot, bool must_be_set, void *helper,
+                     const std::string *name) {
+  Label ok;
+  as.cmp(slot, 0);
+  as.jcc(must_be_set ? CondNotEqual : CondEqual, ok);
+  as.mov_imm64(RDI, (uint64_t)name);
+  as.call(helper);
+  as.bind(ok);
+}
+
+void Jit::emit(Assembler &as, CompiledFunction *func, int pc,
+               std::vector<Label> &labels, Label &exit) {
+  int op = func->code[pc];
+  int a = opcode_operands(op) > 0 ? func->code[pc + 1] : 0;
+  int b = opcode_operands(op) > 1 ? func->code[pc + 2] : 0;
+  Mem top(Stack, Sp, 0);
+  Mem below(Stack, Sp, -8);
+  bool global = op == OpLoadGlobal || op == OpStoreGlobal ||
+                op == OpDefineGlobal || op == OpIndexGlobal;
+  Mem slot(global ? Globals : Locals, a * 8);
+  const std::string *name = global ? &vm->program->global_names[a]
+                                   : (a < func->local_names.size()
+                                          ? &func->local_names[a]
+                                          : nullptr);
+  switch (op) {
+  case OpConst: {
+    as.mov_imm64(RAX, (uint64_t)&vm->program->constants[a]);
+    as.mov(RAX, Mem(RAX));
+    as.mov(top, RAX);
+    as.inc(Sp);
+    break;
+  }
+  case OpNull: {
+    as.mov(top, 0);
+    as.inc(Sp);
+    break;
+  }
+  case OpLoadGlobal:
+  case OpLoadLocal: {
+    emit_check(as, slot, true, (void *)undefined, name);
+    as.mov(RAX, slot);
+    as.mov(top, RAX);
+    as.inc(Sp);
+    break;
+  }
+  case OpStoreGlobal:
+  case OpStoreLocal: {
+    emit_check(as, slot, true, (void *)not_defined, name);
+    as.dec(Sp);
+    as.mov(RAX, top);
+    as.mov(slot, RAX);
+    break;
+  }
+  case OpDefineGlobal:
+  case OpDefineLocal: {
+    emit_check(as, slot, false, (void *)already_defined, name);
+    as.dec(Sp);
+    as.mov(RAX, top);
+    as.mov(slot, RAX);
+    break;
+  }
+  case OpBinary: {
+    call_vm(as, (void *)binary, a, 0);
+    break;
+  }
+  case OpJump: {
+    as.jmp(labels[a]);
+    break;
+  }
+  case OpJumpIfFalse: {
+    // Int comparisons produce the pinned 0 and 1 and literals the pinned
+    // booleans, only other values need is_truthy.
+    Label next;
+    as.dec(Sp);
+    as.mov(RDI, top);
+    for (auto value : {(Object *)IntegerObject::make(0),
+                       (Object *)BoolObject::make(false)}) {
+      as.mov_imm64(RAX, (uint64_t)value);
+      as.cmp(RDI, RAX);
+      as.jcc(CondEqual, labels[a]);
+    }
+    for (auto value : {(Object *)IntegerObject::make(1),
+                       (Object *)BoolObject::make(true)}) {
+      as.mov_imm64(RAX, (uint64_t)value);
+      as.cmp(RDI, RAX);
+      as.jcc(CondEqual, next);
+    }
+    as.call((void *)truthy);
+    as.test8(RAX);
+    as.jcc(CondEqual, labels[a]);
+    as.bind(next);
+    break;
+  }
+  case OpLoop: {
+    // The collector only needs sp to see the stack.
+    store_sp(as);
+    as.call((void *)loop);
+    as.jmp(labels[a]);
+    break;
+  }
+  case OpCall: {
+    call_vm(as, (void *)call, a, b);
+    break;
+  }
+  case OpCallBuiltin: {
+    call_vm(as, (void *)call_builtin, a, b);
+    break;
+  }
+  case OpReturn: {
+    store_sp(as);
+    as.mov(RDI, Vm);
+    as.call((void *)ret);
+    as.mov_imm32(RAX, JitReturned);
+    as.jmp(exit);
+    break;
+  }
+  case OpArray: {
+    call_vm(as, (void *)array, a, 0);
+    break;
+  }
+  case OpIndexGlobal:
+  case OpIndexLocal: {
+    store_sp(as);
+    as.mov(RDI, Vm);
+    as.mov(RSI, slot);
+    as.call((void *)index);
+    break;
+  }
+  case OpPop: {
+    as.dec(Sp);
+    break;
+  }
+  case OpDefineFunction: {
+    call_vm(as, (void *)define_function, a, b);
+    break;
+  }
+  case OpHalt: {
+    store_sp(as);
+    as.mov_imm32(RAX, JitHalted);
+    as.jmp(exit);
+    break;
+  }
+  }
+}
+
+void Jit::compile(CompiledFunction *func) {
+  func->jit_failed = true;
+#ifdef __x86_64__
+  for (int pc = 0; pc < func->code.size();
+       pc += 1 + opcode_operands(func->code[pc])) {
+    if (func->code[pc] == OpTailCall) {
+      return;
+    }
+  }
+  Assembler as;
+  std::vector<Label> labels(func->code.size());
+  Label exit;
+  JitCode *jit_code = new JitCode();
+  jit_code->offsets.resize(func->code.size(), -1);
+
+  // entry(vm, address, base)
+  as.push(RBP);
+  as.mov(RBP, RSP);
+  for (auto reg : {Sp, Stack, Locals, Globals, Vm}) {
+    as.push(reg);
+  }
+  as.sub(RSP, 8);
+  as.mov(Vm, RDI);
+  as.mov_imm64(Stack, (uint64_t)vm->stack);
+  as.mov_imm64(Globals, (uint64_t)vm->globals.data());
+  as.lea(Locals, Mem(Stack, RDX, 0));
+  load_sp(as);
+  as.jmp(RSI);
+
+  for (int pc = 0; pc < func->code.size();
+       pc += 1 + opcode_operands(func->code[pc])) {
+    as.bind(labels[pc]);
+    jit_code->offsets[pc] = as.offset();
+    emit(as, func, pc, labels, exit);
+  }
+
+  as.bind(exit);
+  as.add(RSP, 8);
+  for (auto reg : {Vm, Globals, Locals, Stack, Sp}) {
+    as.pop(reg);
+  }
+  as.pop(RBP);
+  as.ret();
+
+  jit_code->size = as.code.size();
+  jit_code->memory = as.install();
+  if (jit_code->memory == nullptr) {
+    delete jit_code;
+    return;
+  }
+  jit_code->entry = (int (*)(VM *, const void *, size_t))jit_code->memory;
+  func->jit_code = jit_code;
+  func->jit_failed = false;
+  compiled++;
+#endif
+}
@@ -0,0 +1,68 @@
+#include "assembler.h"
+#include "bytecode.h"
+#include "common.h"
+#include "vm.h"
+
+#ifndef jit_h
+#define jit_h
+
+const int JitReturned = 0;
+const int JitHalted = 1;
+
+// Native frames nest on the C stack, calls deeper than this stay in the
+// interpreter.
+const int JitMaxNativeDepth = 10000;
+
+// Machine code for a CompiledFunction. entry runs the VM's top frame, whose
+// locals start at stack[base], from address until the function returns or
+// the program halts.
+class JitCode {
+public:
+  int (*entry)(VM *vm, const void *address, size_t base);
+  uint8_t *memory;
+  size_t size;
+  std::vector<int> offsets;
+
+  const void *address(int pc);
+};
+
+// Template JIT for the stack VM. Every instruction becomes a fixed x86-64
+// sequence working on the VM's stack in place, so the interpreter can hand
+// over a frame in the middle of a loop; everything beyond loads, stores and
+// branches calls back into the VM. Functions with tail calls stay in the
+// interpreter.
+class Jit {
+public:
+  Jit(VM *vm);
+  void compile(CompiledFunction *func);
+
+  int threshold = 1000;
+  size_t compiled = 0;
+
+private:
+  void emit(Assembler &as, CompiledFunction *func, int pc,
+            std::vector<Label> &labels, Label &exit);
+  void emit_check(Assembler &as, Mem slot, bool must_be_set, void *helper,
+                  const std::string *name);
+  void store_sp(Assembler &as);
+  void load_sp(Assembler &as);
+  void call_vm(Assembler &as, void *helper, int a, int b);
+
+  static void undefined(const std::string *name);
+  static void not_defined();
+  static void already_defined(const std::string *name);
+  static void binary(VM *vm, int op);
+  static bool truthy(Object *value);
+  static void loop();
+  static void call(VM *vm, int name, int argc);
+  static void call_builtin(VM *vm, int index, int argc);
+  static void ret(VM *vm);
+  static void array(VM *vm, int count);
+  static void index(VM *vm, Object *indexed);
+  static void define_function(VM *vm, int name, int index);
+
+  VM *vm;
+  int32_t sp_offset;
+};
+
+#endif // !jit_h
@@ -0,0 +1,275 @@
+#include "licm.h"
+
+void LoopHoister::run(std::vector<Node *> &program) {
+  hoist_body(program, {});
+  while (!functions.empty()) {
+    FunctionStatement *funcNode = functions.back();
+    functions.pop_back();
+    hoist_body(funcNode->block, funcNode->params);
+  }
+}
+
+void ArithmeticTypes::infer(std::vector<Node *> &body,
+                            std::vector<Identifier *> &params) {
+  definitions.clear();
+  types.clear();
+  collect_definitions(body);
+  for (auto &[name, values] : definitions) {
+    types[name] = HoistNone;
+  }
+  for (auto param : params) {
+    types[param->name] = HoistUnknown;
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &[name, values] : definitions) {
+      HoistType type = types[name];
+      for (auto value : values) {
+        HoistType value_type = type_of(value);
+        if (type == HoistNone || value_type == HoistUnknown) {
+          type = value_type;
+        } else if (value_type != HoistNone && value_type != type) {
+          type = HoistUnknown;
+        }
+      }
+      if (type != types[name]) {
+        types[name] = type;
+        changed = true;
+      }
+    }
+  }
+}
+
+void ArithmeticTypes::collect_definitions(std::vector<Node *> &block) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      LetStatement *letNode = (LetStatement *)node;
+      definitions[letNode->ident.name].push_back(letNode->value);
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *assNode = (AssignmentExpression *)node;
+      definitions[assNode->ident.name].push_back(assNode->value);
+    } else if (type == "IfStatement") {
+      collect_definitions(((IfStatement *)node)->consequent);
+      collect_definitions(((IfStatement *)node)->alternate);
+    } else if (type == "WhileStatement") {
+      collect_definitions(((WhileStatement *)node)->block);
+    }
+  }
+}
+
+void collect_assigned(std::vector<Node *> &block,
+                      std::unordered_set<std::string> &assigned) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      assigned.insert(((LetStatement *)node)->ident.name);
+    } else if (type == "AssignmentExpression") {
+      assigned.insert(((AssignmentExpression *)node)->ident.name);
+    } else if (type == "IfStatement") {
+      collect_assigned(((IfStatement *)node)->consequent, assigned);
+      collect_assigned(((IfStatement *)node)->alternate, assigned);
+    } else if (type == "WhileStatement") {
+      collect_assigned(((WhileStatement *)node)->block, assigned);
+    }
+  }
+}
+
+// The type of an expression that can't fail, HoistUnknown for the rest.
+// Int division needs a literal divisor other than 0 and -1.
+HoistType ArithmeticTypes::type_of(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    Literal *lit = (Literal *)node;
+    if (lit->data_type == FloatType) {
+      return HoistFloat;
+    }
+    if (lit->data_type != IntType) {
+      return HoistUnknown;
+    }
+    try {
+      std::stoi(lit->value);
+    } catch (std::exception &) {
+      return HoistUnknown;
+    }
+    return HoistInt;
+  } else if (type == "Identifier") {
+    auto found = types.find(((Identifier *)node)->name);
+    return found == types.end() ? HoistUnknown : found->second;
+  } else if (type != "BinaryExpression") {
+    return HoistUnknown;
+  }
+  BinaryExpression *bNode = (BinaryExpression *)node;
+  HoistType left = type_of(bNode->left);
+  HoistType right = type_of(bNode->right);
+  if (left == HoistUnknown || right == HoistUnknown) {
+    return HoistUnknown;
+  }
+  if (left == HoistNone || right == HoistNone) {
+    return HoistNone;
+  }
+  switch (bNode->op.type) {
+  case Div:
+  case Mod: {
+    if (left == HoistFloat || right == HoistFloat) {
+      return bNode->op.type == Mod ? HoistUnknown : HoistFloat;
+    }
+    if (bNode->right->statement_type() != "Literal") {
+      return HoistUnknown;
+    }
+    int divisor = std::stoi(((Literal *)bNode->right)->value);
+    return divisor == 0 || divisor == -1 ? HoistUnknown : HoistInt;
+  }
+  case Plus:
+  case Minus:
+  case Mul:
+  case And:
+  case Or:
+  case Lt:
+  case Lte:
+  case Gt:
+  case Gte:
+  case Equal:
+  case NotEqual: {
+    return left == HoistFloat || right == HoistFloat ? HoistFloat : HoistInt;
+  }
+  default: {
+    return HoistUnknown;
+  }
+  }
+}
+
+// A program or function body, which has its own variables. Function
+// statements found in it are left for run().
+void LoopHoister::hoist_body(std::vector<Node *> &body,
+                             std::vector<Identifier *> params) {
+  types.infer(body, params);
+  temps.clear();
+  temp_lets.clear();
+  hoist_block(body, {});
+  body.insert(body.begin(), temp_lets.begin(), temp_lets.end());
+}
+
+bool LoopHoister::invariant(Node *node,
+                            std::unordered_set<std::string> &defined,
+                            std::unordered_set<std::string> &assigned) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    return true;
+  } else if (type == "Identifier") {
+    std::string &name = ((Identifier *)node)->name;
+    return assigned.count(name) == 0 &&
+           (defined.count(name) > 0 || temps.count(name) > 0);
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    return invariant(bNode->left, defined, assigned) &&
+           invariant(bNode->right, defined, assigned);
+  }
+  return false;
+}
+
+// `defined` holds the variables certainly defined at this point: lets that
+// came before in this block or in the blocks around it.
+void LoopHoister::hoist_block(std::vector<Node *> &block,
+                              std::unordered_set<std::string> defined) {
+  for (size_t i = 0; i < block.size(); i++) {
+    Node *node = block[i];
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      defined.insert(((LetStatement *)node)->ident.name);
+    } else if (type == "IfStatement") {
+      hoist_block(((IfStatement *)node)->consequent, defined);
+      hoist_block(((IfStatement *)node)->alternate, defined);
+    } else if (type == "FunctionStatement") {
+      functions.push_back((FunctionStatement *)node);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      std::unordered_set<std::string> assigned;
+      collect_assigned(whileNode->block, assigned);
+      std::vector<Node *> preheader;
+      whileNode->condition =
+          hoist_expression(whileNode->condition, defined, assigned, preheader);
+      hoist_loop_block(whileNode->block, defined, assigned, preheader);
+      // Loops inside get their own preheaders for what only they keep
+      // invariant.
+      hoist_block(whileNode->block, defined);
+      block.insert(block.begin() + i, preheader.begin(), preheader.end());
+      i += preheader.size();
+    }
+  }
+}
+
+void LoopHoister::hoist_loop_block(std::vector<Node *> &block,
+                                   std::unordered_set<std::string> &defined,
+                                   std::unordered_set<std::string> &assigned,
+                                   std::vector<Node *> &preheader) {
+  for (auto node : block) {
+    std::string type = node->statement_type();
+    if (type == "LetStatement") {
+      LetStatement *letNode = (LetStatement *)node;
+      letNode->value =
+          hoist_expression(letNode->value, defined, assigned, preheader);
+    } else if (type == "AssignmentExpression") {
+      AssignmentExpression *assNode = (AssignmentExpression *)node;
+      assNode->value =
+          hoist_expression(assNode->value, defined, assigned, preheader);
+    } else if (type == "IfStatement") {
+      IfStatement *ifNode = (IfStatement *)node;
+      ifNode->condition =
+          hoist_expression(ifNode->condition, defined, assigned, preheader);
+      hoist_loop_block(ifNode->consequent, defined, assigned, preheader);
+      hoist_loop_block(ifNode->alternate, defined, assigned, preheader);
+    } else if (type == "WhileStatement") {
+      WhileStatement *whileNode = (WhileStatement *)node;
+      whileNode->condition =
+          hoist_expression(whileNode->condition, defined, assigned, preheader);
+      hoist_loop_block(whileNode->block, defined, assigned, preheader);
+    } else if (type == "ReturnStatement") {
+      ReturnStatement *retNode = (ReturnStatement *)node;
+      retNode->value =
+          hoist_expression(retNode->value, defined, assigned, preheader);
+    } else if (type == "CallExpression" || type == "MemberExpression") {
+      hoist_expression(node, defined, assigned, preheader);
+    }
+  }
+}
+
+// Returns the node to use in place of node: the largest invariant
+// expressions are replaced by a temporary assigned in the preheader.
+Node *LoopHoister::hoist_expression(Node *node,
+                                    std::unordered_set<std::string> &defined,
+                                    std::unordered_set<std::string> &assigned,
+                                    std::vector<Node *> &preheader) {
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    HoistType hoist_type = types.type_of(node);
+    if ((hoist_type == HoistInt || hoist_type == HoistFloat) &&
+        invariant(node, defined, assigned)) {
+      std::string name = "licm" + std::to_string(hoisted++);
+      Literal *zero = hoist_type == HoistInt ? new Literal("0", IntType)
+                                             : new Literal("0.0", FloatType);
+      temp_lets.push_back(new LetStatement(Identifier(name), zero));
+      temps.insert(name);
+      types.types[name] = hoist_type;
+      preheader.push_back(new AssignmentExpression(Identifier(name), node));
+      return new Identifier(name);
+    }
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    bNode->left = hoist_expression(bNode->left, defined, assigned, preheader);
+    bNode->right = hoist_expression(bNode->right, defined, assigned, preheader);
+  } else if (type == "CallExpression") {
+    for (auto &arg : ((CallExpression *)node)->args) {
+      arg = hoist_expression(arg, defined, assigned, preheader);
+    }
+  } else if (type == "ArrayExpression") {
+    for (auto &elem : ((ArrayExpression *)node)->elements) {
+      elem = hoist_expression(elem, defined, assigned, preheader);
+    }
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    memNode->property =
+        hoist_expression(memNode->property, defined, assigned, preheader);
+  }
+  return node;
+}
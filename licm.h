@@ -0,0 +1,69 @@
+#include "ast.h"
+#include "common.h"
+#include <unordered_set>
+
+#ifndef licm_h
+#define licm_h
+
+// What every value a variable is given in a body has in common: HoistNone
+// until one is known, HoistUnknown for anything but all ints or all floats.
+enum HoistType {
+  HoistNone,
+  HoistInt,
+  HoistFloat,
+  HoistUnknown,
+};
+
+// Infers which variables of a program or function body only ever hold ints,
+// or only floats, and so which arithmetic on them can't fail.
+class ArithmeticTypes {
+public:
+  void infer(std::vector<Node *> &body, std::vector<Identifier *> &params);
+  HoistType type_of(Node *node);
+  std::unordered_map<std::string, HoistType> types;
+
+private:
+  void collect_definitions(std::vector<Node *> &block);
+  std::unordered_map<std::string, std::vector<Node *>> definitions;
+};
+
+// Adds the variables a block lets or assigns, nested blocks included.
+void collect_assigned(std::vector<Node *> &block,
+                      std::unordered_set<std::string> &assigned);
+
+// Moves loop-invariant binary expressions out of while loops. An expression
+// qualifies when its variables are defined before the loop, not assigned in
+// it, and it can't fail: only int and float arithmetic on variables that are
+// only ever given ints, or only floats. Then evaluating it ahead of a loop
+// that doesn't run or a branch that isn't taken is unobservable. Calls are
+// never moved; they can't assign the loop's variables since functions only
+// see their own slots. Each moved expression is assigned to a temporary
+// right before the loop and the temporaries are declared at the top of the
+// body they are in.
+class LoopHoister {
+public:
+  void run(std::vector<Node *> &program);
+  int hoisted = 0;
+
+private:
+  void hoist_body(std::vector<Node *> &body,
+                  std::vector<Identifier *> params);
+  bool invariant(Node *node, std::unordered_set<std::string> &defined,
+                 std::unordered_set<std::string> &assigned);
+  void hoist_block(std::vector<Node *> &block,
+                   std::unordered_set<std::string> defined);
+  void hoist_loop_block(std::vector<Node *> &block,
+                        std::unordered_set<std::string> &defined,
+                        std::unordered_set<std::string> &assigned,
+                        std::vector<Node *> &preheader);
+  Node *hoist_expression(Node *node, std::unordered_set<std::string> &defined,
+                         std::unordered_set<std::string> &assigned,
+                         std::vector<Node *> &preheader);
+
+  ArithmeticTypes types;
+  std::unordered_set<std::string> temps;
+  std::vector<Node *> temp_lets;
+  std::vector<FunctionStatement *> functions;
+};
+
+#endif // !licm_h
@@ -1,29 +1,379 @@
 #include "parser.h"
 #include "ast.h"
+#include "closure.h"
+#include "compiler.h"
+#include "cse.h"
+#include "deadcode.h"
+#include "emitter.h"
+#include "escape.h"
 #include "eval.h"
+#include "fuse.h"
+#include "inliner.h"
+#include "jit.h"
+#include "licm.h"
+#include "trace.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "ssa.h"
+#include "ssalower.h"
+#include "ssapasses.h"
+#include "stackless.h"
+#include "vm.h"
+#include "wsc.h"
 #include "common.h"
 #include "utils.h"
 
+// Optimizations run on every parsed program, in order.
+static std::vector<std::function<void(std::vector<Node *> &)>> passes;
+
+static std::vector<Node *> parse_file(std::ifstream &file) {
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  std::string source = buffer.str();
+  Lexer lexer(source);
+  std::vector<Token> tokens = lexer.lex();
+  Parser *parser = new Parser(tokens);
+  std::vector<Node *> program = parser->parse(Eof);
+  for (auto &pass : passes) {
+    pass(program);
+  }
+  return program;
+}
+
 int main(int argc, char **argv) {
   srand(time(0));
-  if (argc == 1) {
-    std::cout << "Usage: whimsia <filename>" << std::endl;
+  std::string filepath;
+  std::vector<std::string> filepaths;
+  size_t time_slice = 1000;
+  std::string engine = "ast";
+  bool gc_stats = false;
+  bool dump_bytecode = false;
+  bool exec_stats = false;
+  bool compile_only = false;
+  bool emit_cpp = false;
+  bool use_jit = false;
+  bool use_trace_jit = false;
+  bool use_dead_code = false;
+  DeadCodeEliminator dead_code;
+  bool use_inline = false;
+  Inliner inliner;
+  bool use_licm = false;
+  LoopHoister hoister;
+  bool use_cse = false;
+  CseEliminator eliminator;
+  bool use_escape = false;
+  bool use_fuse = true;
+  NodeFuser fuser;
+  bool shape_stats = false;
+  EscapeAnalysis escape_analysis;
+  bool dump_ssa = false;
+  std::string ssa_passes = "sccp,dce";
+  SsaPassManager pass_manager;
+  int jit_threshold = 0;
+  size_t jit_compiled = 0;
+  std::string output;
+  size_t dispatches = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--frame-arena") {
+      heap.frame_arena = true;
+    } else if (arg == "--gc-stats") {
+      gc_stats = true;
+    } else if (arg.rfind("--engine=", 0) == 0) {
+      engine = arg.substr(9);
+    } else if (arg == "--dump-bytecode") {
+      dump_bytecode = true;
+    } else if (arg == "--dump-ssa") {
+      dump_ssa = true;
+    } else if (arg.rfind("--ssa-passes=", 0) == 0) {
+      ssa_passes = arg.substr(13);
+    } else if (arg == "--exec-stats") {
+      exec_stats = true;
+    } else if (arg == "--jit") {
+      use_jit = true;
+    } else if (arg == "--trace-jit") {
+      use_trace_jit = true;
+    } else if (arg == "--dead-code") {
+      use_dead_code = true;
+    } else if (arg == "--inline") {
+      use_inline = true;
+    } else if (arg == "--licm") {
+      use_licm = true;
+    } else if (arg == "--cse") {
+      use_cse = true;
+    } else if (arg == "--escape") {
+      use_escape = true;
+    } else if (arg == "--no-fuse") {
+      use_fuse = false;
+    } else if (arg == "--shape-stats") {
+      shape_stats = true;
+    } else if (arg.rfind("--jit-threshold=", 0) == 0) {
+      jit_threshold = std::stoi(arg.substr(16));
+    } else if (arg.rfind("--time-slice=", 0) == 0) {
+      time_slice = std::stoul(arg.substr(13));
+    } else if (arg == "--compile") {
+      compile_only = true;
+    } else if (arg == "--emit-cpp") {
+      emit_cpp = true;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      filepaths.push_back(arg);
+      filepath = filepaths.front();
+    }
+  }
+  if (filepath.empty() || (compile_only && output.empty()) ||
+      (engine != "ast" && engine != "closure" && engine != "stackless" &&
+       engine != "vm" && engine != "regvm" && engine != "ssa") ||
+      (filepaths.size() > 1 && engine != "stackless" && !shape_stats) ||
+      time_slice == 0) {
+    std::cout << "Usage: whimsia [--engine=ast|closure|vm|regvm|ssa] [--jit]\n"
+                 "               [--trace-jit] [--jit-threshold=N] "
+                 "[--dump-bytecode]\n"
+                 "               [--dump-ssa] [--ssa-passes=sccp,dce]\n"
+                 "               [--dead-code] [--inline] [--licm] [--cse] "
+                 "[--escape]\n"
+                 "               [--no-fuse] [--exec-stats] [--frame-arena] "
+                 "[--gc-stats]\n"
+                 "               <filename>\n"
+                 "       whimsia --engine=stackless [--time-slice=N] "
+                 "<filename>...\n"
+                 "       whimsia --shape-stats <filename>...\n"
+                 "       whimsia --compile <filename> -o <output.wsc>\n"
+                 "       whimsia --emit-cpp <filename> [-o <output.cpp>]"
+              << std::endl;
+    return 0;
+  }
+  if (use_jit) {
+    engine = "vm";
+  }
+  if (use_dead_code) {
+    passes.push_back([&](std::vector<Node *> &program) {
+      dead_code.run(program);
+    });
+  }
+  if (use_inline) {
+    passes.push_back([&](std::vector<Node *> &program) {
+      inliner.run(program);
+    });
+  }
+  if (use_licm) {
+    passes.push_back([&](std::vector<Node *> &program) {
+      hoister.run(program);
+    });
+  }
+  if (use_cse) {
+    passes.push_back([&](std::vector<Node *> &program) {
+      eliminator.run(program);
+    });
+  }
+  if (use_escape) {
+    passes.push_back([&](std::vector<Node *> &program) {
+      escape_analysis.run(program);
+    });
+  }
+  std::stringstream pass_names(ssa_passes);
+  std::string pass_name;
+  SccpPass sccp;
+  DcePass dce;
+  while (std::getline(pass_names, pass_name, ',')) {
+    if (pass_name == "sccp") {
+      pass_manager.add(pass_name, [&](SsaFunction *function) {
+        return sccp.run(function);
+      });
+    } else if (pass_name == "dce") {
+      pass_manager.add(pass_name, [&](SsaFunction *function) {
+        return dce.run(function);
+      });
+    } else {
+      std::cout << "Unknown SSA pass " << pass_name << std::endl;
+      return 0;
+    }
+  }
+  if (shape_stats) {
+    ShapeCounter counter;
+    for (auto &path : filepaths) {
+      std::ifstream script(path);
+      if (!script.is_open()) {
+        std::cout << "Unable to open file" << std::endl;
+        return 0;
+      }
+      std::vector<Node *> program = parse_file(script);
+      counter.count(program);
+    }
+    std::cout << counter.report();
     return 0;
   }
-  std::string filepath = argv[1];
+  bool precompiled = filepath.size() > 4 &&
+                     filepath.compare(filepath.size() - 4, 4, ".wsc") == 0;
   std::ifstream file(filepath);
-  if (file.is_open()) {
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string source = buffer.str();
-    Lexer lexer(source);
-    std::vector<Token> tokens = lexer.lex();
-    Parser *parser = new Parser(tokens);
-    std::vector<Node *> program = parser->parse(Eof);
-    Environment *global_env = new Environment();
-    evaluate(program, global_env);
+  if (precompiled) {
+    // Compiled programs always run on the stack VM.
+    engine = "vm";
+    CompiledProgram *compiled = read_wsc(filepath);
+    if (dump_bytecode) {
+      std::cout << compiled->disassemble();
+      return 0;
+    }
+    VM vm(compiled);
+    Jit jit(&vm);
+    if (use_jit) {
+      vm.jit = &jit;
+      if (jit_threshold > 0) {
+        jit.threshold = jit_threshold;
+      }
+    }
+    vm.run();
+    dispatches = vm.dispatches;
+    jit_compiled = jit.compiled;
+  } else if (file.is_open()) {
+    std::vector<Node *> program = parse_file(file);
+    if (emit_cpp) {
+      CppEmitter emitter;
+      std::string code = emitter.emit(program, filepath);
+      if (output.empty()) {
+        std::cout << code;
+      } else {
+        std::ofstream out(output);
+        if (!out.is_open()) {
+          std::cout << "Unable to write " << output << std::endl;
+          return 1;
+        }
+        out << code;
+      }
+      return 0;
+    }
+    if (engine == "regvm" || engine == "ssa") {
+      RegProgram *compiled;
+      if (engine == "ssa") {
+        SsaBuilder builder;
+        SsaProgram *ssa = builder.build(program);
+        pass_manager.run(ssa);
+        if (dump_ssa) {
+          std::cout << ssa->print();
+          return 0;
+        }
+        SsaLowering lowering;
+        compiled = lowering.lower(ssa);
+      } else {
+        RegCompiler compiler;
+        compiled = compiler.compile(program);
+      }
+      if (dump_bytecode) {
+        std::cout << compiled->disassemble();
+        return 0;
+      }
+      RegVM vm(compiled);
+      vm.run();
+      dispatches = vm.dispatches;
+    } else if (engine == "stackless" && !dump_bytecode && !compile_only) {
+      // The scripts take turns, each running time_slice statements at once.
+      std::vector<StacklessEvaluator *> scripts;
+      scripts.push_back(new StacklessEvaluator(program));
+      for (size_t i = 1; i < filepaths.size(); i++) {
+        std::ifstream other(filepaths[i]);
+        if (!other.is_open()) {
+          std::cout << "Unable to open file" << std::endl;
+          return 0;
+        }
+        std::vector<Node *> other_program = parse_file(other);
+        scripts.push_back(new StacklessEvaluator(other_program));
+      }
+      while (!scripts.empty()) {
+        for (size_t i = 0; i < scripts.size();) {
+          if (scripts[i]->run(time_slice)) {
+            delete scripts[i];
+            scripts.erase(scripts.begin() + i);
+          } else {
+            i++;
+          }
+        }
+      }
+      dispatches = eval_steps;
+    } else if (engine == "closure" && !dump_bytecode && !compile_only) {
+      call_stack.register_roots();
+      ClosureCompiler compiler;
+      ClosureFunction *compiled = compiler.compile(program);
+      call_closure(compiled, call_stack.push(compiled->num_slots));
+      dispatches = eval_steps;
+    } else if (engine == "vm" || dump_bytecode || compile_only) {
+      Compiler compiler;
+      CompiledProgram *compiled = compiler.compile(program);
+      if (compile_only) {
+        write_wsc(compiled, output);
+        return 0;
+      }
+      if (dump_bytecode) {
+        std::cout << compiled->disassemble();
+        return 0;
+      }
+      VM vm(compiled);
+      Jit jit(&vm);
+      if (use_jit) {
+        vm.jit = &jit;
+        if (jit_threshold > 0) {
+          jit.threshold = jit_threshold;
+        }
+      }
+      vm.run();
+      dispatches = vm.dispatches;
+      jit_compiled = jit.compiled;
+    } else {
+      TraceJit tracer;
+      if (use_trace_jit) {
+        trace_jit = &tracer;
+        if (jit_threshold > 0) {
+          tracer.threshold = jit_threshold;
+        }
+      }
+      Environment *global_env = new Environment();
+      heap.roots.push_back(global_env);
+      call_stack.register_roots();
+      if (use_fuse) {
+        fuser.run(program);
+      }
+      evaluate(program, global_env);
+      dispatches = eval_steps;
+      jit_compiled = tracer.compiled_paths;
+    }
   } else {
     std::cout << "Unable to open file" << std::endl;
   }
+  if (exec_stats) {
+    std::cerr << "engine: " << engine << ", dispatches: " << dispatches;
+    if (use_jit || use_trace_jit) {
+      std::cerr << ", jit compiled: " << jit_compiled;
+    }
+    if (engine == "ast" && use_fuse) {
+      std::cerr << ", fused nodes: " << fuser.fused;
+    }
+    if (use_dead_code) {
+      std::cerr << ", ast nodes: " << dead_code.nodes_before << " -> "
+                << dead_code.nodes_after;
+    }
+    if (use_inline) {
+      std::cerr << ", inlined calls: " << inliner.inlined;
+    }
+    if (use_licm) {
+      std::cerr << ", hoisted expressions: " << hoister.hoisted;
+    }
+    if (use_cse) {
+      std::cerr << ", eliminated expressions: " << eliminator.eliminated;
+    }
+    if (use_escape) {
+      std::cerr << ", temporaries: " << escape_analysis.temporaries;
+    }
+    if (engine == "ssa") {
+      std::cerr << ", ssa passes: " << pass_manager.stats();
+    }
+    std::cerr << "\n";
+  }
+  if (gc_stats) {
+    std::cerr << "allocations: " << heap.allocations
+              << ", minor collections: " << heap.minor_collections
+              << ", major collections: " << heap.major_collections
+              << ", promoted: " << heap.promoted_objects
+              << ", scratch allocations: " << heap.scratch_allocations << "\n";
+  }
   return 0;
 }
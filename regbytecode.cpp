@@ -0,0 +1,33 @@
+#include "regbytecode.h"
+
+const char *RegOpCodeNames[] = {
+    "MOVE",       "NULL",      "BINARY",       "INDEX",
+    "ARRAY",      "JUMP",      "JUMP_IF_FALSE", "LOOP",
+    "CALL",       "TAIL_CALL", "CALL_BUILTIN", "RETURN",
+    "DEFINE_FUNCTION", "GUARD", "HALT",
+};
+
+std::string RegProgram::disassemble() {
+  std::stringstream out;
+  for (int i = 0; i < constants.size(); i++) {
+    out << "const " << i << ": " << constants[i]->inspect() << "\n";
+  }
+  for (auto func : functions) {
+    out << "function " << func->name << " (params " << func->num_params
+        << ", vars " << func->num_vars << ", registers " << func->frame_size
+        << ")\n";
+    for (int pc = 0; pc < func->code.size(); pc++) {
+      RegInstr &instr = func->code[pc];
+      out << "  " << pc << "\t" << RegOpCodeNames[instr.op] << " " << instr.a
+          << " " << instr.b << " " << instr.c;
+      if (instr.op == RegBinary) {
+        out << " op " << instr.token;
+      }
+      if (instr.check != CheckNone) {
+        out << (instr.check == CheckUndefined ? " let" : " assign");
+      }
+      out << "\n";
+    }
+  }
+  return out.str();
+}
@@ -0,0 +1,75 @@
+#include "ast.h"
+#include "common.h"
+
+#ifndef regbytecode_h
+#define regbytecode_h
+
+// Three-address instructions for the register VM. R(x) is a register of the
+// current frame, RK(x) is a register when x >= 0 and the constant -1 - x
+// otherwise.
+enum RegOpCode {
+  RegMove,           // R(a) = RK(b)
+  RegNull,           // R(a) = null
+  RegBinary,         // R(a) = RK(b) token RK(c)
+  RegIndex,          // R(a) = R(b)[RK(c)]
+  RegArray,          // R(a) = [R(b) .. R(b + c - 1)]
+  RegJump,           // pc = b
+  RegJumpIfFalse,    // if !RK(b) then pc = c
+  RegLoop,           // pc = b, GC safepoint
+  RegCall,           // R(a) = function b(R(a) .. R(a + c - 1))
+  RegTailCall,       // return function b(R(a) .. R(a + c - 1))
+  RegCallBuiltin,    // R(a) = builtin b(R(a) .. R(a + c - 1))
+  RegReturn,         // return RK(b)
+  RegDefineFunction, // functions[b] = c
+  RegGuard,          // throw unless RK(a) passes check c for variable b
+  RegHalt,
+  RegOpCount,
+};
+
+// Checks on the old value of R(a) before an instruction writes it, used by
+// let and assignment statements. RegGuard also makes the check of a
+// variable read on its own.
+enum RegCheck {
+  CheckNone,
+  CheckUndefined,  // "variable already defined"
+  CheckDefined,    // "variable not defined"
+  CheckIdentifier, // "undefined identifier"
+};
+
+extern const char *RegOpCodeNames[];
+
+class RegInstr {
+public:
+  uint8_t op;
+  uint8_t check = CheckNone;
+  uint16_t token = 0;
+  int a = 0;
+  int b = 0;
+  int c = 0;
+  const void *handler = nullptr; // set by a threaded RegVM, see dispatch.h
+};
+
+// Registers [0, num_vars) hold the variables, parameters first, the
+// temporaries are allocated above them.
+class RegFunction {
+public:
+  std::string name;
+  int num_params = 0;
+  int num_vars = 0;
+  int frame_size = 0;
+  std::vector<RegInstr> code;
+  std::vector<std::string> var_names;
+};
+
+// functions[0] is the top-level code, whose variables are the globals.
+class RegProgram {
+public:
+  std::vector<Object *> constants;
+  std::vector<std::string> function_names;
+  std::vector<std::string> builtin_names;
+  std::vector<RegFunction *> functions;
+
+  std::string disassemble();
+};
+
+#endif // !regbytecode_h
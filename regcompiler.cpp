@@ -0,0 +1,310 @@
+#include "regcompiler.h"
+#include "builtins.h"
+#include "eval.h"
+#include "utils.h"
+
+RegProgram *RegCompiler::compile(std::vector<Node *> &nodes) {
+  program = new RegProgram();
+  current = new RegFunction();
+  current->name = "<main>";
+  program->functions.push_back(current);
+  collect_vars(nodes);
+  free_reg = current->frame_size = current->num_vars;
+  block_exits.push_back({});
+  compile_block(nodes);
+  emit(RegHalt, 0, 0, 0);
+  block_exits.pop_back();
+  return program;
+}
+
+void RegCompiler::compile_function(FunctionStatement *funcNode) {
+  RegFunction *outer = current;
+  std::unordered_map<std::string, int> outer_vars = vars;
+  std::vector<std::vector<int>> outer_exits = block_exits;
+  int outer_free = free_reg;
+
+  current = new RegFunction();
+  current->name = funcNode->ident.name;
+  current->num_params = funcNode->params.size();
+  int index = program->functions.size();
+  program->functions.push_back(current);
+  vars.clear();
+  for (auto param : funcNode->params) {
+    vars[param->name] = current->var_names.size();
+    current->var_names.push_back(param->name);
+  }
+  current->num_vars = current->var_names.size();
+  collect_vars(funcNode->block);
+  free_reg = current->frame_size = current->num_vars;
+  block_exits = {{}};
+  compile_block(funcNode->block);
+  int ret = alloc_temp();
+  emit(RegNull, ret, 0, 0);
+  emit(RegReturn, 0, ret, 0);
+
+  current = outer;
+  vars = outer_vars;
+  block_exits = outer_exits;
+  free_reg = outer_free;
+  emit(RegDefineFunction, 0, function_name(funcNode->ident.name), index);
+}
+
+// Gives every variable of the current function its register before any
+// temporary is allocated. Nested function statements have their own frame.
+void RegCompiler::collect_vars(std::vector<Node *> &block) {
+  for (auto node : block) {
+    collect_vars(node);
+  }
+}
+
+void RegCompiler::collect_vars(Node *node) {
+  if (node == nullptr) {
+    return;
+  }
+  std::string type = node->statement_type();
+  if (type == "Identifier") {
+    var(((Identifier *)node)->name);
+  } else if (type == "LetStatement") {
+    var(((LetStatement *)node)->ident.name);
+    collect_vars(((LetStatement *)node)->value);
+  } else if (type == "AssignmentExpression") {
+    var(((AssignmentExpression *)node)->ident.name);
+    collect_vars(((AssignmentExpression *)node)->value);
+  } else if (type == "BinaryExpression") {
+    collect_vars(((BinaryExpression *)node)->left);
+    collect_vars(((BinaryExpression *)node)->right);
+  } else if (type == "CallExpression") {
+    collect_vars(((CallExpression *)node)->args);
+  } else if (type == "MemberExpression") {
+    collect_vars(((MemberExpression *)node)->object);
+    collect_vars(((MemberExpression *)node)->property);
+  } else if (type == "ArrayExpression") {
+    collect_vars(((ArrayExpression *)node)->elements);
+  } else if (type == "IfStatement") {
+    collect_vars(((IfStatement *)node)->condition);
+    collect_vars(((IfStatement *)node)->consequent);
+    collect_vars(((IfStatement *)node)->alternate);
+  } else if (type == "WhileStatement") {
+    collect_vars(((WhileStatement *)node)->condition);
+    collect_vars(((WhileStatement *)node)->block);
+  } else if (type == "ReturnStatement") {
+    collect_vars(((ReturnStatement *)node)->value);
+  }
+}
+
+void RegCompiler::compile_block(std::vector<Node *> &block) {
+  for (auto node : block) {
+    if (node != nullptr) {
+      compile_statement(node);
+    }
+  }
+}
+
+void RegCompiler::compile_statement(Node *node) {
+  std::string type = node->statement_type();
+  bool in_function = current != program->functions[0];
+  int statement_free = free_reg;
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    int at = compile_to(letNode->value, var(letNode->ident.name));
+    current->code[at].check = CheckUndefined;
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    int at = compile_to(assNode->value, var(assNode->ident.name));
+    current->code[at].check = CheckDefined;
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    int else_jump = emit(RegJumpIfFalse, 0, compile_rk(ifNode->condition), 0);
+    free_reg = statement_free;
+    block_exits.push_back({});
+    compile_block(ifNode->consequent);
+    int end_jump = emit(RegJump, 0, 0, 0);
+    current->code[else_jump].c = current->code.size();
+    compile_block(ifNode->alternate);
+    current->code[end_jump].b = current->code.size();
+    for (auto exit : block_exits.back()) {
+      current->code[exit].b = current->code.size();
+    }
+    block_exits.pop_back();
+  } else if (type == "WhileStatement") {
+    WhileStatement *whileNode = (WhileStatement *)node;
+    int start = current->code.size();
+    int end_jump =
+        emit(RegJumpIfFalse, 0, compile_rk(whileNode->condition), 0);
+    free_reg = statement_free;
+    block_exits.push_back({});
+    compile_block(whileNode->block);
+    emit(RegLoop, 0, start, 0);
+    current->code[end_jump].c = current->code.size();
+    for (auto exit : block_exits.back()) {
+      current->code[exit].b = start;
+    }
+    block_exits.pop_back();
+  } else if (type == "FunctionStatement") {
+    compile_function((FunctionStatement *)node);
+  } else if (type == "CallExpression") {
+    compile_call((CallExpression *)node, -1, false);
+  } else if (type == "ReturnStatement") {
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    if (!in_function) {
+      compile_rk(retNode->value);
+      emit(RegHalt, 0, 0, 0);
+    } else if (retNode->value->statement_type() == "CallExpression") {
+      compile_call((CallExpression *)retNode->value, -1, true);
+    } else {
+      emit(RegReturn, 0, compile_rk(retNode->value), 0);
+    }
+  } else if (type == "MemberExpression") {
+    // A bare index statement ends the block it is in, like in evaluate().
+    int value = compile_rk(node);
+    if (block_exits.size() > 1) {
+      block_exits.back().push_back(emit(RegJump, 0, 0, 0));
+    } else if (in_function) {
+      emit(RegReturn, 0, value, 0);
+    } else {
+      emit(RegHalt, 0, 0, 0);
+    }
+  }
+  free_reg = statement_free;
+}
+
+// Returns an RK operand holding the value of node. Literals and variables
+// are used in place, anything else goes through a new temporary.
+int RegCompiler::compile_rk(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    return -1 - add_constant((Literal *)node);
+  } else if (type == "Identifier") {
+    return var(((Identifier *)node)->name);
+  }
+  int temp = alloc_temp();
+  compile_to(node, temp);
+  return temp;
+}
+
+// Writes the value of node into register target and returns the index of
+// the instruction that does the write.
+int RegCompiler::compile_to(Node *node, int target) {
+  std::string type = node->statement_type();
+  int expression_free = free_reg;
+  int at;
+  if (type == "Literal") {
+    at = emit(RegMove, target, -1 - add_constant((Literal *)node), 0);
+  } else if (type == "Identifier") {
+    at = emit(RegMove, target, var(((Identifier *)node)->name), 0);
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    int left = compile_rk(bNode->left);
+    int right = compile_rk(bNode->right);
+    at = emit(RegBinary, target, left, right);
+    current->code[at].token = bNode->op.type;
+  } else if (type == "CallExpression") {
+    at = compile_call((CallExpression *)node, target, false);
+  } else if (type == "ArrayExpression") {
+    ArrayExpression *arrNode = (ArrayExpression *)node;
+    int base = free_reg;
+    for (auto elem : arrNode->elements) {
+      int reg = alloc_temp();
+      int elem_free = free_reg;
+      compile_to(elem, reg);
+      free_reg = elem_free;
+    }
+    at = emit(RegArray, target, base, arrNode->elements.size());
+  } else if (type == "MemberExpression") {
+    MemberExpression *memNode = (MemberExpression *)node;
+    int property = compile_rk(memNode->property);
+    at = emit(RegIndex, target,
+              var(((Identifier *)memNode->object)->name), property);
+  } else {
+    throw EvalError("invalid initialization value " + type);
+  }
+  free_reg = expression_free;
+  return at;
+}
+
+// Arguments go into consecutive registers and the callee's frame starts at
+// the first of them, which also receives the result. When target is the
+// temporary allocated last the call is placed on it to save a move.
+int RegCompiler::compile_call(CallExpression *callNode, int target,
+                              bool tail) {
+  int call_free = free_reg;
+  if (target >= current->num_vars && target == free_reg - 1) {
+    free_reg = target;
+  }
+  int base = free_reg;
+  for (auto arg : callNode->args) {
+    int reg = alloc_temp();
+    int arg_free = free_reg;
+    compile_to(arg, reg);
+    free_reg = arg_free;
+  }
+  int argc = callNode->args.size();
+  if (argc == 0) {
+    alloc_temp();
+  }
+  int at;
+  if (BuiltinFunctions.find(callNode->callee.name) != BuiltinFunctions.end()) {
+    at = emit(RegCallBuiltin, base, builtin(callNode->callee.name), argc);
+    if (tail) {
+      emit(RegReturn, 0, base, 0);
+    }
+  } else {
+    at = emit(tail ? RegTailCall : RegCall, base,
+              function_name(callNode->callee.name), argc);
+  }
+  free_reg = call_free;
+  if (target >= 0 && target != base) {
+    at = emit(RegMove, target, base, 0);
+  }
+  return at;
+}
+
+int RegCompiler::emit(int op, int a, int b, int c) {
+  RegInstr instr;
+  instr.op = op;
+  instr.a = a;
+  instr.b = b;
+  instr.c = c;
+  current->code.push_back(instr);
+  return current->code.size() - 1;
+}
+
+int RegCompiler::alloc_temp() {
+  int reg = free_reg++;
+  current->frame_size = std::max(current->frame_size, free_reg);
+  return reg;
+}
+
+int RegCompiler::var(std::string &name) {
+  if (vars.find(name) == vars.end()) {
+    vars[name] = current->var_names.size();
+    current->var_names.push_back(name);
+    current->num_vars = current->var_names.size();
+  }
+  return vars[name];
+}
+
+int RegCompiler::add_constant(Literal *literal) {
+  std::string key = std::to_string(literal->data_type) + ":" + literal->value;
+  if (constants.find(key) == constants.end()) {
+    constants[key] = program->constants.size();
+    program->constants.push_back(get_obj_from_literal(literal));
+  }
+  return constants[key];
+}
+
+int RegCompiler::function_name(std::string &name) {
+  if (functions.find(name) == functions.end()) {
+    functions[name] = program->function_names.size();
+    program->function_names.push_back(name);
+  }
+  return functions[name];
+}
+
+int RegCompiler::builtin(std::string &name) {
+  if (builtins.find(name) == builtins.end()) {
+    builtins[name] = program->builtin_names.size();
+    program->builtin_names.push_back(name);
+  }
+  return builtins[name];
+}
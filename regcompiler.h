@@ -0,0 +1,43 @@
+#include "ast.h"
+#include "common.h"
+#include "regbytecode.h"
+
+#ifndef regcompiler_h
+#define regcompiler_h
+
+// Compiles the Parser output into a RegProgram for the register VM. Every
+// variable of a function gets a fixed register, temporaries are allocated
+// above them in stack order and the result of an expression is written
+// straight into its destination, so `x = x + y` is a single instruction.
+class RegCompiler {
+public:
+  RegProgram *compile(std::vector<Node *> &program);
+
+private:
+  void compile_function(FunctionStatement *funcNode);
+  void collect_vars(std::vector<Node *> &block);
+  void collect_vars(Node *node);
+  void compile_block(std::vector<Node *> &block);
+  void compile_statement(Node *node);
+  int compile_rk(Node *node);
+  int compile_to(Node *node, int target);
+  int compile_call(CallExpression *callNode, int target, bool tail);
+
+  int emit(int op, int a, int b, int c);
+  int alloc_temp();
+  int var(std::string &name);
+  int add_constant(Literal *literal);
+  int function_name(std::string &name);
+  int builtin(std::string &name);
+
+  RegProgram *program;
+  RegFunction *current;
+  std::unordered_map<std::string, int> vars;
+  std::unordered_map<std::string, int> functions;
+  std::unordered_map<std::string, int> builtins;
+  std::unordered_map<std::string, int> constants;
+  std::vector<std::vector<int>> block_exits;
+  int free_reg = 0;
+};
+
+#endif // !regcompiler_h
@@ -0,0 +1,235 @@
+#include "regvm.h"
+#include "dispatch.h"
+#include "builtins.h"
+#include "eval.h"
+#include "gc.h"
+
+RegVM::RegVM(RegProgram *program) : program(program) {
+  capacity = 1 << 20;
+  registers = new Object *[capacity];
+  num_constants = program->constants.size();
+  function_table.resize(program->function_names.size());
+  for (auto &name : program->builtin_names) {
+    builtins.push_back(&BuiltinFunctions.at(name));
+  }
+  heap.root_ranges.push_back(RootRange{program->constants.data(), &num_constants});
+  heap.root_ranges.push_back(RootRange{registers, &top});
+}
+
+// Temporaries may hold the null returned by a function without a return
+// statement, only variables are checked.
+Object *RegVM::read(int operand) {
+  if (operand < 0) {
+    return program->constants[-1 - operand];
+  }
+  Object *value = regs[operand];
+  if (value == nullptr && operand < func->num_vars) {
+    throw EvalError("undefined identifier: " + func->var_names[operand]);
+  }
+  return value;
+}
+
+void RegVM::check(RegInstr &instr) {
+  if (instr.check == CheckUndefined && regs[instr.a] != nullptr) {
+    throw EvalError("variable already defined: " + func->var_names[instr.a]);
+  }
+  if (instr.check == CheckDefined && regs[instr.a] == nullptr) {
+    throw EvalError("variable not defined");
+  }
+}
+
+// Sets up the frame of callee at base, whose first argc registers already
+// hold the arguments.
+void RegVM::enter(RegFunction *callee, size_t base, int argc) {
+  if (base + callee->frame_size > capacity) {
+    throw EvalError("stack overflow");
+  }
+  std::fill(registers + base + argc, registers + base + callee->frame_size,
+            nullptr);
+  func = callee;
+  regs = registers + base;
+  top = base + callee->frame_size;
+}
+
+// Points every instruction at its handler. Instructions with a let or
+// assignment check go through check_handler first.
+void RegVM::thread(const void **handlers, const void *check_handler) {
+  for (auto func : program->functions) {
+    for (auto &instr : func->code) {
+      instr.handler =
+          instr.check != CheckNone ? check_handler : handlers[instr.op];
+    }
+  }
+}
+
+#ifdef WHIMSIA_THREADED
+#define DISPATCH()                                                             \
+  dispatches++;                                                                \
+  instr = &code[pc++];                                                         \
+  goto *instr->handler
+#else
+#define DISPATCH()                                                             \
+  dispatches++;                                                                \
+  instr = &code[pc++];                                                         \
+  goto dispatch
+#endif
+
+void RegVM::run() {
+#ifdef WHIMSIA_THREADED
+  static const void *handlers[] = {
+      HANDLER_ADDRESS(RegMove),           HANDLER_ADDRESS(RegNull),
+      HANDLER_ADDRESS(RegBinary),         HANDLER_ADDRESS(RegIndex),
+      HANDLER_ADDRESS(RegArray),          HANDLER_ADDRESS(RegJump),
+      HANDLER_ADDRESS(RegJumpIfFalse),    HANDLER_ADDRESS(RegLoop),
+      HANDLER_ADDRESS(RegCall),           HANDLER_ADDRESS(RegTailCall),
+      HANDLER_ADDRESS(RegCallBuiltin),    HANDLER_ADDRESS(RegReturn),
+      HANDLER_ADDRESS(RegDefineFunction), HANDLER_ADDRESS(RegGuard),
+      HANDLER_ADDRESS(RegHalt),
+  };
+  thread(handlers, &&handler_check);
+#endif
+  frames.push_back(RegFrame{program->functions[0], 0, 0});
+  enter(program->functions[0], 0, 0);
+  RegInstr *code = func->code.data();
+  RegInstr *instr;
+  int pc = 0;
+  DISPATCH();
+#ifdef WHIMSIA_THREADED
+handler_check:
+  check(*instr);
+  goto *handlers[instr->op];
+#else
+dispatch:
+  if (instr->check != CheckNone) {
+    check(*instr);
+  }
+  switch (instr->op) {
+#endif
+  HANDLER(RegMove) {
+    regs[instr->a] = read(instr->b);
+    DISPATCH();
+  }
+  HANDLER(RegNull) {
+    regs[instr->a] = nullptr;
+    DISPATCH();
+  }
+  HANDLER(RegBinary) {
+    regs[instr->a] = evaluate_operator(read(instr->b), read(instr->c),
+                                      (TokenType)instr->token);
+    DISPATCH();
+  }
+  HANDLER(RegIndex) {
+    Object *prop = read(instr->c);
+    ArrayObject *value = (ArrayObject *)regs[instr->b];
+    if (value == nullptr) {
+      throw EvalError("object not defined");
+    }
+    if (prop->type() != IntType) {
+      throw EvalError("invalid property type");
+    }
+    int index = ((IntegerObject *)prop)->value;
+    if (index < 0 || index >= value->elements.size()) {
+      throw EvalError("index out of bounds");
+    }
+    regs[instr->a] = value->elements[index];
+    DISPATCH();
+  }
+  HANDLER(RegArray) {
+    std::vector<Object *> elements(regs + instr->b,
+                                   regs + instr->b + instr->c);
+    regs[instr->a] = new ArrayObject(elements);
+    DISPATCH();
+  }
+  HANDLER(RegJump) {
+    pc = instr->b;
+    DISPATCH();
+  }
+  HANDLER(RegJumpIfFalse) {
+    if (!read(instr->b)->is_truthy()) {
+      pc = instr->c;
+    }
+    DISPATCH();
+  }
+  HANDLER(RegLoop) {
+    pc = instr->b;
+    if (heap.no_gc_depth == 0) {
+      heap.safepoint();
+    }
+    DISPATCH();
+  }
+  HANDLER(RegCall)
+  HANDLER(RegTailCall) {
+    if (function_table[instr->b] < 0) {
+      throw EvalError("function " + program->function_names[instr->b] +
+                      " not defined");
+    }
+    RegFunction *callee = program->functions[function_table[instr->b]];
+    if (instr->c != callee->num_params) {
+      throw EvalError("invalid number of arguments");
+    }
+    size_t base = regs - registers;
+    if (instr->op == RegTailCall) {
+      function_table.leave(frames.size());
+      std::copy(regs + instr->a, regs + instr->a + instr->c, regs);
+      frames.back().func = callee;
+    } else {
+      frames.back().pc = pc;
+      base += instr->a;
+      frames.push_back(RegFrame{callee, 0, base});
+    }
+    enter(callee, base, instr->c);
+    code = func->code.data();
+    pc = 0;
+    if (heap.no_gc_depth == 0) {
+      heap.safepoint();
+    }
+    DISPATCH();
+  }
+  HANDLER(RegCallBuiltin) {
+    args.assign(regs + instr->a, regs + instr->a + instr->c);
+    regs[instr->a] = (*builtins[instr->b])(args);
+    DISPATCH();
+  }
+  HANDLER(RegReturn) {
+    Object *ret = read(instr->b);
+    regs[0] = ret;
+    function_table.leave(frames.size());
+    frames.pop_back();
+    RegFrame &frame = frames.back();
+    func = frame.func;
+    regs = registers + frame.base;
+    top = frame.base + func->frame_size;
+    code = func->code.data();
+    pc = frame.pc;
+    DISPATCH();
+  }
+  HANDLER(RegDefineFunction) {
+    function_table.define(instr->b, instr->c, frames.size());
+    DISPATCH();
+  }
+  HANDLER(RegGuard) {
+    Object *value =
+        instr->a < 0 ? program->constants[-1 - instr->a] : regs[instr->a];
+    if (instr->c == CheckUndefined && value != nullptr) {
+      throw EvalError("variable already defined: " +
+                      func->var_names[instr->b]);
+    }
+    if (instr->c == CheckDefined && value == nullptr) {
+      throw EvalError("variable not defined");
+    }
+    if (instr->c == CheckIdentifier && value == nullptr) {
+      throw EvalError("undefined identifier: " + func->var_names[instr->b]);
+    }
+    DISPATCH();
+  }
+  HANDLER(RegHalt) {
+    frames.clear();
+    return;
+  }
+#ifndef WHIMSIA_THREADED
+  default: {
+    throw EvalError("unknown opcode " + std::to_string(instr->op));
+  }
+  }
+#endif
+}
@@ -0,0 +1,47 @@
+#include "ast.h"
+#include "bytecode.h"
+#include "common.h"
+#include "regbytecode.h"
+
+#ifndef regvm_h
+#define regvm_h
+
+class RegFrame {
+public:
+  RegFunction *func;
+  int pc;
+  size_t base;
+};
+
+// Register machine for RegProgram. All frames live in one register file; a
+// callee's frame starts at the caller register holding its first argument,
+// so arguments are passed without copying. The live part of the register
+// file and the constant pool are registered as GC root ranges.
+class RegVM {
+public:
+  RegVM(RegProgram *program);
+  void run();
+
+  size_t dispatches = 0;
+
+private:
+  Object *read(int operand);
+  void check(RegInstr &instr);
+  void enter(RegFunction *callee, size_t base, int argc);
+  void thread(const void **handlers, const void *check_handler);
+
+  RegProgram *program;
+  size_t num_constants;
+  Object **registers;
+  Object **regs;
+  size_t top = 0;
+  size_t capacity;
+  RegFunction *func;
+  std::vector<RegFrame> frames;
+  FunctionTable function_table;
+  std::vector<const std::function<Object *(std::vector<Object *> &)> *>
+      builtins;
+  std::vector<Object *> args;
+};
+
+#endif // !regvm_h
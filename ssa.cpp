@@ -0,0 +1,581 @@
+#include "ssa.h"
+#include "builtins.h"
+#include "eval.h"
+#include "utils.h"
+#include <algorithm>
+
+const char *SsaOpNames[] = {
+    "const",  "null",   "param",     "phi",         "binary",
+    "index",  "array",  "call",      "call_builtin", "define_function",
+    "check",  "jump",   "branch",    "return",      "tail_call",
+    "halt",
+};
+
+SsaValue::SsaValue(int op, int id, SsaBlock *block)
+    : op(op), id(id), block(block) {}
+
+bool SsaValue::is_terminator() {
+  return op == SsaJump || op == SsaBranch || op == SsaReturn ||
+         op == SsaTailCall || op == SsaHalt;
+}
+
+SsaBlock::SsaBlock(int id) : id(id) {}
+
+SsaValue *SsaBlock::terminator() {
+  if (code.empty() || !code.back()->is_terminator()) {
+    return nullptr;
+  }
+  return code.back();
+}
+
+SsaBlock *SsaFunction::new_block() {
+  int id = blocks.empty() ? 0 : blocks.back()->id + 1;
+  blocks.push_back(new SsaBlock(id));
+  return blocks.back();
+}
+
+SsaValue *SsaFunction::new_value(int op, SsaBlock *block) {
+  return new SsaValue(op, num_values++, block);
+}
+
+// Adds a constant, or null, at the start of the entry block.
+SsaValue *SsaFunction::new_constant(Object *constant) {
+  SsaValue *value =
+      new_value(constant == nullptr ? SsaNull : SsaConst, blocks[0]);
+  value->constant = constant;
+  blocks[0]->code.insert(blocks[0]->code.begin(), value);
+  return value;
+}
+
+// Drops one edge and the phi operands that came with it. The terminator of
+// from is left to the caller.
+void SsaFunction::remove_edge(SsaBlock *from, SsaBlock *to) {
+  for (size_t i = 0; i < to->preds.size(); i++) {
+    if (to->preds[i] == from) {
+      to->preds.erase(to->preds.begin() + i);
+      for (auto phi : to->phis) {
+        phi->args.erase(phi->args.begin() + i);
+      }
+      break;
+    }
+  }
+  for (size_t i = 0; i < from->succs.size(); i++) {
+    if (from->succs[i] == to) {
+      from->succs.erase(from->succs.begin() + i);
+      break;
+    }
+  }
+}
+
+int SsaFunction::remove_unreachable() {
+  std::vector<SsaBlock *> order = reverse_postorder();
+  std::unordered_set<SsaBlock *> reachable(order.begin(), order.end());
+  std::vector<SsaBlock *> kept;
+  for (auto block : blocks) {
+    if (reachable.count(block) > 0) {
+      kept.push_back(block);
+      continue;
+    }
+    std::vector<SsaBlock *> succs = block->succs;
+    for (auto succ : succs) {
+      remove_edge(block, succ);
+    }
+  }
+  int removed = blocks.size() - kept.size();
+  blocks = kept;
+  return removed;
+}
+
+// Replaces phis whose operands are all the same value, or the phi itself,
+// by that value until none is left.
+void SsaFunction::simplify_phis() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    std::unordered_map<SsaValue *, SsaValue *> replaced;
+    for (auto block : blocks) {
+      for (size_t i = 0; i < block->phis.size();) {
+        SsaValue *phi = block->phis[i];
+        SsaValue *same = nullptr;
+        bool trivial = true;
+        for (auto arg : phi->args) {
+          while (replaced.count(arg) > 0) {
+            arg = replaced[arg];
+          }
+          if (arg == phi || arg == same) {
+            continue;
+          }
+          if (same != nullptr) {
+            trivial = false;
+            break;
+          }
+          same = arg;
+        }
+        if (trivial && same != nullptr) {
+          replaced[phi] = same;
+          block->phis.erase(block->phis.begin() + i);
+          changed = true;
+        } else {
+          i++;
+        }
+      }
+    }
+    replace_uses(replaced);
+  }
+}
+
+void SsaFunction::replace_uses(
+    std::unordered_map<SsaValue *, SsaValue *> &replaced) {
+  if (replaced.empty()) {
+    return;
+  }
+  for (auto block : blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        for (auto &arg : value->args) {
+          while (replaced.count(arg) > 0) {
+            arg = replaced[arg];
+          }
+        }
+      }
+    }
+  }
+}
+
+// The blocks reachable from the entry block, each after its dominators.
+std::vector<SsaBlock *> SsaFunction::reverse_postorder() {
+  std::vector<SsaBlock *> postorder;
+  std::unordered_set<SsaBlock *> visited;
+  std::vector<std::pair<SsaBlock *, size_t>> stack;
+  visited.insert(blocks[0]);
+  stack.push_back({blocks[0], 0});
+  while (!stack.empty()) {
+    auto &[block, next] = stack.back();
+    // Successors are visited last to first so that the first one follows
+    // its block in the end, like the body of a loop or an if.
+    if (next < block->succs.size()) {
+      SsaBlock *succ = block->succs[block->succs.size() - 1 - next++];
+      if (visited.insert(succ).second) {
+        stack.push_back({succ, 0});
+      }
+      continue;
+    }
+    postorder.push_back(block);
+    stack.pop_back();
+  }
+  return std::vector<SsaBlock *>(postorder.rbegin(), postorder.rend());
+}
+
+// Checks the invariants the passes and the lowering rely on.
+void SsaFunction::verify() {
+  std::unordered_set<SsaBlock *> known(blocks.begin(), blocks.end());
+  std::unordered_set<SsaValue *> defined;
+  for (auto block : blocks) {
+    defined.insert(block->phis.begin(), block->phis.end());
+    defined.insert(block->code.begin(), block->code.end());
+  }
+  auto fail = [&](SsaBlock *block, std::string reason) {
+    throw EvalError("invalid SSA in " + name + " b" +
+                    std::to_string(block->id) + ": " + reason);
+  };
+  for (auto block : blocks) {
+    SsaValue *terminator = block->terminator();
+    if (terminator == nullptr) {
+      fail(block, "no terminator");
+    }
+    size_t num_succs = terminator->op == SsaJump     ? 1
+                       : terminator->op == SsaBranch ? 2
+                                                     : 0;
+    if (block->succs.size() != num_succs) {
+      fail(block, "successors don't match the terminator");
+    }
+    for (auto succ : block->succs) {
+      if (known.count(succ) == 0 ||
+          std::count(succ->preds.begin(), succ->preds.end(), block) !=
+              std::count(block->succs.begin(), block->succs.end(), succ)) {
+        fail(block, "edge to b" + std::to_string(succ->id));
+      }
+    }
+    for (auto pred : block->preds) {
+      if (known.count(pred) == 0) {
+        fail(block, "predecessor not in the function");
+      }
+    }
+    for (auto phi : block->phis) {
+      if (phi->op != SsaPhi || phi->args.size() != block->preds.size()) {
+        fail(block, "phi v" + std::to_string(phi->id));
+      }
+    }
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        if (value->block != block ||
+            (value->is_terminator() && value != terminator)) {
+          fail(block, "misplaced v" + std::to_string(value->id));
+        }
+        for (auto arg : value->args) {
+          if (defined.count(arg) == 0) {
+            fail(block, "v" + std::to_string(value->id) +
+                            " uses a removed value");
+          }
+        }
+      }
+    }
+  }
+}
+
+static std::string print_value(SsaValue *value) {
+  std::stringstream out;
+  out << "  ";
+  if (!value->is_terminator() && value->op != SsaDefineFunction &&
+      (value->op != SsaCheck || value->check == CheckIdentifier)) {
+    out << "v" << value->id << " = ";
+  }
+  out << SsaOpNames[value->op];
+  if (value->op == SsaConst) {
+    out << " " << value->constant->inspect();
+  } else if (value->op == SsaParam || value->op == SsaDefineFunction) {
+    out << " " << value->index;
+  } else if (value->op == SsaBinary) {
+    out << " op " << value->token;
+  } else if (value->op == SsaCheck) {
+    out << " " << value->check;
+  }
+  if (!value->name.empty()) {
+    out << " " << value->name;
+  }
+  for (auto arg : value->args) {
+    out << " v" << arg->id;
+  }
+  if (value->is_terminator()) {
+    for (auto succ : value->block->succs) {
+      out << " b" << succ->id;
+    }
+  }
+  if (value->type >= 0) {
+    out << " : type " << value->type;
+  }
+  out << "\n";
+  return out.str();
+}
+
+std::string SsaFunction::print() {
+  std::stringstream out;
+  out << "function " << name << " (params " << num_params << ")\n";
+  for (auto block : blocks) {
+    out << "b" << block->id;
+    if (!block->preds.empty()) {
+      out << " (preds";
+      for (auto pred : block->preds) {
+        out << " b" << pred->id;
+      }
+      out << ")";
+    }
+    out << ":\n";
+    for (auto phi : block->phis) {
+      out << print_value(phi);
+    }
+    for (auto value : block->code) {
+      out << print_value(value);
+    }
+  }
+  return out.str();
+}
+
+std::string SsaProgram::print() {
+  std::string out;
+  for (auto function : functions) {
+    out += function->print();
+  }
+  return out;
+}
+
+SsaProgram *SsaBuilder::build(std::vector<Node *> &nodes) {
+  program = new SsaProgram();
+  build_function(nullptr);
+  build_block(nodes);
+  emit(SsaHalt, {});
+  end_block({});
+  function->remove_unreachable();
+  function->simplify_phis();
+  return program;
+}
+
+// Builds funcNode, or the top-level code for nullptr, as the next function
+// of the program and leaves the builder in it.
+void SsaBuilder::build_function(FunctionStatement *funcNode) {
+  function = new SsaFunction();
+  function->name = funcNode == nullptr ? "<main>" : funcNode->ident.name;
+  program->functions.push_back(function);
+  current = function->new_block();
+  sealed.insert(current);
+  null_value = emit(SsaNull, {});
+  block_exits.clear();
+  if (funcNode == nullptr) {
+    return;
+  }
+  function->num_params = funcNode->params.size();
+  for (size_t i = 0; i < funcNode->params.size(); i++) {
+    SsaValue *param = emit(SsaParam, {});
+    param->index = i;
+    write_variable(funcNode->params[i]->name, current, param);
+  }
+  build_block(funcNode->block);
+  emit(SsaReturn, {null_value});
+  end_block({});
+  function->remove_unreachable();
+  function->simplify_phis();
+}
+
+void SsaBuilder::build_block(std::vector<Node *> &block) {
+  for (auto node : block) {
+    if (node != nullptr) {
+      build_statement(node);
+    }
+  }
+}
+
+void SsaBuilder::build_statement(Node *node) {
+  std::string type = node->statement_type();
+  bool in_function = function != program->functions[0];
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    SsaValue *value = build_expression(letNode->value);
+    emit_check(read_variable(letNode->ident.name, current), CheckUndefined,
+               letNode->ident.name);
+    write_variable(letNode->ident.name, current, value);
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    SsaValue *value = build_expression(assNode->value);
+    emit_check(read_variable(assNode->ident.name, current), CheckDefined,
+               assNode->ident.name);
+    write_variable(assNode->ident.name, current, value);
+  } else if (type == "IfStatement") {
+    IfStatement *ifNode = (IfStatement *)node;
+    SsaValue *condition = build_expression(ifNode->condition);
+    SsaBlock *consequent = function->new_block();
+    SsaBlock *alternate = function->new_block();
+    SsaBlock *join = function->new_block();
+    emit(SsaBranch, {condition});
+    end_block({consequent, alternate});
+    seal(consequent);
+    seal(alternate);
+    block_exits.push_back(join);
+    current = consequent;
+    build_block(ifNode->consequent);
+    emit(SsaJump, {});
+    end_block({join});
+    current = alternate;
+    build_block(ifNode->alternate);
+    emit(SsaJump, {});
+    end_block({join});
+    block_exits.pop_back();
+    seal(join);
+    current = join;
+  } else if (type == "WhileStatement") {
+    // The header is sealed once the body has added the back edge.
+    WhileStatement *whileNode = (WhileStatement *)node;
+    SsaBlock *header = function->new_block();
+    emit(SsaJump, {});
+    end_block({header});
+    current = header;
+    SsaValue *condition = build_expression(whileNode->condition);
+    SsaBlock *body = function->new_block();
+    SsaBlock *exit = function->new_block();
+    emit(SsaBranch, {condition});
+    end_block({body, exit});
+    seal(body);
+    seal(exit);
+    block_exits.push_back(header);
+    current = body;
+    build_block(whileNode->block);
+    emit(SsaJump, {});
+    end_block({header});
+    block_exits.pop_back();
+    seal(header);
+    current = exit;
+  } else if (type == "FunctionStatement") {
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    SsaFunction *outer = function;
+    SsaBlock *outer_current = current;
+    SsaValue *outer_null = null_value;
+    std::vector<SsaBlock *> outer_exits = block_exits;
+    int index = program->functions.size();
+    build_function(funcNode);
+    function = outer;
+    current = outer_current;
+    null_value = outer_null;
+    block_exits = outer_exits;
+    SsaValue *define = emit(SsaDefineFunction, {});
+    define->name = funcNode->ident.name;
+    define->index = index;
+  } else if (type == "CallExpression") {
+    build_call((CallExpression *)node, false);
+  } else if (type == "ReturnStatement") {
+    // The top-level code stops without reading a returned variable.
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    std::string value_type = retNode->value->statement_type();
+    if (!in_function) {
+      if (value_type != "Literal" && value_type != "Identifier") {
+        build_expression(retNode->value);
+      }
+      emit(SsaHalt, {});
+      end_block({});
+    } else if (value_type == "CallExpression") {
+      build_call((CallExpression *)retNode->value, true);
+    } else {
+      emit(SsaReturn, {build_expression(retNode->value)});
+      end_block({});
+    }
+  } else if (type == "MemberExpression") {
+    // A bare index statement ends the block it is in, like in evaluate().
+    SsaValue *value = build_expression(node);
+    if (!block_exits.empty()) {
+      emit(SsaJump, {});
+      end_block({block_exits.back()});
+    } else if (in_function) {
+      emit(SsaReturn, {value});
+      end_block({});
+    } else {
+      emit(SsaHalt, {});
+      end_block({});
+    }
+  }
+}
+
+SsaValue *SsaBuilder::build_expression(Node *node) {
+  std::string type = node->statement_type();
+  if (type == "Literal") {
+    SsaValue *value = emit(SsaConst, {});
+    value->constant = get_obj_from_literal((Literal *)node);
+    return value;
+  } else if (type == "Identifier") {
+    // Reads after this one know the variable is defined.
+    std::string &name = ((Identifier *)node)->name;
+    SsaValue *value =
+        emit_check(read_variable(name, current), CheckIdentifier, name);
+    write_variable(name, current, value);
+    return value;
+  } else if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    SsaValue *left = build_expression(bNode->left);
+    SsaValue *right = build_expression(bNode->right);
+    SsaValue *value = emit(SsaBinary, {left, right});
+    value->token = bNode->op.type;
+    return value;
+  } else if (type == "CallExpression") {
+    return build_call((CallExpression *)node, false);
+  } else if (type == "ArrayExpression") {
+    std::vector<SsaValue *> elements;
+    for (auto elem : ((ArrayExpression *)node)->elements) {
+      elements.push_back(build_expression(elem));
+    }
+    return emit(SsaArray, elements);
+  } else if (type == "MemberExpression") {
+    // Like RegIndex, the array variable is read without a check.
+    MemberExpression *memNode = (MemberExpression *)node;
+    SsaValue *property = build_expression(memNode->property);
+    SsaValue *object =
+        read_variable(((Identifier *)memNode->object)->name, current);
+    return emit(SsaIndex, {object, property});
+  }
+  throw EvalError("invalid initialization value " + type);
+}
+
+// A call in tail position ends the block.
+SsaValue *SsaBuilder::build_call(CallExpression *callNode, bool tail) {
+  std::vector<SsaValue *> args;
+  for (auto arg : callNode->args) {
+    args.push_back(build_expression(arg));
+  }
+  bool builtin =
+      BuiltinFunctions.find(callNode->callee.name) != BuiltinFunctions.end();
+  SsaValue *call = emit(builtin ? SsaCallBuiltin
+                        : tail  ? SsaTailCall
+                                : SsaCall,
+                        args);
+  call->name = callNode->callee.name;
+  if (tail) {
+    if (builtin) {
+      emit(SsaReturn, {call});
+    }
+    end_block({});
+  }
+  return call;
+}
+
+SsaValue *SsaBuilder::emit(int op, std::vector<SsaValue *> args) {
+  SsaValue *value = function->new_value(op, current);
+  value->args = args;
+  current->code.push_back(value);
+  return value;
+}
+
+SsaValue *SsaBuilder::emit_check(SsaValue *value, int check,
+                                 std::string &name) {
+  SsaValue *checked = emit(SsaCheck, {value});
+  checked->check = check;
+  checked->name = name;
+  return checked;
+}
+
+// Links the current block, which has just been given its terminator, to
+// succs. Anything built after it lands in a new block without predecessors,
+// dropped in the end.
+void SsaBuilder::end_block(std::vector<SsaBlock *> succs) {
+  current->succs = succs;
+  for (auto succ : succs) {
+    succ->preds.push_back(current);
+  }
+  current = function->new_block();
+  sealed.insert(current);
+}
+
+void SsaBuilder::write_variable(const std::string &name, SsaBlock *block,
+                                SsaValue *value) {
+  definitions[block][name] = value;
+}
+
+SsaValue *SsaBuilder::read_variable(const std::string &name,
+                                    SsaBlock *block) {
+  auto &defined = definitions[block];
+  auto found = defined.find(name);
+  if (found != defined.end()) {
+    return found->second;
+  }
+  SsaValue *value;
+  if (sealed.count(block) == 0) {
+    // Not all predecessors are known yet, see seal().
+    value = function->new_value(SsaPhi, block);
+    block->phis.push_back(value);
+    incomplete_phis[block][name] = value;
+  } else if (block->preds.empty()) {
+    value = null_value;
+  } else if (block->preds.size() == 1) {
+    value = read_variable(name, block->preds[0]);
+  } else {
+    // Written first so that reads going around a loop end at the phi.
+    value = function->new_value(SsaPhi, block);
+    block->phis.push_back(value);
+    write_variable(name, block, value);
+    add_phi_operands(name, value);
+  }
+  write_variable(name, block, value);
+  return value;
+}
+
+SsaValue *SsaBuilder::add_phi_operands(const std::string &name,
+                                       SsaValue *phi) {
+  for (auto pred : phi->block->preds) {
+    phi->args.push_back(read_variable(name, pred));
+  }
+  return phi;
+}
+
+void SsaBuilder::seal(SsaBlock *block) {
+  std::unordered_map<std::string, SsaValue *> phis = incomplete_phis[block];
+  incomplete_phis.erase(block);
+  for (auto &[name, phi] : phis) {
+    add_phi_operands(name, phi);
+  }
+  sealed.insert(block);
+}
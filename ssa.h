@@ -0,0 +1,136 @@
+#include "ast.h"
+#include "common.h"
+#include "regbytecode.h"
+#include <unordered_set>
+
+#ifndef ssa_h
+#define ssa_h
+
+// Operations of the SSA IR. A block holds its phis apart from its code, and
+// the last instruction of its code is the terminator.
+enum SsaOp {
+  SsaConst,          // constant
+  SsaNull,           // what a variable holds before its let
+  SsaParam,          // parameter index
+  SsaPhi,            // args[i] when control comes from preds[i]
+  SsaBinary,         // args[0] token args[1]
+  SsaIndex,          // args[0][args[1]]
+  SsaArray,          // [args[0] .. args[n - 1]]
+  SsaCall,           // function name(args)
+  SsaCallBuiltin,    // builtin name(args)
+  SsaDefineFunction, // function name = functions[index]
+  SsaCheck,          // throw unless args[0] passes check for variable name
+  SsaJump,           // goto succs[0]
+  SsaBranch,         // if args[0] goto succs[0] else succs[1]
+  SsaReturn,         // return args[0]
+  SsaTailCall,       // return function name(args)
+  SsaHalt,
+  SsaOpCount,
+};
+
+extern const char *SsaOpNames[];
+
+class SsaBlock;
+
+// An instruction and the value it defines. A CheckIdentifier check is the
+// variable read it checks, its value is args[0] known not to be null.
+class SsaValue {
+public:
+  SsaValue(int op, int id, SsaBlock *block);
+  bool is_terminator();
+
+  int op;
+  int id;
+  SsaBlock *block;
+  std::vector<SsaValue *> args;
+  int token = 0;
+  Object *constant = nullptr;
+  int index = 0;
+  int check = CheckNone;
+  std::string name;
+  // Set by SccpPass to the type of values known to never be null, -1 when
+  // it isn't known.
+  int type = -1;
+};
+
+class SsaBlock {
+public:
+  SsaBlock(int id);
+  SsaValue *terminator();
+
+  int id;
+  std::vector<SsaValue *> phis;
+  std::vector<SsaValue *> code;
+  std::vector<SsaBlock *> preds;
+  std::vector<SsaBlock *> succs;
+};
+
+// blocks[0] is the entry block. Values only ever refer to values of the
+// same function.
+class SsaFunction {
+public:
+  SsaBlock *new_block();
+  SsaValue *new_value(int op, SsaBlock *block);
+  SsaValue *new_constant(Object *constant);
+  void remove_edge(SsaBlock *from, SsaBlock *to);
+  int remove_unreachable();
+  void simplify_phis();
+  void replace_uses(std::unordered_map<SsaValue *, SsaValue *> &replaced);
+  std::vector<SsaBlock *> reverse_postorder();
+  void verify();
+  std::string print();
+
+  std::string name;
+  int num_params = 0;
+  std::vector<SsaBlock *> blocks;
+  int num_values = 0;
+};
+
+// functions[0] is the top-level code; the others are numbered like in the
+// RegProgram they are lowered to.
+class SsaProgram {
+public:
+  std::string print();
+
+  std::vector<SsaFunction *> functions;
+};
+
+// Builds the SSA form of the Parser output, reading variables straight into
+// SSA values as it goes (Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form"). A variable holds SsaNull until its let,
+// and the let, assignment and read checks the register VM makes on it are
+// SsaCheck instructions, so passes can prove them away.
+class SsaBuilder {
+public:
+  SsaProgram *build(std::vector<Node *> &program);
+
+private:
+  void build_function(FunctionStatement *funcNode);
+  void build_block(std::vector<Node *> &block);
+  void build_statement(Node *node);
+  SsaValue *build_expression(Node *node);
+  SsaValue *build_call(CallExpression *callNode, bool tail);
+  SsaValue *emit(int op, std::vector<SsaValue *> args);
+  SsaValue *emit_check(SsaValue *value, int check, std::string &name);
+  void end_block(std::vector<SsaBlock *> succs);
+  void write_variable(const std::string &name, SsaBlock *block,
+                      SsaValue *value);
+  SsaValue *read_variable(const std::string &name, SsaBlock *block);
+  SsaValue *add_phi_operands(const std::string &name, SsaValue *phi);
+  void seal(SsaBlock *block);
+
+  SsaProgram *program;
+  SsaFunction *function;
+  SsaBlock *current;
+  SsaValue *null_value;
+  std::unordered_map<SsaBlock *,
+                     std::unordered_map<std::string, SsaValue *>>
+      definitions;
+  std::unordered_map<SsaBlock *,
+                     std::unordered_map<std::string, SsaValue *>>
+      incomplete_phis;
+  std::unordered_set<SsaBlock *> sealed;
+  std::vector<SsaBlock *> block_exits;
+};
+
+#endif // !ssa_h
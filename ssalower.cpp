@@ -0,0 +1,517 @@
+#include "ssalower.h"
+#include <algorithm>
+
+// The value a CheckIdentifier check stands for lives where the checked
+// value does.
+static SsaValue *location(SsaValue *value) {
+  while (value->op == SsaCheck && value->check == CheckIdentifier) {
+    value = value->args[0];
+  }
+  return value;
+}
+
+static bool needs_register(SsaValue *value) {
+  switch (value->op) {
+  case SsaNull:
+  case SsaParam:
+  case SsaPhi:
+  case SsaBinary:
+  case SsaIndex:
+  case SsaArray:
+  case SsaCall:
+  case SsaCallBuiltin: {
+    return true;
+  }
+  default: {
+    return false;
+  }
+  }
+}
+
+RegProgram *SsaLowering::lower(SsaProgram *ssa) {
+  program = new RegProgram();
+  for (auto function : ssa->functions) {
+    lower_function(function);
+  }
+  return program;
+}
+
+void SsaLowering::lower_function(SsaFunction *function) {
+  current = new RegFunction();
+  current->name = function->name;
+  current->num_params = function->num_params;
+  program->functions.push_back(current);
+  registers.clear();
+  used.clear();
+  order_index.clear();
+  block_starts.clear();
+  fixups.clear();
+  variables.clear();
+  arg_slots.clear();
+
+  split_critical_edges(function);
+  std::vector<SsaBlock *> order = function->reverse_postorder();
+  for (size_t i = 0; i < order.size(); i++) {
+    order_index[order[i]] = i;
+  }
+  find_arg_slots(order);
+  allocate_registers(order);
+  for (auto &[value, slot] : arg_slots) {
+    registers[value] = scratch + slot;
+  }
+  current->frame_size = scratch + 1;
+  for (size_t i = 0; i < order.size(); i++) {
+    lower_block(order[i], i + 1 < order.size() ? order[i + 1] : nullptr);
+  }
+  for (auto &[at, target] : fixups) {
+    RegInstr &instr = current->code[at];
+    (instr.op == RegJumpIfFalse ? instr.c : instr.b) = block_starts[target];
+  }
+}
+
+// Puts a block on every edge from a block with several successors to one
+// with several predecessors, where the moves for its phis can go.
+void SsaLowering::split_critical_edges(SsaFunction *function) {
+  for (size_t i = 0; i < function->blocks.size(); i++) {
+    SsaBlock *block = function->blocks[i];
+    if (block->succs.size() < 2) {
+      continue;
+    }
+    for (auto &succ : block->succs) {
+      if (succ->preds.size() < 2) {
+        continue;
+      }
+      SsaBlock *split = function->new_block();
+      split->code.push_back(function->new_value(SsaJump, split));
+      split->preds = {block};
+      split->succs = {succ};
+      *std::find(succ->preds.begin(), succ->preds.end(), block) = split;
+      succ = split;
+    }
+  }
+}
+
+// Arithmetic and index reads used only as an argument of the call or array
+// right after them, with nothing in between that needs the scratch
+// registers, are computed straight into the argument's scratch register.
+void SsaLowering::find_arg_slots(std::vector<SsaBlock *> &order) {
+  std::unordered_map<SsaValue *, int> uses;
+  for (auto block : order) {
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        for (auto arg : value->args) {
+          uses[location(arg)]++;
+        }
+      }
+    }
+  }
+  auto keeps_scratch = [](SsaValue *value) {
+    switch (value->op) {
+    case SsaConst:
+    case SsaNull:
+    case SsaParam:
+    case SsaBinary:
+    case SsaCheck:
+    case SsaDefineFunction: {
+      return true;
+    }
+    case SsaIndex: {
+      return location(value->args[0])->op != SsaConst;
+    }
+    default: {
+      return false;
+    }
+    }
+  };
+  for (auto block : order) {
+    for (size_t i = 0; i < block->code.size(); i++) {
+      SsaValue *value = block->code[i];
+      if (value->op != SsaCall && value->op != SsaCallBuiltin &&
+          value->op != SsaTailCall && value->op != SsaArray) {
+        continue;
+      }
+      for (size_t k = 0; k < value->args.size(); k++) {
+        SsaValue *arg = value->args[k];
+        if ((arg->op != SsaBinary && arg->op != SsaIndex) ||
+            arg->block != block || uses[arg] != 1 || !keeps_scratch(arg)) {
+          continue;
+        }
+        bool clear = true;
+        for (size_t j = i; j > 0 && block->code[j - 1] != arg; j--) {
+          clear = clear && keeps_scratch(block->code[j - 1]);
+        }
+        if (clear) {
+          arg_slots[arg] = k;
+        }
+      }
+    }
+  }
+}
+
+// Positions: a block's phis are defined at its start, an instruction at
+// position p reads its operands at 2p and writes its value at 2p + 1, so a
+// value can take the register of an operand it reads last. The moves for
+// the phis of a successor read at the terminator and write right after.
+void SsaLowering::allocate_registers(std::vector<SsaBlock *> &order) {
+  std::unordered_map<SsaBlock *, int> starts;
+  std::unordered_map<SsaBlock *, int> ends;
+  std::unordered_map<SsaValue *, int> positions;
+  int position = 0;
+  for (auto block : order) {
+    starts[block] = 2 * position++;
+    for (auto value : block->code) {
+      positions[value] = position++;
+    }
+    ends[block] = 2 * (position - 1);
+  }
+
+  auto phi_operand = [](SsaValue *phi, SsaBlock *pred) {
+    SsaBlock *block = phi->block;
+    size_t k = std::find(block->preds.begin(), block->preds.end(), pred) -
+               block->preds.begin();
+    return location(phi->args[k]);
+  };
+  std::unordered_map<SsaBlock *, std::unordered_set<SsaValue *>> live_in;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = order.rbegin(); it != order.rend(); it++) {
+      SsaBlock *block = *it;
+      std::unordered_set<SsaValue *> live;
+      for (auto succ : block->succs) {
+        live.insert(live_in[succ].begin(), live_in[succ].end());
+        for (auto phi : succ->phis) {
+          SsaValue *arg = phi_operand(phi, block);
+          if (needs_register(arg)) {
+            live.insert(arg);
+          }
+        }
+      }
+      for (auto value = block->code.rbegin(); value != block->code.rend();
+           value++) {
+        live.erase(*value);
+        for (auto arg : (*value)->args) {
+          if (needs_register(location(arg))) {
+            live.insert(location(arg));
+          }
+        }
+      }
+      for (auto phi : block->phis) {
+        live.erase(phi);
+      }
+      if (live != live_in[block]) {
+        live_in[block] = live;
+        changed = true;
+      }
+    }
+  }
+
+  // Walks every block backwards, closing the range of a value at its
+  // definition or at the start of the block.
+  std::unordered_map<SsaValue *, std::vector<std::pair<int, int>>> ranges;
+  std::unordered_map<SsaValue *, std::vector<int>> hints;
+  for (auto block : order) {
+    std::unordered_map<SsaValue *, int> live;
+    for (auto succ : block->succs) {
+      for (auto value : live_in[succ]) {
+        live[value] = ends[block] + 1;
+      }
+      for (auto phi : succ->phis) {
+        SsaValue *arg = phi_operand(phi, block);
+        ranges[phi].push_back({ends[block] + 1, ends[block] + 1});
+        if (needs_register(arg)) {
+          live.insert({arg, ends[block]});
+          used.insert(arg);
+          hints[arg].push_back(phi->id);
+          hints[phi].push_back(arg->id);
+        }
+      }
+    }
+    for (auto it = block->code.rbegin(); it != block->code.rend(); it++) {
+      SsaValue *value = *it;
+      int at = 2 * positions[value];
+      if (needs_register(value) && arg_slots.count(value) == 0) {
+        // Parameters arrive in their registers.
+        int def = value->op == SsaParam ? 0 : at + 1;
+        auto found = live.find(value);
+        ranges[value].push_back(
+            {def, found == live.end() ? def : found->second});
+        if (found != live.end()) {
+          live.erase(found);
+        }
+      }
+      for (auto arg : value->args) {
+        arg = location(arg);
+        if (needs_register(arg) && arg_slots.count(arg) == 0) {
+          live.insert({arg, at});
+        }
+        used.insert(arg);
+      }
+    }
+    for (auto phi : block->phis) {
+      auto found = live.find(phi);
+      ranges[phi].push_back(
+          {starts[block], found == live.end() ? starts[block] : found->second});
+      if (found != live.end()) {
+        live.erase(found);
+      }
+    }
+    for (auto &[value, end] : live) {
+      ranges[value].push_back({starts[block], end});
+    }
+  }
+
+  // Values are given registers in the order they start, each taking the
+  // first register, preferably one of a phi it is moved to or from, whose
+  // values it doesn't overlap.
+  std::unordered_map<int, SsaValue *> by_id;
+  std::vector<std::pair<int, SsaValue *>> sorted;
+  for (auto &[value, list] : ranges) {
+    int first = list[0].first;
+    for (auto &range : list) {
+      first = std::min(first, range.first);
+    }
+    sorted.push_back({first, value});
+    by_id[value->id] = value;
+  }
+  std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+    if (a.first != b.first) {
+      return a.first < b.first;
+    }
+    return a.second->id < b.second->id;
+  });
+  std::vector<std::vector<std::pair<int, int>>> taken;
+  auto fits = [&](std::vector<std::pair<int, int>> &list, int reg) {
+    if (reg >= taken.size()) {
+      return true;
+    }
+    for (auto &range : list) {
+      for (auto &other : taken[reg]) {
+        if (range.first <= other.second && other.first <= range.second) {
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+  for (auto &[first, value] : sorted) {
+    std::vector<std::pair<int, int>> &list = ranges[value];
+    int reg = -1;
+    if (value->op == SsaParam) {
+      reg = value->index;
+    }
+    for (auto id : hints[value]) {
+      auto hinted = registers.find(by_id[id]);
+      if (reg < 0 && hinted != registers.end() &&
+          fits(list, hinted->second)) {
+        reg = hinted->second;
+      }
+    }
+    for (int i = 0; reg < 0; i++) {
+      if (fits(list, i)) {
+        reg = i;
+      }
+    }
+    if (reg >= taken.size()) {
+      taken.resize(reg + 1);
+    }
+    taken[reg].insert(taken[reg].end(), list.begin(), list.end());
+    registers[value] = reg;
+  }
+  scratch = std::max((int)taken.size(), current->num_params);
+}
+
+void SsaLowering::lower_block(SsaBlock *block, SsaBlock *next) {
+  block_starts[block] = current->code.size();
+  for (auto value : block->code) {
+    switch (value->op) {
+    case SsaNull: {
+      emit(RegNull, registers[value], 0, 0);
+      break;
+    }
+    case SsaBinary: {
+      int at = emit(RegBinary, registers[value], operand(value->args[0]),
+                    operand(value->args[1]));
+      current->code[at].token = value->token;
+      break;
+    }
+    case SsaIndex: {
+      emit(RegIndex, registers[value], in_register(value->args[0]),
+           operand(value->args[1]));
+      break;
+    }
+    case SsaArray: {
+      emit_args(value->args);
+      emit(RegArray, registers[value], scratch, value->args.size());
+      break;
+    }
+    case SsaCall:
+    case SsaCallBuiltin: {
+      emit_args(value->args);
+      if (value->op == SsaCall) {
+        emit(RegCall, scratch, function_name(value->name), value->args.size());
+      } else {
+        emit(RegCallBuiltin, scratch, builtin(value->name),
+             value->args.size());
+      }
+      if (used.count(value) > 0) {
+        emit(RegMove, registers[value], scratch, 0);
+      }
+      break;
+    }
+    case SsaDefineFunction: {
+      emit(RegDefineFunction, 0, function_name(value->name), value->index);
+      break;
+    }
+    case SsaCheck: {
+      emit(RegGuard, operand(value->args[0]), variable(value->name),
+           value->check);
+      break;
+    }
+    case SsaJump: {
+      jump(block, block->succs[0], next);
+      break;
+    }
+    case SsaBranch: {
+      // Critical edges are split, so neither side has phis.
+      int at = emit(RegJumpIfFalse, 0, operand(value->args[0]), 0);
+      fixups.push_back({at, block->succs[1]});
+      jump(block, block->succs[0], next);
+      break;
+    }
+    case SsaReturn: {
+      emit(RegReturn, 0, operand(value->args[0]), 0);
+      break;
+    }
+    case SsaTailCall: {
+      emit_args(value->args);
+      emit(RegTailCall, scratch, function_name(value->name),
+           value->args.size());
+      break;
+    }
+    case SsaHalt: {
+      emit(RegHalt, 0, 0, 0);
+      break;
+    }
+    }
+  }
+}
+
+// Jumps back to a block laid out before are loops and go through RegLoop
+// for its GC safepoint.
+void SsaLowering::jump(SsaBlock *from, SsaBlock *to, SsaBlock *next) {
+  emit_moves(from, to);
+  if (to == next) {
+    return;
+  }
+  bool back = order_index[to] <= order_index[from];
+  fixups.push_back({emit(back ? RegLoop : RegJump, 0, 0, 0), to});
+}
+
+// Copies the phi operands of the edge into the phi registers as if all at
+// once: a move waits while its destination is still to be read, and a
+// cycle of moves is broken through the scratch register.
+void SsaLowering::emit_moves(SsaBlock *from, SsaBlock *to) {
+  size_t k = std::find(to->preds.begin(), to->preds.end(), from) -
+             to->preds.begin();
+  std::vector<std::pair<int, int>> moves;
+  for (auto phi : to->phis) {
+    int source = operand(phi->args[k]);
+    if (registers[phi] != source) {
+      moves.push_back({registers[phi], source});
+    }
+  }
+  while (!moves.empty()) {
+    bool moved = false;
+    for (size_t i = 0; i < moves.size() && !moved; i++) {
+      int target = moves[i].first;
+      bool read = std::any_of(moves.begin(), moves.end(), [&](auto &move) {
+        return move.second == target;
+      });
+      if (!read) {
+        emit(RegMove, target, moves[i].second, 0);
+        moves.erase(moves.begin() + i);
+        moved = true;
+      }
+    }
+    if (!moved) {
+      int source = moves[0].second;
+      emit(RegMove, scratch, source, 0);
+      for (auto &move : moves) {
+        if (move.second == source) {
+          move.second = scratch;
+        }
+      }
+    }
+  }
+}
+
+void SsaLowering::emit_args(std::vector<SsaValue *> &args) {
+  for (size_t i = 0; i < args.size(); i++) {
+    if (operand(args[i]) != scratch + i) {
+      emit(RegMove, scratch + i, operand(args[i]), 0);
+    }
+  }
+  current->frame_size =
+      std::max(current->frame_size, scratch + (int)args.size());
+}
+
+int SsaLowering::operand(SsaValue *value) {
+  value = location(value);
+  if (value->op == SsaConst) {
+    return -1 - add_constant(value->constant);
+  }
+  return registers.at(value);
+}
+
+// RegIndex reads its array from a register.
+int SsaLowering::in_register(SsaValue *value) {
+  int reg = operand(value);
+  if (reg < 0) {
+    emit(RegMove, scratch, reg, 0);
+    reg = scratch;
+  }
+  return reg;
+}
+
+int SsaLowering::emit(int op, int a, int b, int c) {
+  RegInstr instr;
+  instr.op = op;
+  instr.a = a;
+  instr.b = b;
+  instr.c = c;
+  current->code.push_back(instr);
+  return current->code.size() - 1;
+}
+
+int SsaLowering::add_constant(Object *constant) {
+  if (constants.find(constant) == constants.end()) {
+    constants[constant] = program->constants.size();
+    program->constants.push_back(constant);
+  }
+  return constants[constant];
+}
+
+int SsaLowering::function_name(const std::string &name) {
+  if (functions.find(name) == functions.end()) {
+    functions[name] = program->function_names.size();
+    program->function_names.push_back(name);
+  }
+  return functions[name];
+}
+
+int SsaLowering::builtin(const std::string &name) {
+  if (builtins.find(name) == builtins.end()) {
+    builtins[name] = program->builtin_names.size();
+    program->builtin_names.push_back(name);
+  }
+  return builtins[name];
+}
+
+int SsaLowering::variable(const std::string &name) {
+  if (variables.find(name) == variables.end()) {
+    variables[name] = current->var_names.size();
+    current->var_names.push_back(name);
+  }
+  return variables[name];
+}
@@ -0,0 +1,52 @@
+#include "ssa.h"
+#include "common.h"
+#include "regbytecode.h"
+
+#ifndef ssalower_h
+#define ssalower_h
+
+// Lowers an SsaProgram to a RegProgram for the register VM. Blocks are laid
+// out in reverse postorder and each value gets a register by a linear scan
+// over its live range; a phi becomes moves at the end of its predecessors.
+// Call arguments and array elements go into scratch registers above all the
+// values, so a callee's frame can start there without overwriting anything
+// live. Variables don't have registers of their own: the frames have no
+// variables for RegVM to check and `var_names` only names the variables of
+// RegGuard instructions.
+class SsaLowering {
+public:
+  RegProgram *lower(SsaProgram *ssa);
+
+private:
+  void lower_function(SsaFunction *function);
+  void split_critical_edges(SsaFunction *function);
+  void find_arg_slots(std::vector<SsaBlock *> &order);
+  void allocate_registers(std::vector<SsaBlock *> &order);
+  void lower_block(SsaBlock *block, SsaBlock *next);
+  void jump(SsaBlock *from, SsaBlock *to, SsaBlock *next);
+  void emit_moves(SsaBlock *from, SsaBlock *to);
+  void emit_args(std::vector<SsaValue *> &args);
+  int operand(SsaValue *value);
+  int in_register(SsaValue *value);
+  int emit(int op, int a, int b, int c);
+  int add_constant(Object *constant);
+  int function_name(const std::string &name);
+  int builtin(const std::string &name);
+  int variable(const std::string &name);
+
+  RegProgram *program;
+  RegFunction *current;
+  int scratch;
+  std::unordered_map<SsaValue *, int> registers;
+  std::unordered_map<SsaValue *, int> arg_slots;
+  std::unordered_set<SsaValue *> used;
+  std::unordered_map<SsaBlock *, int> order_index;
+  std::unordered_map<SsaBlock *, int> block_starts;
+  std::vector<std::pair<int, SsaBlock *>> fixups;
+  std::unordered_map<Object *, int> constants;
+  std::unordered_map<std::string, int> functions;
+  std::unordered_map<std::string, int> builtins;
+  std::unordered_map<std::string, int> variables;
+};
+
+#endif // !ssalower_h
@@ -0,0 +1,440 @@
+#include "ssapasses.h"
+#include "eval.h"
+#include <cstring>
+
+void SsaPassManager::add(std::string name,
+                         std::function<int(SsaFunction *)> pass) {
+  names.push_back(name);
+  passes.push_back(pass);
+  changes.push_back(0);
+}
+
+void SsaPassManager::run(SsaProgram *program) {
+  for (auto function : program->functions) {
+    function->verify();
+    for (size_t i = 0; i < passes.size(); i++) {
+      changes[i] += passes[i](function);
+      function->verify();
+    }
+  }
+}
+
+std::string SsaPassManager::stats() {
+  std::string out;
+  for (size_t i = 0; i < names.size(); i++) {
+    out += (i > 0 ? ", " : "") + names[i] + " " + std::to_string(changes[i]);
+  }
+  return out;
+}
+
+// Whether a and b are the same constant. Floats are compared bit for bit so
+// that a NaN is equal to itself.
+static bool same_constant(Object *a, Object *b) {
+  if (a == b) {
+    return true;
+  }
+  if (a == nullptr || b == nullptr || a->type() != b->type()) {
+    return false;
+  }
+  switch (a->type()) {
+  case IntType: {
+    return ((IntegerObject *)a)->value == ((IntegerObject *)b)->value;
+  }
+  case FloatType: {
+    return std::memcmp(&((FloatObject *)a)->value, &((FloatObject *)b)->value,
+                       sizeof(float)) == 0;
+  }
+  case BoolType: {
+    return ((BoolObject *)a)->value == ((BoolObject *)b)->value;
+  }
+  case StringType: {
+    return ((StringObject *)a)->value == ((StringObject *)b)->value;
+  }
+  default: {
+    return false;
+  }
+  }
+}
+
+static bool non_null(Lattice &lattice) {
+  return lattice.state == LatticeNonNull ||
+         (lattice.state == LatticeConstant && lattice.constant != nullptr);
+}
+
+static int type_of(Lattice &lattice) {
+  if (lattice.state == LatticeConstant && lattice.constant != nullptr) {
+    return lattice.constant->type();
+  }
+  return lattice.state == LatticeNonNull ? lattice.type : -1;
+}
+
+static bool same_lattice(Lattice &a, Lattice &b) {
+  return a.state == b.state && a.type == b.type &&
+         (a.state != LatticeConstant || same_constant(a.constant, b.constant));
+}
+
+static Lattice meet(Lattice a, Lattice b) {
+  if (a.state == LatticeTop) {
+    return b;
+  }
+  if (b.state == LatticeTop) {
+    return a;
+  }
+  if (a.state == LatticeConstant && b.state == LatticeConstant &&
+      same_constant(a.constant, b.constant)) {
+    return a;
+  }
+  Lattice result;
+  result.state = LatticeBottom;
+  if (non_null(a) && non_null(b)) {
+    result.state = LatticeNonNull;
+    result.type = type_of(a) == type_of(b) ? type_of(a) : -1;
+  }
+  return result;
+}
+
+// The result of evaluate_operator() on two constants, or nullptr if it
+// fails or would divide an int by 0.
+static Object *fold(int op, Object *left, Object *right) {
+  if (left->type() == ArrayType || right->type() == ArrayType) {
+    return nullptr;
+  }
+  bool string_plus =
+      (left->type() == StringType || right->type() == StringType) &&
+      op == Plus;
+  bool floats = left->type() == FloatType || right->type() == FloatType;
+  if (!string_plus && !floats && (op == Div || op == Mod)) {
+    if (left->type() != IntType || right->type() != IntType ||
+        ((IntegerObject *)right)->value == 0 ||
+        ((IntegerObject *)right)->value == -1) {
+      return nullptr;
+    }
+  }
+  try {
+    return evaluate_operator(left, right, (TokenType)op);
+  } catch (std::exception &) {
+    return nullptr;
+  }
+}
+
+// The type of `left op right` when it can't fail, -1 otherwise. Int
+// division needs a constant divisor other than 0 and -1.
+static int result_type(int op, Lattice &left, Lattice &right) {
+  if (!non_null(left) || !non_null(right)) {
+    return -1;
+  }
+  int left_type = type_of(left);
+  int right_type = type_of(right);
+  if ((left_type == StringType || right_type == StringType) && op == Plus) {
+    return StringType;
+  }
+  for (auto type : {left_type, right_type}) {
+    if (type != IntType && type != FloatType && type != BoolType) {
+      return -1;
+    }
+  }
+  switch (op) {
+  case Plus:
+  case Minus:
+  case Mul:
+  case Div:
+  case And:
+  case Or:
+  case Lt:
+  case Lte:
+  case Gt:
+  case Gte:
+  case Equal:
+  case NotEqual:
+  case Mod: {
+    break;
+  }
+  default: {
+    return -1;
+  }
+  }
+  if (left_type == FloatType || right_type == FloatType) {
+    return op == Mod ? -1 : FloatType;
+  }
+  if (op == Div || op == Mod) {
+    if (right.state != LatticeConstant || right_type != IntType) {
+      return -1;
+    }
+    int divisor = ((IntegerObject *)right.constant)->value;
+    if (divisor == 0 || divisor == -1) {
+      return -1;
+    }
+  }
+  return IntType;
+}
+
+int SccpPass::run(SsaFunction *function) {
+  values.clear();
+  users.clear();
+  edges.clear();
+  executable.clear();
+  constants.clear();
+  for (auto block : function->blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        value->type = -1;
+        for (auto arg : value->args) {
+          users[arg].push_back(value);
+        }
+      }
+    }
+  }
+  mark_edge(nullptr, function->blocks[0]);
+  while (!edge_worklist.empty() || !value_worklist.empty()) {
+    if (!edge_worklist.empty()) {
+      SsaBlock *block = edge_worklist.back().second;
+      edge_worklist.pop_back();
+      // A new edge can only change the phis of a block already visited.
+      bool first = executable.insert(block).second;
+      for (auto phi : block->phis) {
+        visit(phi);
+      }
+      if (first) {
+        for (auto value : block->code) {
+          visit(value);
+        }
+      }
+      continue;
+    }
+    SsaValue *value = value_worklist.back();
+    value_worklist.pop_back();
+    if (executable.count(value->block) > 0) {
+      visit(value);
+    }
+  }
+  return rewrite(function);
+}
+
+void SccpPass::mark_edge(SsaBlock *from, SsaBlock *to) {
+  if (edges.insert({from, to}).second) {
+    edge_worklist.push_back({from, to});
+  }
+}
+
+void SccpPass::visit(SsaValue *value) {
+  SsaBlock *block = value->block;
+  if (value->op == SsaJump) {
+    mark_edge(block, block->succs[0]);
+    return;
+  } else if (value->op == SsaBranch) {
+    Lattice &condition = values[value->args[0]];
+    if (condition.state == LatticeTop) {
+      return;
+    }
+    if (condition.state == LatticeConstant && condition.constant != nullptr) {
+      bool taken = condition.constant->is_truthy();
+      mark_edge(block, block->succs[taken ? 0 : 1]);
+    } else {
+      mark_edge(block, block->succs[0]);
+      mark_edge(block, block->succs[1]);
+    }
+    return;
+  } else if (value->is_terminator()) {
+    return;
+  }
+  Lattice lattice = evaluate(value);
+  Lattice &old = values[value];
+  if (same_lattice(old, lattice)) {
+    return;
+  }
+  old = lattice;
+  for (auto user : users[value]) {
+    value_worklist.push_back(user);
+  }
+}
+
+Lattice SccpPass::evaluate(SsaValue *value) {
+  Lattice result;
+  switch (value->op) {
+  case SsaConst:
+  case SsaNull: {
+    result.state = LatticeConstant;
+    result.constant = value->constant;
+    return result;
+  }
+  case SsaPhi: {
+    // Only the operands of edges taken so far count.
+    SsaBlock *block = value->block;
+    for (size_t i = 0; i < block->preds.size(); i++) {
+      if (edges.count({block->preds[i], block}) > 0) {
+        result = meet(result, values[value->args[i]]);
+      }
+    }
+    return result;
+  }
+  case SsaBinary: {
+    Lattice &left = values[value->args[0]];
+    Lattice &right = values[value->args[1]];
+    if (left.state == LatticeTop || right.state == LatticeTop) {
+      return result;
+    }
+    if (left.state == LatticeConstant && right.state == LatticeConstant &&
+        left.constant != nullptr && right.constant != nullptr) {
+      Object *folded = fold(value->token, left.constant, right.constant);
+      if (folded != nullptr) {
+        result.state = LatticeConstant;
+        result.constant = folded;
+        return result;
+      }
+    }
+    // evaluate_operator() never returns null.
+    result.state = LatticeNonNull;
+    result.type = result_type(value->token, left, right);
+    return result;
+  }
+  case SsaCheck: {
+    // Past a read check the variable is known to be defined.
+    Lattice &checked = values[value->args[0]];
+    if (value->check != CheckIdentifier) {
+      result.state = LatticeBottom;
+    } else if (checked.state == LatticeTop || non_null(checked)) {
+      result = checked;
+    } else {
+      result.state = LatticeNonNull;
+    }
+    return result;
+  }
+  case SsaArray: {
+    result.state = LatticeNonNull;
+    result.type = ArrayType;
+    return result;
+  }
+  default: {
+    result.state = LatticeBottom;
+    return result;
+  }
+  }
+}
+
+SsaValue *SccpPass::constant_value(SsaFunction *function, Object *constant) {
+  for (auto value : constants) {
+    if (same_constant(value->constant, constant)) {
+      return value;
+    }
+  }
+  constants.push_back(function->new_constant(constant));
+  return constants.back();
+}
+
+int SccpPass::rewrite(SsaFunction *function) {
+  int changes = 0;
+  // A branch only one side of which is ever taken becomes a jump.
+  for (auto block : function->blocks) {
+    SsaValue *terminator = block->terminator();
+    if (executable.count(block) == 0 || terminator->op != SsaBranch) {
+      continue;
+    }
+    bool taken = edges.count({block, block->succs[0]}) > 0;
+    bool not_taken = edges.count({block, block->succs[1]}) > 0;
+    if (taken == not_taken) {
+      continue;
+    }
+    terminator->op = SsaJump;
+    terminator->args.clear();
+    function->remove_edge(block, block->succs[taken ? 1 : 0]);
+    changes++;
+  }
+  changes += function->remove_unreachable();
+
+  std::vector<std::pair<SsaValue *, Object *>> folded;
+  std::unordered_set<SsaValue *> removed;
+  std::unordered_map<SsaValue *, SsaValue *> replaced;
+  for (auto block : function->blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        Lattice &lattice = values[value];
+        if (lattice.state == LatticeConstant &&
+            (value->op == SsaPhi || value->op == SsaBinary ||
+             value->op == SsaCheck)) {
+          folded.push_back({value, lattice.constant});
+          continue;
+        }
+        if (non_null(lattice)) {
+          value->type = type_of(lattice);
+        }
+        if (value->op != SsaCheck) {
+          continue;
+        }
+        Lattice &checked = values[value->args[0]];
+        bool passes = value->check == CheckUndefined
+                          ? checked.state == LatticeConstant &&
+                                checked.constant == nullptr
+                          : non_null(checked);
+        if (passes) {
+          removed.insert(value);
+          replaced[value] = value->args[0];
+        }
+      }
+    }
+  }
+  for (auto &[value, constant] : folded) {
+    removed.insert(value);
+    replaced[value] = constant_value(function, constant);
+  }
+  for (auto block : function->blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      std::erase_if(*list,
+                    [&](SsaValue *value) { return removed.count(value) > 0; });
+    }
+  }
+  function->replace_uses(replaced);
+  function->simplify_phis();
+  return changes + removed.size();
+}
+
+// Constants, phis and arrays never fail, and arithmetic can't when
+// SccpPass gave it a type.
+static bool removable(SsaValue *value) {
+  switch (value->op) {
+  case SsaConst:
+  case SsaNull:
+  case SsaParam:
+  case SsaPhi:
+  case SsaArray: {
+    return true;
+  }
+  case SsaBinary: {
+    return value->type >= 0;
+  }
+  default: {
+    return false;
+  }
+  }
+}
+
+int DcePass::run(SsaFunction *function) {
+  std::unordered_set<SsaValue *> live;
+  std::vector<SsaValue *> worklist;
+  for (auto block : function->blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      for (auto value : *list) {
+        if (!removable(value)) {
+          live.insert(value);
+          worklist.push_back(value);
+        }
+      }
+    }
+  }
+  while (!worklist.empty()) {
+    SsaValue *value = worklist.back();
+    worklist.pop_back();
+    for (auto arg : value->args) {
+      if (live.insert(arg).second) {
+        worklist.push_back(arg);
+      }
+    }
+  }
+  int removed = 0;
+  for (auto block : function->blocks) {
+    for (auto list : {&block->phis, &block->code}) {
+      removed += std::erase_if(
+          *list, [&](SsaValue *value) { return live.count(value) == 0; });
+    }
+  }
+  return removed;
+}
@@ -0,0 +1,72 @@
+#include "ssa.h"
+#include "common.h"
+#include <set>
+
+#ifndef ssapasses_h
+#define ssapasses_h
+
+// Runs passes over every function of an SsaProgram, in the order they were
+// added, verifying the IR after each. Every pass returns how many changes it
+// made, which are summed up for --exec-stats.
+class SsaPassManager {
+public:
+  void add(std::string name, std::function<int(SsaFunction *)> pass);
+  void run(SsaProgram *program);
+  std::string stats();
+
+private:
+  std::vector<std::string> names;
+  std::vector<std::function<int(SsaFunction *)>> passes;
+  std::vector<int> changes;
+};
+
+// What SccpPass knows about a value: nothing yet (LatticeTop), its constant
+// (null included), that it is never null and maybe its type, or nothing
+// useful (LatticeBottom).
+enum LatticeState {
+  LatticeTop,
+  LatticeConstant,
+  LatticeNonNull,
+  LatticeBottom,
+};
+
+class Lattice {
+public:
+  int state = LatticeTop;
+  Object *constant = nullptr;
+  int type = -1;
+};
+
+// Sparse conditional constant propagation (Wegman and Zadeck): values and
+// branches are only evaluated once the edge leading to them is known to be
+// taken. Folds constant arithmetic and branches, drops the blocks that are
+// never reached and the variable checks that can't fail, and records the
+// types of the values that are never null for DcePass.
+class SccpPass {
+public:
+  int run(SsaFunction *function);
+
+private:
+  void visit(SsaValue *value);
+  Lattice evaluate(SsaValue *value);
+  void mark_edge(SsaBlock *from, SsaBlock *to);
+  int rewrite(SsaFunction *function);
+  SsaValue *constant_value(SsaFunction *function, Object *constant);
+
+  std::unordered_map<SsaValue *, Lattice> values;
+  std::unordered_map<SsaValue *, std::vector<SsaValue *>> users;
+  std::set<std::pair<SsaBlock *, SsaBlock *>> edges;
+  std::unordered_set<SsaBlock *> executable;
+  std::vector<std::pair<SsaBlock *, SsaBlock *>> edge_worklist;
+  std::vector<SsaValue *> value_worklist;
+  std::vector<SsaValue *> constants;
+};
+
+// Removes the values nothing uses that can be computed without any effect:
+// constants, phis, arrays and arithmetic SccpPass has found can't fail.
+class DcePass {
+public:
+  int run(SsaFunction *function);
+};
+
+#endif // !ssapasses_h
@@ -0,0 +1,376 @@
+#include "stackless.h"
+#include "builtins.h"
+#include "eval.h"
+#include "utils.h"
+#include <sys/mman.h>
+
+// Slots of the value stack. The memory is only reserved, pages are backed as
+// the stack grows into them.
+const size_t StacklessStackSize = 1 << 27;
+
+StacklessEvaluator::StacklessEvaluator(std::vector<Node *> &body) {
+  std::vector<std::string> params;
+  program = new FunctionObject(body, params);
+  resolve_slots(program);
+  void *memory = mmap(nullptr, StacklessStackSize * sizeof(Object *),
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw EvalError("unable to reserve the value stack");
+  }
+  stack = (Object **)memory;
+  heap.root_ranges.push_back(RootRange{stack, &top});
+
+  for (int i = 0; i < program->num_slots; i++) {
+    push(nullptr);
+  }
+  frames.push_back(StacklessFrame{0, 0, program});
+  Task task{TaskBlock};
+  task.block = &program->body;
+  task.body = true;
+  tasks.push_back(task);
+}
+
+StacklessEvaluator::~StacklessEvaluator() {
+  for (auto it = heap.root_ranges.begin(); it != heap.root_ranges.end();
+       it++) {
+    if (it->begin == stack) {
+      heap.root_ranges.erase(it);
+      break;
+    }
+  }
+  munmap(stack, StacklessStackSize * sizeof(Object *));
+}
+
+void StacklessEvaluator::push(Object *obj) {
+  if (top == StacklessStackSize) {
+    throw EvalError("stack overflow");
+  }
+  stack[top++] = obj;
+}
+
+Object *StacklessEvaluator::pop() { return stack[--top]; }
+
+void StacklessEvaluator::push_task(TaskKind kind, Node *node) {
+  Task task{kind};
+  task.node = node;
+  tasks.push_back(task);
+}
+
+Object *&StacklessEvaluator::slot(Identifier *ident) {
+  return stack[frames.back().base + ident->slot];
+}
+
+// Functions defined in the running function, then the top-level ones, like
+// Environment::get_function().
+FunctionObject *StacklessEvaluator::find_function(CallExpression *callNode) {
+  std::string &name = callNode->callee.name;
+  FunctionObject *funcObj = nullptr;
+  for (auto frame : {&frames.back(), &frames.front()}) {
+    auto func = frame->functions.find(name);
+    if (func != frame->functions.end()) {
+      funcObj = func->second;
+      break;
+    }
+  }
+  if (funcObj == nullptr) {
+    throw EvalError("function " + name + " not defined");
+  }
+  if (callNode->args.size() != funcObj->params.size()) {
+    throw EvalError("invalid number of arguments");
+  }
+  return funcObj;
+}
+
+// Runs at most `statements` statements. Returns true once the program has
+// finished, false if it stopped early; calling it again continues with the
+// next statement.
+bool StacklessEvaluator::run(size_t statements) {
+  while (!tasks.empty()) {
+    Task task = tasks.back();
+    tasks.pop_back();
+    switch (task.kind) {
+    case TaskBlock: {
+      if (task.index >= task.block->size()) {
+        break;
+      }
+      if (statements == 0) {
+        tasks.push_back(task);
+        return false;
+      }
+      statements--;
+      eval_steps++;
+      if (heap.no_gc_depth == 0) {
+        heap.safepoint();
+      }
+      Node *node = (*task.block)[task.index];
+      task.index++;
+      if (node->statement_type() != "MemberExpression") {
+        tasks.push_back(task);
+      }
+      statement(node, task.body);
+      break;
+    }
+    case TaskEval: {
+      expression(task.node);
+      break;
+    }
+    case TaskBinary: {
+      Object *right = pop();
+      Object *left = pop();
+      BinaryExpression *bNode = (BinaryExpression *)task.node;
+      push(evaluate_operator(left, right, bNode->op));
+      break;
+    }
+    case TaskLet: {
+      slot(&((LetStatement *)task.node)->ident) = pop();
+      break;
+    }
+    case TaskAssign: {
+      slot(&((AssignmentExpression *)task.node)->ident) = pop();
+      break;
+    }
+    case TaskIf: {
+      IfStatement *ifNode = (IfStatement *)task.node;
+      Task block{TaskBlock};
+      if (pop()->is_truthy()) {
+        block.block = &ifNode->consequent;
+      } else if (ifNode->alternate.size() > 0) {
+        block.block = &ifNode->alternate;
+      } else {
+        break;
+      }
+      tasks.push_back(block);
+      break;
+    }
+    case TaskWhile: {
+      push_task(TaskWhileTest, task.node);
+      push_task(TaskEval, ((WhileStatement *)task.node)->condition);
+      break;
+    }
+    case TaskWhileTest: {
+      if (pop()->is_truthy()) {
+        push_task(TaskWhile, task.node);
+        Task block{TaskBlock};
+        block.block = &((WhileStatement *)task.node)->block;
+        tasks.push_back(block);
+      }
+      break;
+    }
+    case TaskCall: {
+      call(task);
+      break;
+    }
+    case TaskCallBuiltin: {
+      CallExpression *callNode = (CallExpression *)task.node;
+      size_t argc = callNode->args.size();
+      std::vector<Object *> args(stack + top - argc, stack + top);
+      top -= argc;
+      push(BuiltinFunctions.at(callNode->callee.name)(args));
+      break;
+    }
+    case TaskTailCall: {
+      tail_call(task);
+      break;
+    }
+    case TaskCallReturn: {
+      finish_call();
+      break;
+    }
+    case TaskReturn: {
+      return_value(pop());
+      break;
+    }
+    case TaskArray: {
+      size_t size = ((ArrayExpression *)task.node)->elements.size();
+      std::vector<Object *> arr(stack + top - size, stack + top);
+      top -= size;
+      push(new ArrayObject(arr));
+      break;
+    }
+    case TaskIndex: {
+      MemberExpression *memNode = (MemberExpression *)task.node;
+      Object *prop = pop();
+      ArrayObject *value =
+          (ArrayObject *)slot((Identifier *)memNode->object);
+      if (value == nullptr) {
+        throw EvalError("object not defined");
+      }
+      if (prop->type() != IntType) {
+        throw EvalError("invalid property type");
+      }
+      int index = ((IntegerObject *)prop)->value;
+      if (index < 0 || index >= value->elements.size()) {
+        throw EvalError("index out of bounds");
+      }
+      push(value->elements[index]);
+      break;
+    }
+    case TaskDiscard: {
+      pop();
+      break;
+    }
+    }
+  }
+  return true;
+}
+
+// Schedules a statement. A bare index statement ends its block: it returns
+// its value from a function or program body and is discarded elsewhere.
+void StacklessEvaluator::statement(Node *node, bool body) {
+  std::string type = node->statement_type();
+  if (type == "LetStatement") {
+    LetStatement *letNode = (LetStatement *)node;
+    if (slot(&letNode->ident) != nullptr) {
+      throw EvalError("variable already defined: " + letNode->ident.name);
+    }
+    push_task(TaskLet, node);
+    push_task(TaskEval, letNode->value);
+  } else if (type == "AssignmentExpression") {
+    AssignmentExpression *assNode = (AssignmentExpression *)node;
+    if (slot(&assNode->ident) == nullptr) {
+      throw EvalError("variable not defined");
+    }
+    push_task(TaskAssign, node);
+    push_task(TaskEval, assNode->value);
+  } else if (type == "IfStatement") {
+    push_task(TaskIf, node);
+    push_task(TaskEval, ((IfStatement *)node)->condition);
+  } else if (type == "WhileStatement") {
+    push_task(TaskWhile, node);
+  } else if (type == "FunctionStatement") {
+    FunctionStatement *funcNode = (FunctionStatement *)node;
+    std::string name = funcNode->ident.name;
+    auto &functions = frames.back().functions;
+    if (functions.find(name) != functions.end()) {
+      throw EvalError("function already defined");
+    }
+    std::vector<std::string> params_vec;
+    for (auto param : funcNode->params) {
+      params_vec.push_back(param->name);
+    }
+    FunctionObject *funcObj = new FunctionObject(funcNode->block, params_vec);
+    resolve_slots(funcObj);
+    functions[name] = funcObj;
+  } else if (type == "CallExpression") {
+    push_task(TaskDiscard);
+    push_task(TaskEval, node);
+  } else if (type == "ReturnStatement") {
+    ReturnStatement *retNode = (ReturnStatement *)node;
+    if (retNode->tail_call && frames.size() > 1) {
+      CallExpression *callNode = (CallExpression *)retNode->value;
+      Task task{TaskTailCall};
+      task.func = find_function(callNode);
+      tasks.push_back(task);
+      for (auto arg = callNode->args.rbegin(); arg != callNode->args.rend();
+           arg++) {
+        push_task(TaskEval, *arg);
+      }
+    } else {
+      push_task(TaskReturn);
+      push_task(TaskEval, retNode->value);
+    }
+  } else if (type == "MemberExpression") {
+    push_task(body ? TaskReturn : TaskDiscard);
+    push_task(TaskEval, node);
+  }
+}
+
+// Evaluates literals and identifiers right away and schedules the rest with
+// their operands first, leaving the value on the stack.
+void StacklessEvaluator::expression(Node *node) {
+  eval_steps++;
+  std::string type = node->statement_type();
+  if (type == "BinaryExpression") {
+    BinaryExpression *bNode = (BinaryExpression *)node;
+    push_task(TaskBinary, node);
+    push_task(TaskEval, bNode->right);
+    push_task(TaskEval, bNode->left);
+  } else if (type == "Literal") {
+    Object *obj = get_obj_from_literal((Literal *)node);
+    if (obj == nullptr) {
+      throw EvalError("invalid literal type " + ((Literal *)node)->type);
+    }
+    push(obj);
+  } else if (type == "Identifier") {
+    Object *obj = slot((Identifier *)node);
+    if (obj == nullptr) {
+      throw EvalError("undefined identifier: " + ((Identifier *)node)->name);
+    }
+    push(obj);
+  } else if (type == "CallExpression") {
+    CallExpression *callNode = (CallExpression *)node;
+    if (BuiltinFunctions.find(callNode->callee.name) !=
+        BuiltinFunctions.end()) {
+      push_task(TaskCallBuiltin, node);
+    } else {
+      Task task{TaskCall, node};
+      task.func = find_function(callNode);
+      tasks.push_back(task);
+    }
+    for (auto arg = callNode->args.rbegin(); arg != callNode->args.rend();
+         arg++) {
+      push_task(TaskEval, *arg);
+    }
+  } else if (type == "ArrayExpression") {
+    std::vector<Node *> &elements = ((ArrayExpression *)node)->elements;
+    push_task(TaskArray, node);
+    for (auto elem = elements.rbegin(); elem != elements.rend(); elem++) {
+      push_task(TaskEval, *elem);
+    }
+  } else if (type == "MemberExpression") {
+    push_task(TaskIndex, node);
+    push_task(TaskEval, ((MemberExpression *)node)->property);
+  } else {
+    throw EvalError("invalid initialization value " + type);
+  }
+}
+
+// The arguments on top of the stack become the first slots of the frame.
+void StacklessEvaluator::call(Task &task) {
+  FunctionObject *funcObj = task.func;
+  size_t base = top - funcObj->params.size();
+  while (top < base + funcObj->num_slots) {
+    push(nullptr);
+  }
+  push_task(TaskCallReturn);
+  frames.push_back(StacklessFrame{base, tasks.size(), funcObj});
+  Task block{TaskBlock};
+  block.block = &funcObj->body;
+  block.body = true;
+  tasks.push_back(block);
+}
+
+// Moves the arguments down into the frame of the returning function and
+// runs the callee in it.
+void StacklessEvaluator::tail_call(Task &task) {
+  StacklessFrame &frame = frames.back();
+  FunctionObject *funcObj = task.func;
+  size_t argc = funcObj->params.size();
+  std::copy(stack + top - argc, stack + top, stack + frame.base);
+  top = frame.base + argc;
+  while (top < frame.base + funcObj->num_slots) {
+    push(nullptr);
+  }
+  tasks.resize(frame.depth);
+  frame.func = funcObj;
+  frame.functions.clear();
+  Task block{TaskBlock};
+  block.block = &funcObj->body;
+  block.body = true;
+  tasks.push_back(block);
+}
+
+void StacklessEvaluator::finish_call() {
+  Object *result = frames.back().result;
+  top = frames.back().base;
+  frames.pop_back();
+  push(result);
+}
+
+// Drops the rest of the running function, or of the whole program.
+void StacklessEvaluator::return_value(Object *value) {
+  StacklessFrame &frame = frames.back();
+  frame.result = value;
+  tasks.resize(frame.depth);
+}
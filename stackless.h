@@ -0,0 +1,81 @@
+#include "ast.h"
+#include "common.h"
+
+#ifndef stackless_h
+#define stackless_h
+
+enum TaskKind {
+  TaskBlock,
+  TaskEval,
+  TaskBinary,
+  TaskLet,
+  TaskAssign,
+  TaskIf,
+  TaskWhile,
+  TaskWhileTest,
+  TaskCall,
+  TaskCallBuiltin,
+  TaskTailCall,
+  TaskCallReturn,
+  TaskReturn,
+  TaskArray,
+  TaskIndex,
+  TaskDiscard,
+};
+
+// One unit of pending work. Blocks carry the index of their next statement,
+// `body` marks the block of a function or of the program itself.
+class Task {
+public:
+  TaskKind kind;
+  Node *node = nullptr;
+  std::vector<Node *> *block = nullptr;
+  size_t index = 0;
+  bool body = false;
+  FunctionObject *func = nullptr;
+};
+
+// A function call: its slots start at `base` on the value stack and
+// `depth` is the size of the task stack with its TaskCallReturn on top.
+class StacklessFrame {
+public:
+  size_t base;
+  size_t depth;
+  FunctionObject *func;
+  Object *result = nullptr;
+  std::unordered_map<std::string, FunctionObject *> functions;
+};
+
+// Evaluates a program like evaluate() but without recursing in C++: pending
+// work is kept on an explicit task stack, intermediate values and the frames
+// of script functions on a value stack that is a GC root. Script recursion
+// is only limited by memory, and run() can stop after any statement and be
+// called again to continue, so several programs can take turns on one
+// thread.
+class StacklessEvaluator {
+public:
+  StacklessEvaluator(std::vector<Node *> &program);
+  ~StacklessEvaluator();
+  bool run(size_t statements);
+
+private:
+  void statement(Node *node, bool body);
+  void expression(Node *node);
+  void call(Task &task);
+  void tail_call(Task &task);
+  void finish_call();
+  void return_value(Object *value);
+  FunctionObject *find_function(CallExpression *callNode);
+  Object *&slot(Identifier *ident);
+  void push(Object *obj);
+  Object *pop();
+  void push_task(TaskKind kind, Node *node = nullptr);
+
+  FunctionObject *program;
+  std::vector<Task> tasks;
+  std::vector<StacklessFrame> frames;
+  Object **stack;
+  size_t top = 0;
+};
+
+#endif // !stackless_h
@@ -0,0 +1,587 @@
+#include "trace.h"
+#include "eval.h"
+#include "utils.h"
+#include <deque>
+#include <tuple>
+
+TraceJit *trace_jit = nullptr;
+
+const int MaxTracePaths = 16;
+
+// Thrown to give up on a recording. With retry the loop is only about to
+// end, it can be recorded on a later iteration.
+class TraceAbort {
+public:
+  bool retry = false;
+};
+
+static bool traceable_op(TokenType op) {
+  return op == Plus || op == Minus || op == Mul || op == Div || op == Mod ||
+         op == And || op == Or || op == Lt || op == Lte || op == Gt ||
+         op == Gte || op == Equal || op == NotEqual;
+}
+
+// Records one iteration without side effects: expressions are evaluated on
+// the recorded values, assignments only change what later reads see.
+class TraceRecorder {
+public:
+  Trace *trace;
+  Environment *env;
+  TracePath path;
+  std::vector<int64_t> values;
+  std::unordered_map<std::string, int> loads;
+  std::unordered_map<std::string, int> assigned;
+  std::unordered_map<int, bool> guarded;
+
+  int emit(TraceInstr instr, int64_t value) {
+    path.instrs.push_back(instr);
+    values.push_back(value);
+    return path.instrs.size() - 1;
+  }
+
+  int constant(int64_t value, DataType kind) {
+    TraceInstr instr{TraceConst};
+    instr.value = value;
+    instr.kind = kind;
+    return emit(instr, value);
+  }
+
+  bool is_const(int ref) { return path.instrs[ref].op == TraceConst; }
+
+  int var(Identifier *ident, DataType type, bool read) {
+    for (int i = 0; i < trace->vars.size(); i++) {
+      TraceVar &var = trace->vars[i];
+      if (var.ident->name != ident->name) {
+        continue;
+      }
+      if (read) {
+        if (var.read && var.type != type) {
+          throw TraceAbort();
+        }
+        var.read = true;
+        var.type = type;
+      }
+      return i;
+    }
+    trace->vars.push_back(TraceVar{ident, type, read});
+    return trace->vars.size() - 1;
+  }
+
+  int load(Identifier *ident) {
+    auto ref = assigned.find(ident->name);
+    if (ref != assigned.end()) {
+      return ref->second;
+    }
+    ref = loads.find(ident->name);
+    if (ref != loads.end()) {
+      return ref->second;
+    }
+    Object *obj = env->get(ident);
+    if (obj == nullptr ||
+        (obj->type() != IntType && obj->type() != BoolType)) {
+      throw TraceAbort();
+    }
+    TraceInstr instr{TraceLoad};
+    instr.a = var(ident, obj->type(), true);
+    instr.kind = obj->type();
+    int64_t value = obj->type() == IntType ? ((IntegerObject *)obj)->value
+                                           : ((BoolObject *)obj)->value;
+    loads[ident->name] = emit(instr, value);
+    return loads[ident->name];
+  }
+
+  int binary(TokenType op, int left, int right) {
+    if (!traceable_op(op)) {
+      throw TraceAbort();
+    }
+    if ((op == Div || op == Mod) &&
+        (values[right] == 0 ||
+         (values[left] == INT32_MIN && values[right] == -1))) {
+      throw TraceAbort();
+    }
+    int64_t value =
+        evaluate_primary_op((int)values[left], (int)values[right], op);
+    if (is_const(left) && is_const(right)) {
+      return constant(value, IntType);
+    }
+    TraceInstr instr{TraceBinary};
+    instr.binop = op;
+    instr.a = left;
+    instr.b = right;
+    return emit(instr, value);
+  }
+
+  int index(MemberExpression *node) {
+    Identifier *ident = (Identifier *)node->object;
+    if (node->object->statement_type() != "Identifier" ||
+        assigned.find(ident->name) != assigned.end()) {
+      throw TraceAbort();
+    }
+    int prop = expression(node->property);
+    ArrayObject *arr = (ArrayObject *)env->get(ident);
+    if (arr == nullptr || arr->type() != ArrayType ||
+        path.instrs[prop].kind != IntType || values[prop] < 0 ||
+        values[prop] >= arr->elements.size()) {
+      throw TraceAbort();
+    }
+    Object *element = arr->elements[values[prop]];
+    if (element == nullptr || element->type() != IntType) {
+      throw TraceAbort();
+    }
+    TraceInstr instr{TraceIndex};
+    instr.a = var(ident, ArrayType, true);
+    instr.b = prop;
+    return emit(instr, ((IntegerObject *)element)->value);
+  }
+
+  int expression(Node *node) {
+    std::string type = node->statement_type();
+    if (type == "Literal") {
+      Literal *literal = (Literal *)node;
+      if (literal->data_type == IntType) {
+        return constant(std::stoi(literal->value), IntType);
+      }
+      if (literal->data_type == BoolType) {
+        return constant(literal->value == "true", BoolType);
+      }
+    } else if (type == "Identifier") {
+      return load((Identifier *)node);
+    } else if (type == "BinaryExpression") {
+      BinaryExpression *bNode = (BinaryExpression *)node;
+      int left = expression(bNode->left);
+      int right = expression(bNode->right);
+      return binary(bNode->op.type, left, right);
+    } else if (type == "MemberExpression") {
+      return index((MemberExpression *)node);
+    }
+    throw TraceAbort();
+  }
+
+  // Guards on constants and on values that were guarded before are left
+  // out.
+  void guard(int ref, bool truthy) {
+    if (is_const(ref) || guarded.find(ref) != guarded.end()) {
+      return;
+    }
+    guarded[ref] = truthy;
+    TraceInstr instr{TraceGuard};
+    instr.a = ref;
+    instr.b = truthy;
+    emit(instr, truthy);
+  }
+
+  void block(std::vector<Node *> &nodes) {
+    for (auto node : nodes) {
+      std::string type = node->statement_type();
+      if (type == "AssignmentExpression") {
+        AssignmentExpression *assNode = (AssignmentExpression *)node;
+        if (assigned.find(assNode->ident.name) == assigned.end() &&
+            env->get(&assNode->ident) == nullptr) {
+          throw TraceAbort();
+        }
+        int value = expression(assNode->value);
+        int slot = var(&assNode->ident, path.instrs[value].kind, false);
+        if (assigned.find(assNode->ident.name) == assigned.end()) {
+          path.stores.push_back({slot, value});
+        }
+        for (auto &store : path.stores) {
+          if (store.first == slot) {
+            store.second = value;
+          }
+        }
+        assigned[assNode->ident.name] = value;
+      } else if (type == "IfStatement") {
+        IfStatement *ifNode = (IfStatement *)node;
+        int condition = expression(ifNode->condition);
+        bool truthy = values[condition] != 0;
+        guard(condition, truthy);
+        block(truthy ? ifNode->consequent : ifNode->alternate);
+      } else {
+        throw TraceAbort();
+      }
+    }
+  }
+
+  void record(WhileStatement *loop) {
+    int condition = expression(loop->condition);
+    if (values[condition] == 0) {
+      TraceAbort abort;
+      abort.retry = true;
+      throw abort;
+    }
+    guard(condition, true);
+    block(loop->block);
+  }
+};
+
+// Variables that are read must keep their type over an iteration, whatever
+// path it takes.
+static bool stable_types(Trace *trace) {
+  for (auto &path : trace->paths) {
+    for (auto &store : path.stores) {
+      TraceVar &var = trace->vars[store.first];
+      if (var.read && path.instrs[store.second].kind != var.type) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool same_instr(TraceInstr &x, TraceInstr &y) {
+  return x.op == y.op && x.a == y.a && x.b == y.b && x.binop == y.binop &&
+         x.value == y.value && x.kind == y.kind;
+}
+
+TraceJit::TraceJit() {
+  IntegerObject *probe = IntegerObject::make(0);
+  int_vtable = *(const void **)probe;
+  int_value_offset = (char *)&probe->value - (char *)probe;
+}
+
+bool TraceJit::record(Trace *trace, WhileStatement *loop, Environment *env,
+                      int parent, int fork) {
+  std::vector<TraceVar> vars = trace->vars;
+  TraceRecorder recorder;
+  recorder.trace = trace;
+  recorder.env = env;
+  try {
+    recorder.record(loop);
+  } catch (TraceAbort &abort) {
+    trace->vars = vars;
+    if (parent < 0 && !abort.retry) {
+      loop->untraceable = true;
+    }
+    return false;
+  }
+  TracePath &path = recorder.path;
+  if (parent >= 0) {
+    // The new path has to agree with its parent up to the failed guard.
+    TracePath &from = trace->paths[parent];
+    bool forked = path.instrs.size() > fork &&
+                  from.instrs[fork].op == TraceGuard &&
+                  path.instrs[fork].op == TraceGuard &&
+                  path.instrs[fork].a == from.instrs[fork].a &&
+                  path.instrs[fork].b != from.instrs[fork].b;
+    for (int i = 0; forked && i < fork; i++) {
+      forked = same_instr(path.instrs[i], from.instrs[i]);
+    }
+    if (!forked) {
+      trace->vars = vars;
+      return false;
+    }
+    path.parent = parent;
+    path.fork = fork;
+  }
+  trace->paths.push_back(path);
+  if (!stable_types(trace)) {
+    trace->paths.pop_back();
+    trace->vars = vars;
+    if (parent < 0) {
+      loop->untraceable = true;
+    }
+    return false;
+  }
+  return true;
+}
+
+// Native code layout: rbx points at the slots, two per variable (the
+// unboxed value, or element pointer and length for arrays; for assigned
+// variables the second one receives the kind of the assigned value), then a
+// scratch slot per store and a slot per instruction.
+class TraceCompiler {
+public:
+  Trace *trace;
+  Assembler as;
+  Label loop;
+  Label exit;
+  std::deque<Label> labels;
+  std::vector<std::tuple<int, int, Label *>> pending;
+  int scratch_base;
+  int temp_base;
+  const void *int_vtable;
+  int32_t int_value_offset;
+
+  Mem value(int var) { return Mem(RBX, var * 16); }
+  Mem second(int var) { return Mem(RBX, var * 16 + 8); }
+  Mem scratch(int i) { return Mem(RBX, (scratch_base + i) * 8); }
+  Mem temp(int ref) { return Mem(RBX, (temp_base + ref) * 8); }
+
+  void load(Reg reg, TracePath &path, int ref) {
+    TraceInstr &instr = path.instrs[ref];
+    if (instr.op == TraceConst) {
+      as.mov_imm64(reg, instr.value);
+    } else if (instr.op == TraceLoad) {
+      as.mov(reg, value(instr.a));
+    } else {
+      as.mov(reg, temp(ref));
+    }
+  }
+
+  Label &side_exit(int path, int ref) {
+    labels.emplace_back();
+    pending.push_back({path, ref, &labels.back()});
+    return labels.back();
+  }
+
+  void binary(int p, int ref) {
+    TracePath &path = trace->paths[p];
+    TraceInstr &instr = path.instrs[ref];
+    load(RAX, path, instr.a);
+    load(RCX, path, instr.b);
+    switch (instr.binop) {
+    case Plus: {
+      as.add(RAX, RCX);
+      as.movsxd(RAX, RAX);
+      break;
+    }
+    case Minus: {
+      as.sub(RAX, RCX);
+      as.movsxd(RAX, RAX);
+      break;
+    }
+    case Mul: {
+      as.imul(RAX, RCX);
+      as.movsxd(RAX, RAX);
+      break;
+    }
+    case Div:
+    case Mod: {
+      as.test(RCX, RCX);
+      as.jcc(CondEqual, side_exit(p, ref));
+      as.cqo();
+      as.idiv(RCX);
+      if (instr.binop == Div) {
+        as.movsxd(RAX, RAX);
+      } else {
+        as.mov(RAX, RDX);
+      }
+      break;
+    }
+    case And:
+    case Or: {
+      as.test(RAX, RAX);
+      as.setcc(CondNotEqual, RAX);
+      as.movzx8(RAX, RAX);
+      as.test(RCX, RCX);
+      as.setcc(CondNotEqual, RCX);
+      as.movzx8(RCX, RCX);
+      if (instr.binop == And) {
+        as.and_(RAX, RCX);
+      } else {
+        as.or_(RAX, RCX);
+      }
+      break;
+    }
+    default: {
+      Cond cond = instr.binop == Lt    ? CondLess
+                  : instr.binop == Lte ? CondLessEqual
+                  : instr.binop == Gt  ? CondGreater
+                  : instr.binop == Gte ? CondGreaterEqual
+                  : instr.binop == Equal ? CondEqual
+                                         : CondNotEqual;
+      as.cmp(RAX, RCX);
+      as.setcc(cond, RAX);
+      as.movzx8(RAX, RAX);
+      break;
+    }
+    }
+    as.mov(temp(ref), RAX);
+  }
+
+  void index(int p, int ref) {
+    TracePath &path = trace->paths[p];
+    TraceInstr &instr = path.instrs[ref];
+    Label &fail = side_exit(p, ref);
+    load(RCX, path, instr.b);
+    as.mov(RAX, second(instr.a));
+    as.cmp(RCX, RAX);
+    as.jcc(CondAboveEqual, fail);
+    as.mov(RAX, value(instr.a));
+    as.mov(RAX, Mem(RAX, RCX, 0));
+    as.test(RAX, RAX);
+    as.jcc(CondEqual, fail);
+    as.mov(RDX, Mem(RAX));
+    as.mov_imm64(RSI, (uint64_t)int_vtable);
+    as.cmp(RDX, RSI);
+    as.jcc(CondNotEqual, fail);
+    as.movsxd(RAX, Mem(RAX, int_value_offset));
+    as.mov(temp(ref), RAX);
+  }
+
+  // Emits path p from instruction from on, then commits its stores and
+  // goes around the loop.
+  void emit_path(int p, int from) {
+    TracePath &path = trace->paths[p];
+    for (int ref = from; ref < path.instrs.size(); ref++) {
+      TraceInstr &instr = path.instrs[ref];
+      switch (instr.op) {
+      case TraceBinary: {
+        binary(p, ref);
+        break;
+      }
+      case TraceIndex: {
+        index(p, ref);
+        break;
+      }
+      case TraceGuard: {
+        load(RAX, path, instr.a);
+        as.test(RAX, RAX);
+        as.jcc(instr.b ? CondEqual : CondNotEqual, side_exit(p, ref));
+        break;
+      }
+      default: {
+        break;
+      }
+      }
+    }
+    for (int i = 0; i < path.stores.size(); i++) {
+      load(RAX, path, path.stores[i].second);
+      as.mov(scratch(i), RAX);
+    }
+    for (int i = 0; i < path.stores.size(); i++) {
+      int var = path.stores[i].first;
+      as.mov(RAX, scratch(i));
+      as.mov(value(var), RAX);
+      as.mov(second(var), path.instrs[path.stores[i].second].kind);
+    }
+    as.jmp(loop);
+  }
+
+  // Side exits continue in the side path forked at them if there is one.
+  void emit_exits() {
+    for (int i = 0; i < pending.size(); i++) {
+      auto [p, ref, label] = pending[i];
+      as.bind(*label);
+      int child = -1;
+      for (int c = 0; c < trace->paths.size(); c++) {
+        if (trace->paths[c].parent == p && trace->paths[c].fork == ref) {
+          child = c;
+        }
+      }
+      if (child >= 0) {
+        emit_path(child, ref + 1);
+      } else {
+        as.mov_imm32(RAX, trace->exits.size());
+        as.jmp(exit);
+        trace->exits.push_back({p, ref});
+      }
+    }
+  }
+
+  void compile() {
+    int stores = 0;
+    int instrs = 0;
+    for (auto &path : trace->paths) {
+      stores = std::max(stores, (int)path.stores.size());
+      instrs = std::max(instrs, (int)path.instrs.size());
+    }
+    scratch_base = trace->vars.size() * 2;
+    temp_base = scratch_base + stores;
+    trace->slots.resize(temp_base + instrs);
+    trace->exits.clear();
+
+    as.push(RBX);
+    as.mov(RBX, RDI);
+    as.bind(loop);
+    emit_path(0, 0);
+    emit_exits();
+    as.bind(exit);
+    as.pop(RBX);
+    as.ret();
+  }
+};
+
+bool TraceJit::compile(Trace *trace) {
+#ifdef __x86_64__
+  TraceCompiler compiler;
+  compiler.trace = trace;
+  compiler.int_vtable = int_vtable;
+  compiler.int_value_offset = int_value_offset;
+  compiler.compile();
+  uint8_t *memory = compiler.as.install();
+  if (memory == nullptr) {
+    return false;
+  }
+  if (trace->memory != nullptr) {
+    uninstall(trace->memory, trace->size);
+  }
+  trace->memory = memory;
+  trace->size = compiler.as.code.size();
+  trace->entry = (int (*)(int64_t *))memory;
+  compiled_paths++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void TraceJit::loop(WhileStatement *loop, Environment *env) {
+  if (loop->trace == nullptr) {
+    if (loop->untraceable || ++loop->hotness < threshold) {
+      return;
+    }
+    Trace *trace = new Trace();
+    if (!record(trace, loop, env, -1, -1)) {
+      delete trace;
+      return;
+    }
+    if (!compile(trace)) {
+      delete trace;
+      loop->untraceable = true;
+      return;
+    }
+    loop->trace = trace;
+  }
+  run(loop->trace, loop, env);
+}
+
+// Enters the trace if the variables have the recorded types and boxes the
+// assigned ones back into env once it exits.
+void TraceJit::run(Trace *trace, WhileStatement *loop, Environment *env) {
+  int64_t *slots = trace->slots.data();
+  for (int i = 0; i < trace->vars.size(); i++) {
+    TraceVar &var = trace->vars[i];
+    Object *obj = env->get(var.ident);
+    if (obj == nullptr || (var.read && obj->type() != var.type)) {
+      return;
+    }
+    slots[i * 2 + 1] = -1;
+    if (!var.read) {
+      continue;
+    }
+    if (var.type == IntType) {
+      slots[i * 2] = ((IntegerObject *)obj)->value;
+    } else if (var.type == BoolType) {
+      slots[i * 2] = ((BoolObject *)obj)->value;
+    } else {
+      slots[i * 2] = (int64_t)((ArrayObject *)obj)->elements.data();
+      slots[i * 2 + 1] = ((ArrayObject *)obj)->elements.size();
+    }
+  }
+  int exit = trace->entry(slots);
+  for (int i = 0; i < trace->vars.size(); i++) {
+    TraceVar &var = trace->vars[i];
+    if (var.read && var.type == ArrayType) {
+      continue;
+    }
+    if (slots[i * 2 + 1] == IntType) {
+      env->set(var.ident, IntegerObject::make(slots[i * 2]));
+    } else if (slots[i * 2 + 1] == BoolType) {
+      env->set(var.ident, BoolObject::make(slots[i * 2]));
+    }
+  }
+
+  auto [p, ref] = trace->exits[exit];
+  TraceInstr &instr = trace->paths[p].instrs[ref];
+  if (instr.exits < 0 || ++instr.exits < threshold) {
+    return;
+  }
+  instr.exits = -1;
+  if (trace->paths.size() < MaxTracePaths &&
+      record(trace, loop, env, p, ref)) {
+    if (!compile(trace)) {
+      trace->paths.pop_back();
+    }
+  }
+}
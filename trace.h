@@ -0,0 +1,86 @@
+#include "assembler.h"
+#include "ast.h"
+#include "common.h"
+
+#ifndef trace_h
+#define trace_h
+
+enum TraceOp {
+  TraceConst,  // value
+  TraceLoad,   // var, its value at the start of the iteration
+  TraceBinary, // binop, left ref, right ref
+  TraceIndex,  // array var, index ref
+  TraceGuard,  // ref, expected truthiness
+};
+
+// Trace instructions work on unboxed ints; kind is the type the value would
+// have in the evaluator. Every instruction is its own ref.
+class TraceInstr {
+public:
+  TraceOp op;
+  int a = 0;
+  int b = 0;
+  TokenType binop = Plus;
+  int64_t value = 0;
+  DataType kind = IntType;
+  int exits = 0;
+};
+
+// A variable the trace reads or assigns. Variables that are read keep the
+// type they had when the trace was recorded, which is checked on entry.
+class TraceVar {
+public:
+  Identifier *ident;
+  DataType type;
+  bool read = false;
+};
+
+// One recorded iteration of the loop: the condition, the path taken through
+// the body and the variables assigned at the end of it. A side path repeats
+// its parent up to the guard at fork, which it passed the other way.
+class TracePath {
+public:
+  std::vector<TraceInstr> instrs;
+  std::vector<std::pair<int, int>> stores;
+  int parent = -1;
+  int fork = -1;
+};
+
+class Trace {
+public:
+  std::vector<TraceVar> vars;
+  std::vector<TracePath> paths;
+  std::vector<std::pair<int, int>> exits;
+  std::vector<int64_t> slots;
+  int (*entry)(int64_t *slots) = nullptr;
+  uint8_t *memory = nullptr;
+  size_t size = 0;
+};
+
+// Tracing JIT for the tree walking evaluator. Once a WhileStatement got hot
+// one iteration of it is recorded, following the branches its variables
+// take, and compiled to native code that loops over unboxed values. Guards
+// that fail leave the trace with the Environment as it was at the start of
+// the iteration, which the evaluator then runs; a guard that keeps failing
+// gets a side path of its own.
+class TraceJit {
+public:
+  TraceJit();
+  void loop(WhileStatement *loop, Environment *env);
+
+  int threshold = 1000;
+  size_t compiled_paths = 0;
+
+private:
+  bool record(Trace *trace, WhileStatement *loop, Environment *env,
+              int parent, int fork);
+  bool compile(Trace *trace);
+  void run(Trace *trace, WhileStatement *loop, Environment *env);
+
+  const void *int_vtable;
+  int32_t int_value_offset;
+};
+
+extern TraceJit *trace_jit;
+
+#endif // !trace_h
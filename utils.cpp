@@ -21,10 +21,10 @@ bool is_token_type_bool(TokenType t) {
 Object *get_obj_from_literal(Literal *l) {
   switch (l->data_type) {
   case IntType: {
-    return new IntegerObject(stoi(l->value));
+    return IntegerObject::make(stoi(l->value));
   }
   case BoolType: {
-    return new BoolObject(l->value == "true");
+    return BoolObject::make(l->value == "true");
   }
   case FloatType: {
     return new FloatObject(stof(l->value));
@@ -0,0 +1,345 @@
+#include "vm.h"
+#include "dispatch.h"
+#include "builtins.h"
+#include "eval.h"
+#include "gc.h"
+#include "jit.h"
+
+VM::VM(CompiledProgram *program) : program(program) {
+  capacity = 1 << 20;
+  stack = new Object *[capacity];
+  globals.resize(program->global_names.size(), nullptr);
+  num_globals = globals.size();
+  num_constants = program->constants.size();
+  function_table.resize(program->function_names.size());
+  for (auto &name : program->builtin_names) {
+    builtins.push_back(&BuiltinFunctions.at(name));
+  }
+  heap.root_ranges.push_back(RootRange{globals.data(), &num_globals});
+  heap.root_ranges.push_back(RootRange{program->constants.data(), &num_constants});
+  heap.root_ranges.push_back(RootRange{stack, &sp});
+}
+
+// Translates the code of every function into CodeWords, with the opcodes
+// replaced by their handler addresses when handlers is not null.
+void VM::thread(const void **handlers) {
+  for (auto func : program->functions) {
+    func->threaded.resize(func->code.size());
+    for (int pc = 0; pc < func->code.size();) {
+      int op = func->code[pc];
+      if (handlers != nullptr) {
+        func->threaded[pc].handler = handlers[op];
+      } else {
+        func->threaded[pc].operand = op;
+      }
+      for (int i = 1; i <= opcode_operands(op); i++) {
+        func->threaded[pc + i].operand = func->code[pc + i];
+      }
+      pc += 1 + opcode_operands(op);
+    }
+  }
+}
+
+#ifdef WHIMSIA_THREADED
+#define DISPATCH()                                                             \
+  dispatches++;                                                                \
+  goto *code[pc++].handler
+#else
+#define DISPATCH()                                                             \
+  dispatches++;                                                                \
+  op = code[pc++].operand;                                                     \
+  goto dispatch
+#endif
+
+void VM::run() {
+  frames.push_back(Frame{program->functions[0], 0, 0});
+  if (program->functions[0]->max_stack > capacity) {
+    throw EvalError("stack overflow");
+  }
+  interpret(0);
+  frames.clear();
+}
+
+// Checks the call and sets up the callee's frame over the argc arguments on
+// top of the stack. A tail call replaces the current frame instead.
+CompiledFunction *VM::enter(int name, int argc, bool tail) {
+  if (function_table[name] < 0) {
+    throw EvalError("function " + program->function_names[name] +
+                    " not defined");
+  }
+  CompiledFunction *callee = program->functions[function_table[name]];
+  if (argc != callee->num_params) {
+    throw EvalError("invalid number of arguments");
+  }
+  size_t new_base = sp - argc;
+  if (tail) {
+    function_table.leave(frames.size());
+    Frame &frame = frames.back();
+    std::copy(stack + new_base, stack + sp, stack + frame.base);
+    new_base = frame.base;
+    frame.func = callee;
+    frame.pc = 0;
+  } else {
+    frames.push_back(Frame{callee, 0, new_base});
+  }
+  if (new_base + callee->num_locals + callee->max_stack > capacity) {
+    throw EvalError("stack overflow");
+  }
+  std::fill(stack + new_base + argc, stack + new_base + callee->num_locals,
+            nullptr);
+  sp = new_base + callee->num_locals;
+  return callee;
+}
+
+// Whether func should continue in machine code, compiling it once it is hot.
+bool VM::native(CompiledFunction *func) {
+  if (jit == nullptr || native_depth >= JitMaxNativeDepth) {
+    return false;
+  }
+  if (func->jit_code == nullptr) {
+    if (func->jit_failed || ++func->hotness < jit->threshold) {
+      return false;
+    }
+    jit->compile(func);
+  }
+  return func->jit_code != nullptr;
+}
+
+// Runs the top frame in machine code from pc until it returns. Returns true
+// if the program halted.
+bool VM::run_native(int pc) {
+  JitCode *jit_code = frames.back().func->jit_code;
+  native_depth++;
+  int status = jit_code->entry(this, jit_code->address(pc), frames.back().base);
+  native_depth--;
+  return status == JitHalted;
+}
+
+// Runs the top frame until the frame stack shrinks to stop_depth, or returns
+// true once the program halts.
+bool VM::interpret(size_t stop_depth) {
+#ifdef WHIMSIA_THREADED
+  static const void *handlers[] = {
+      HANDLER_ADDRESS(OpConst),          HANDLER_ADDRESS(OpNull),
+      HANDLER_ADDRESS(OpLoadGlobal),     HANDLER_ADDRESS(OpStoreGlobal),
+      HANDLER_ADDRESS(OpDefineGlobal),   HANDLER_ADDRESS(OpLoadLocal),
+      HANDLER_ADDRESS(OpStoreLocal),     HANDLER_ADDRESS(OpDefineLocal),
+      HANDLER_ADDRESS(OpBinary),         HANDLER_ADDRESS(OpJump),
+      HANDLER_ADDRESS(OpJumpIfFalse),    HANDLER_ADDRESS(OpLoop),
+      HANDLER_ADDRESS(OpCall),           HANDLER_ADDRESS(OpTailCall),
+      HANDLER_ADDRESS(OpCallBuiltin),    HANDLER_ADDRESS(OpReturn),
+      HANDLER_ADDRESS(OpArray),          HANDLER_ADDRESS(OpIndexGlobal),
+      HANDLER_ADDRESS(OpIndexLocal),     HANDLER_ADDRESS(OpPop),
+      HANDLER_ADDRESS(OpDefineFunction), HANDLER_ADDRESS(OpHalt),
+  };
+  if (!threaded) {
+    thread(handlers);
+  }
+#else
+  if (!threaded) {
+    thread(nullptr);
+  }
+#endif
+  threaded = true;
+  CompiledFunction *func;
+  const CodeWord *code;
+  int pc;
+  size_t base;
+#ifndef WHIMSIA_THREADED
+  int op;
+#endif
+  bool tail;
+  Object *indexed;
+resume:
+  func = frames.back().func;
+  code = func->threaded.data();
+  pc = frames.back().pc;
+  base = frames.back().base;
+  DISPATCH();
+#ifndef WHIMSIA_THREADED
+dispatch:
+  switch (op) {
+#endif
+  HANDLER(OpConst) {
+    stack[sp++] = program->constants[code[pc++].operand];
+    DISPATCH();
+  }
+  HANDLER(OpNull) {
+    stack[sp++] = nullptr;
+    DISPATCH();
+  }
+  HANDLER(OpLoadGlobal) {
+    int slot = code[pc++].operand;
+    if (globals[slot] == nullptr) {
+      throw EvalError("undefined identifier: " + program->global_names[slot]);
+    }
+    stack[sp++] = globals[slot];
+    DISPATCH();
+  }
+  HANDLER(OpStoreGlobal) {
+    int slot = code[pc++].operand;
+    if (globals[slot] == nullptr) {
+      throw EvalError("variable not defined");
+    }
+    globals[slot] = stack[--sp];
+    DISPATCH();
+  }
+  HANDLER(OpDefineGlobal) {
+    int slot = code[pc++].operand;
+    if (globals[slot] != nullptr) {
+      throw EvalError("variable already defined: " +
+                      program->global_names[slot]);
+    }
+    globals[slot] = stack[--sp];
+    DISPATCH();
+  }
+  HANDLER(OpLoadLocal) {
+    int slot = code[pc++].operand;
+    if (stack[base + slot] == nullptr) {
+      throw EvalError("undefined identifier: " + func->local_names[slot]);
+    }
+    stack[sp++] = stack[base + slot];
+    DISPATCH();
+  }
+  HANDLER(OpStoreLocal) {
+    int slot = code[pc++].operand;
+    if (stack[base + slot] == nullptr) {
+      throw EvalError("variable not defined");
+    }
+    stack[base + slot] = stack[--sp];
+    DISPATCH();
+  }
+  HANDLER(OpDefineLocal) {
+    int slot = code[pc++].operand;
+    if (stack[base + slot] != nullptr) {
+      throw EvalError("variable already defined: " + func->local_names[slot]);
+    }
+    stack[base + slot] = stack[--sp];
+    DISPATCH();
+  }
+  HANDLER(OpBinary) {
+    Object *right = stack[--sp];
+    stack[sp - 1] = evaluate_operator(stack[sp - 1], right,
+                                      (TokenType)code[pc++].operand);
+    DISPATCH();
+  }
+  HANDLER(OpJump) {
+    pc = code[pc].operand;
+    DISPATCH();
+  }
+  HANDLER(OpJumpIfFalse) {
+    if (!stack[--sp]->is_truthy()) {
+      pc = code[pc].operand;
+    } else {
+      pc++;
+    }
+    DISPATCH();
+  }
+  HANDLER(OpLoop) {
+    pc = code[pc].operand;
+    if (heap.no_gc_depth == 0) {
+      heap.safepoint();
+    }
+    if (native(func)) {
+      if (run_native(pc)) {
+        return true;
+      }
+      if (frames.size() == stop_depth) {
+        return false;
+      }
+      goto resume;
+    }
+    DISPATCH();
+  }
+  HANDLER(OpCall) {
+    tail = false;
+    goto call;
+  }
+  HANDLER(OpTailCall) {
+    tail = true;
+  call:
+    int name = code[pc++].operand;
+    int argc = code[pc++].operand;
+    frames.back().pc = pc;
+    CompiledFunction *callee = enter(name, argc, tail);
+    if (heap.no_gc_depth == 0) {
+      heap.safepoint();
+    }
+    if (native(callee)) {
+      if (run_native(0)) {
+        return true;
+      }
+      if (frames.size() == stop_depth) {
+        return false;
+      }
+    }
+    goto resume;
+  }
+  HANDLER(OpCallBuiltin) {
+    int index = code[pc++].operand;
+    int argc = code[pc++].operand;
+    args.assign(stack + sp - argc, stack + sp);
+    sp -= argc;
+    stack[sp++] = (*builtins[index])(args);
+    DISPATCH();
+  }
+  HANDLER(OpReturn) {
+    Object *ret = stack[sp - 1];
+    function_table.leave(frames.size());
+    frames.pop_back();
+    sp = base;
+    stack[sp++] = ret;
+    if (frames.size() == stop_depth) {
+      return false;
+    }
+    goto resume;
+  }
+  HANDLER(OpArray) {
+    int count = code[pc++].operand;
+    std::vector<Object *> elements(stack + sp - count, stack + sp);
+    sp -= count;
+    stack[sp++] = new ArrayObject(elements);
+    DISPATCH();
+  }
+  HANDLER(OpIndexGlobal) {
+    indexed = globals[code[pc++].operand];
+    goto index;
+  }
+  HANDLER(OpIndexLocal) {
+    indexed = stack[base + code[pc++].operand];
+  index:
+    ArrayObject *value = (ArrayObject *)indexed;
+    Object *prop = stack[sp - 1];
+    if (value == nullptr) {
+      throw EvalError("object not defined");
+    }
+    if (prop->type() != IntType) {
+      throw EvalError("invalid property type");
+    }
+    int index = ((IntegerObject *)prop)->value;
+    if (index < 0 || index >= value->elements.size()) {
+      throw EvalError("index out of bounds");
+    }
+    stack[sp - 1] = value->elements[index];
+    DISPATCH();
+  }
+  HANDLER(OpPop) {
+    sp--;
+    DISPATCH();
+  }
+  HANDLER(OpDefineFunction) {
+    int name = code[pc++].operand;
+    int index = code[pc++].operand;
+    function_table.define(name, index, frames.size());
+    DISPATCH();
+  }
+  HANDLER(OpHalt) {
+    return true;
+  }
+#ifndef WHIMSIA_THREADED
+  default: {
+    throw EvalError("unknown opcode " + std::to_string(op));
+  }
+  }
+#endif
+}
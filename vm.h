@@ -0,0 +1,55 @@
+#include "ast.h"
+#include "bytecode.h"
+#include "common.h"
+
+#ifndef vm_h
+#define vm_h
+
+class Jit;
+
+class Frame {
+public:
+  CompiledFunction *func;
+  int pc;
+  size_t base;
+};
+
+// Stack machine for CompiledProgram. A frame's locals sit at the bottom of
+// its stack window with the operands above them; the globals, the stack and
+// the constant pool are registered as GC root ranges. The code is translated
+// to CodeWords before it runs, see dispatch.h. With a Jit attached, hot
+// functions and loops continue in machine code.
+class VM {
+public:
+  VM(CompiledProgram *program);
+  void run();
+
+  size_t dispatches = 0;
+  Jit *jit = nullptr;
+
+private:
+  friend class Jit;
+
+  void thread(const void **handlers);
+  bool interpret(size_t stop_depth);
+  CompiledFunction *enter(int name, int argc, bool tail);
+  bool native(CompiledFunction *func);
+  bool run_native(int pc);
+
+  CompiledProgram *program;
+  std::vector<Object *> globals;
+  size_t num_globals;
+  size_t num_constants;
+  Object **stack;
+  size_t sp = 0;
+  size_t capacity;
+  std::vector<Frame> frames;
+  FunctionTable function_table;
+  std::vector<const std::function<Object *(std::vector<Object *> &)> *>
+      builtins;
+  std::vector<Object *> args;
+  bool threaded = false;
+  int native_depth = 0;
+};
+
+#endif // !vm_h
@@ -0,0 +1,487 @@
+#include "wsc.h"
+#include "builtins.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+WscError::WscError(std::string err)
+    : error_msg("error while loading bytecode: " + err) {}
+const char *WscError::what() const noexcept { return error_msg.c_str(); }
+
+enum WscHeader {
+  HeaderMagic,
+  HeaderVersion,
+  HeaderOpCount,
+  HeaderStrings,
+  HeaderConstants = HeaderStrings + 2,
+  HeaderGlobals = HeaderConstants + 2,
+  HeaderFunctionNames = HeaderGlobals + 2,
+  HeaderBuiltins = HeaderFunctionNames + 2,
+  HeaderFunctions = HeaderBuiltins + 2,
+  HeaderSize = HeaderFunctions + 2,
+};
+
+const uint32_t WscMagic = 'W' | 'S' << 8 | 'C' << 16;
+const int FunctionRecordSize = 8;
+
+class WscWriter {
+public:
+  std::string out;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint32_t> string_index;
+
+  uint32_t intern(std::string &str) {
+    if (string_index.find(str) == string_index.end()) {
+      string_index[str] = strings.size();
+      strings.push_back(str);
+    }
+    return string_index[str];
+  }
+
+  uint32_t offset() { return out.size(); }
+
+  void put(uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+      out.push_back((char)(word >> (8 * i)));
+    }
+  }
+
+  void patch(uint32_t at, uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+      out[at + i] = (char)(word >> (8 * i));
+    }
+  }
+
+  void put_names(std::vector<std::string> &names, int header) {
+    patch(header * 4, names.size());
+    patch(header * 4 + 4, offset());
+    for (auto &name : names) {
+      put(string_index[name]);
+    }
+  }
+};
+
+void write_wsc(CompiledProgram *program, std::string path) {
+  WscWriter writer;
+  for (auto constant : program->constants) {
+    if (constant->type() == StringType) {
+      writer.intern(((StringObject *)constant)->value);
+    }
+  }
+  for (auto names : {&program->global_names, &program->function_names,
+                     &program->builtin_names}) {
+    for (auto &name : *names) {
+      writer.intern(name);
+    }
+  }
+  for (auto func : program->functions) {
+    writer.intern(func->name);
+    for (auto &name : func->local_names) {
+      writer.intern(name);
+    }
+  }
+
+  for (int i = 0; i < HeaderSize; i++) {
+    writer.put(0);
+  }
+  writer.patch(HeaderMagic * 4, WscMagic);
+  writer.patch(HeaderVersion * 4, WscVersion);
+  writer.patch(HeaderOpCount * 4, OpCount);
+
+  writer.patch(HeaderStrings * 4, writer.strings.size());
+  writer.patch(HeaderStrings * 4 + 4, writer.offset());
+  for (auto &str : writer.strings) {
+    writer.put(str.size());
+    writer.out += str;
+    writer.out.append((4 - str.size() % 4) % 4, '\0');
+  }
+
+  writer.patch(HeaderConstants * 4, program->constants.size());
+  writer.patch(HeaderConstants * 4 + 4, writer.offset());
+  for (auto constant : program->constants) {
+    writer.put(constant->type());
+    switch (constant->type()) {
+    case IntType: {
+      writer.put(((IntegerObject *)constant)->value);
+      break;
+    }
+    case FloatType: {
+      uint32_t bits;
+      memcpy(&bits, &((FloatObject *)constant)->value, 4);
+      writer.put(bits);
+      break;
+    }
+    case BoolType: {
+      writer.put(((BoolObject *)constant)->value);
+      break;
+    }
+    case StringType: {
+      writer.put(writer.string_index[((StringObject *)constant)->value]);
+      break;
+    }
+    default: {
+      throw WscError("unsupported constant " + constant->inspect());
+    }
+    }
+  }
+
+  writer.put_names(program->global_names, HeaderGlobals);
+  writer.put_names(program->function_names, HeaderFunctionNames);
+  writer.put_names(program->builtin_names, HeaderBuiltins);
+
+  writer.patch(HeaderFunctions * 4, program->functions.size());
+  writer.patch(HeaderFunctions * 4 + 4, writer.offset());
+  uint32_t records = writer.offset();
+  for (int i = 0; i < program->functions.size() * FunctionRecordSize; i++) {
+    writer.put(0);
+  }
+  for (int i = 0; i < program->functions.size(); i++) {
+    CompiledFunction *func = program->functions[i];
+    uint32_t record = records + i * FunctionRecordSize * 4;
+    writer.patch(record, writer.string_index[func->name]);
+    writer.patch(record + 4, func->num_params);
+    writer.patch(record + 8, func->num_locals);
+    writer.patch(record + 12, func->max_stack);
+    writer.patch(record + 16, func->code.size());
+    writer.patch(record + 20, writer.offset());
+    for (auto word : func->code) {
+      writer.put(word);
+    }
+    writer.patch(record + 24, func->local_names.size());
+    writer.patch(record + 28, writer.offset());
+    for (auto &name : func->local_names) {
+      writer.put(writer.string_index[name]);
+    }
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    throw WscError("unable to write " + path);
+  }
+  file.write(writer.out.data(), writer.out.size());
+}
+
+class WscReader {
+public:
+  const unsigned char *data;
+  size_t size;
+  std::vector<std::string> strings;
+
+  uint32_t word(size_t at) {
+    if (at + 4 > size || at % 4 != 0) {
+      throw WscError("truncated file");
+    }
+    return data[at] | data[at + 1] << 8 | data[at + 2] << 16 |
+           (uint32_t)data[at + 3] << 24;
+  }
+
+  uint32_t header(int field) { return word(field * 4); }
+
+  std::string &string(uint32_t index) {
+    if (index >= strings.size()) {
+      throw WscError("invalid string index");
+    }
+    return strings[index];
+  }
+
+  std::vector<std::string> names(int field) {
+    std::vector<std::string> result;
+    for (uint32_t i = 0; i < header(field); i++) {
+      result.push_back(string(word(header(field + 1) + i * 4)));
+    }
+    return result;
+  }
+};
+
+// How many values an instruction pops and pushes.
+static void stack_effect(int op, int *code, int &pops, int &pushes) {
+  pops = 0;
+  pushes = 0;
+  switch (op) {
+  case OpConst:
+  case OpNull:
+  case OpLoadGlobal:
+  case OpLoadLocal: {
+    pushes = 1;
+    break;
+  }
+  case OpStoreGlobal:
+  case OpDefineGlobal:
+  case OpStoreLocal:
+  case OpDefineLocal:
+  case OpJumpIfFalse:
+  case OpPop:
+  case OpReturn: {
+    pops = 1;
+    break;
+  }
+  case OpBinary: {
+    pops = 2;
+    pushes = 1;
+    break;
+  }
+  case OpCall:
+  case OpTailCall:
+  case OpCallBuiltin: {
+    pops = code[2];
+    pushes = 1;
+    break;
+  }
+  case OpArray: {
+    pops = code[1];
+    pushes = 1;
+    break;
+  }
+  case OpIndexGlobal:
+  case OpIndexLocal: {
+    pops = 1;
+    pushes = 1;
+    break;
+  }
+  }
+}
+
+static bool ends_flow(int op) {
+  return op == OpJump || op == OpLoop || op == OpTailCall ||
+         op == OpReturn || op == OpHalt;
+}
+
+// Checks that every instruction is complete and only refers to things that
+// exist, that jumps land on instructions, and that along every path the
+// stack never goes below the function's locals or above max_stack and the
+// code never runs off its end. The VM trusts its code.
+static void verify(CompiledProgram *program, CompiledFunction *func) {
+  int size = func->code.size();
+  std::vector<bool> starts(size, false);
+  int last = -1;
+  for (int pc = 0; pc < size;) {
+    int op = func->code[pc];
+    if (op < 0 || op >= OpCount || pc + opcode_operands(op) >= size) {
+      throw WscError("invalid code in function " + func->name);
+    }
+    int operand = opcode_operands(op) > 0 ? func->code[pc + 1] : 0;
+    int limit = 1;
+    switch (op) {
+    case OpConst: {
+      limit = program->constants.size();
+      break;
+    }
+    case OpLoadGlobal:
+    case OpStoreGlobal:
+    case OpDefineGlobal:
+    case OpIndexGlobal: {
+      limit = program->global_names.size();
+      break;
+    }
+    case OpLoadLocal:
+    case OpStoreLocal:
+    case OpDefineLocal:
+    case OpIndexLocal: {
+      limit = func->num_locals;
+      break;
+    }
+    case OpJump:
+    case OpJumpIfFalse:
+    case OpLoop: {
+      limit = size;
+      break;
+    }
+    case OpCall:
+    case OpTailCall:
+    case OpDefineFunction: {
+      limit = program->function_names.size();
+      break;
+    }
+    case OpCallBuiltin: {
+      limit = program->builtin_names.size();
+      break;
+    }
+    case OpBinary: {
+      limit = Eof + 1;
+      break;
+    }
+    case OpArray: {
+      limit = INT32_MAX;
+      break;
+    }
+    }
+    if (operand < 0 || operand >= limit) {
+      throw WscError("invalid operand in function " + func->name);
+    }
+    if ((op == OpCall || op == OpTailCall || op == OpCallBuiltin) &&
+        func->code[pc + 2] < 0) {
+      throw WscError("invalid argument count in function " + func->name);
+    }
+    if (op == OpDefineFunction &&
+        (func->code[pc + 2] <= 0 ||
+         func->code[pc + 2] >= program->functions.size())) {
+      throw WscError("invalid function index in function " + func->name);
+    }
+    starts[pc] = true;
+    last = pc;
+    pc += 1 + opcode_operands(op);
+  }
+  if (last < 0 || !ends_flow(func->code[last])) {
+    throw WscError("code does not end in function " + func->name);
+  }
+
+  // The stack depth every reachable instruction starts with has to be the
+  // same along all the paths to it.
+  std::vector<int> depths(size, -1);
+  std::vector<int> worklist = {0};
+  depths[0] = 0;
+  while (!worklist.empty()) {
+    int pc = worklist.back();
+    worklist.pop_back();
+    int *code = &func->code[pc];
+    int op = code[0];
+    int pops, pushes;
+    stack_effect(op, code, pops, pushes);
+    int depth = depths[pc];
+    if (pops > depth || depth - pops + pushes > func->max_stack) {
+      throw WscError("invalid stack use in function " + func->name);
+    }
+    depth += pushes - pops;
+    std::vector<int> next;
+    if (op == OpJump || op == OpJumpIfFalse || op == OpLoop) {
+      next.push_back(code[1]);
+    }
+    if (!ends_flow(op)) {
+      next.push_back(pc + 1 + opcode_operands(op));
+    }
+    for (auto target : next) {
+      if (target >= size || !starts[target]) {
+        throw WscError("invalid jump target in function " + func->name);
+      }
+      if (depths[target] < 0) {
+        depths[target] = depth;
+        worklist.push_back(target);
+      } else if (depths[target] != depth) {
+        throw WscError("invalid stack use in function " + func->name);
+      }
+    }
+  }
+}
+
+static CompiledProgram *read_program(WscReader &reader) {
+  if (reader.header(HeaderMagic) != WscMagic) {
+    throw WscError("not a compiled whimsia program");
+  }
+  if (reader.header(HeaderVersion) != WscVersion ||
+      reader.header(HeaderOpCount) != OpCount) {
+    throw WscError("compiled by an incompatible version, recompile it");
+  }
+  uint32_t at = reader.header(HeaderStrings + 1);
+  for (uint32_t i = 0; i < reader.header(HeaderStrings); i++) {
+    uint32_t length = reader.word(at);
+    if (at + 4 + length > reader.size) {
+      throw WscError("truncated file");
+    }
+    reader.strings.push_back(
+        std::string((const char *)reader.data + at + 4, length));
+    at += 4 + (length + 3) / 4 * 4;
+  }
+
+  CompiledProgram *program = new CompiledProgram();
+  at = reader.header(HeaderConstants + 1);
+  for (uint32_t i = 0; i < reader.header(HeaderConstants); i++) {
+    uint32_t value = reader.word(at + i * 8 + 4);
+    switch (reader.word(at + i * 8)) {
+    case IntType: {
+      program->constants.push_back(IntegerObject::make((int)value));
+      break;
+    }
+    case FloatType: {
+      float f;
+      memcpy(&f, &value, 4);
+      program->constants.push_back(new FloatObject(f));
+      break;
+    }
+    case BoolType: {
+      program->constants.push_back(BoolObject::make(value != 0));
+      break;
+    }
+    case StringType: {
+      program->constants.push_back(new StringObject(reader.string(value)));
+      break;
+    }
+    default: {
+      throw WscError("invalid constant type");
+    }
+    }
+  }
+  program->global_names = reader.names(HeaderGlobals);
+  program->function_names = reader.names(HeaderFunctionNames);
+  program->builtin_names = reader.names(HeaderBuiltins);
+  for (auto &name : program->builtin_names) {
+    if (BuiltinFunctions.find(name) == BuiltinFunctions.end()) {
+      throw WscError("unknown builtin " + name);
+    }
+  }
+
+  at = reader.header(HeaderFunctions + 1);
+  for (uint32_t i = 0; i < reader.header(HeaderFunctions); i++) {
+    uint32_t record = at + i * FunctionRecordSize * 4;
+    CompiledFunction *func = new CompiledFunction();
+    func->name = reader.string(reader.word(record));
+    func->num_params = reader.word(record + 4);
+    func->num_locals = reader.word(record + 8);
+    func->max_stack = reader.word(record + 12);
+    if (func->num_params < 0 || func->num_locals < func->num_params ||
+        func->max_stack < 0) {
+      throw WscError("invalid function " + func->name);
+    }
+    uint32_t code_size = reader.word(record + 16);
+    uint32_t code = reader.word(record + 20);
+    for (uint32_t pc = 0; pc < code_size; pc++) {
+      func->code.push_back(reader.word(code + pc * 4));
+    }
+    uint32_t num_names = reader.word(record + 24);
+    uint32_t names = reader.word(record + 28);
+    for (uint32_t j = 0; j < num_names; j++) {
+      func->local_names.push_back(reader.string(reader.word(names + j * 4)));
+    }
+    if (func->local_names.size() != func->num_locals) {
+      throw WscError("invalid function " + func->name);
+    }
+    program->functions.push_back(func);
+  }
+  if (program->functions.empty()) {
+    throw WscError("no top-level code");
+  }
+  for (auto func : program->functions) {
+    verify(program, func);
+  }
+  return program;
+}
+
+CompiledProgram *read_wsc(std::string path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw WscError("unable to open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < HeaderSize * 4) {
+    close(fd);
+    throw WscError("truncated file");
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw WscError("unable to map " + path);
+  }
+  WscReader reader;
+  reader.data = (const unsigned char *)data;
+  reader.size = st.st_size;
+  CompiledProgram *program;
+  try {
+    program = read_program(reader);
+  } catch (...) {
+    munmap(data, st.st_size);
+    throw;
+  }
+  munmap(data, st.st_size);
+  return program;
+}
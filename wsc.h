@@ -0,0 +1,33 @@
+#include "bytecode.h"
+#include "common.h"
+
+#ifndef wsc_h
+#define wsc_h
+
+// Compiled program files (.wsc). Everything is a little endian 32 bit word
+// and every reference is an offset from the start of the file, so a file can
+// be mapped and read in place:
+//
+//   header     magic "WSC\0", version, OpCount, then count and offset of the
+//              string, constant, global, function name, builtin and function
+//              tables
+//   strings    length and bytes, padded to a word, per string
+//   constants  DataType and value per constant, strings by string index
+//   names      string indices
+//   functions  name, num_params, num_locals, max_stack, code length and
+//              offset, local name count and offset, per function
+//   code       the CompiledFunction code words
+const uint32_t WscVersion = 1;
+
+class WscError : public std::exception {
+public:
+  std::string error_msg;
+  WscError(std::string err);
+  const char *what() const noexcept override;
+};
+
+void write_wsc(CompiledProgram *program, std::string path);
+
+CompiledProgram *read_wsc(std::string path);
+
+#endif // !wsc_h